@@ -0,0 +1,566 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#include <c64vm.h>
+#include <stdio.h>
+#include <string.h>
+
+// Benchmarks the engines on small guest programs and the memory map and
+// stepping paths from the host. Prints one JSON object per line:
+//   {"name":..., "engine":..., "unit":..., "value":..., "p50":..., "p90":..., "p99":..., "min":..., "max":..., "runs":...}
+// value is the median of the runs, the percentiles are over the runs.
+// Guest results are also reported in ns per memory op where the program is about memory.
+
+#define BENCH_RAM_SIZE 0x400000         // 4 MiB of RAM at 0
+#define BENCH_CODE 0x1000               // where the programs are loaded
+#define BENCH_HANDLER 0x2000            // interrupt handler of the storm
+#define BENCH_COUNTER 0x3000            // written by the storm's handler
+#define BENCH_SOURCE 0x100000           // streamed from
+#define BENCH_DEST 0x200000             // streamed to
+#define BENCH_STACK 0x3ffff8            // initial SP
+#define BENCH_MMIO 0x400000             // status register of the polled device
+#define BENCH_IRQ 1                     // interrupt raised by the storm
+#define BENCH_SLICE 64                  // instructions between interrupts of the storm
+#define BENCH_STREAM_WORDS 65536        // words copied per pass
+#define BENCH_HOST_OPS 65536            // operations per run of a host benchmark
+#define BENCH_MAX_RUNS 1024
+
+typedef struct
+{
+    uint8_t code[256];
+    size_t size;
+} benchProgram_t;
+
+typedef struct benchGuest
+{
+    const char *name;
+    void (*build)(benchProgram_t *program);
+    // Optional, called between slices of BENCH_SLICE instructions, NULL runs to HLT in one go
+    void (*tick)(c64cpu_t *cpu);
+    // Returns NULL if the run computed what it should
+    const char *(*check)(c64cpu_t *cpu);
+    double memoryOps; // guest memory accesses per run, 0 if not about memory
+} benchGuest_t;
+
+static const char *benchEngineNames[] = {"switch", "threaded", "jit"};
+static volatile uint64_t benchSink;
+static uint64_t benchPolls;
+static uint64_t benchInterrupts; // raised by the storm and entered by the time of the next raise
+
+static void bench_emit16(benchProgram_t *program, uint16_t value)
+{
+    memcpy(program->code + program->size, &value, sizeof(value));
+    program->size += sizeof(value);
+}
+
+static void bench_emit8(benchProgram_t *program, uint8_t value)
+{
+    program->code[program->size++] = value;
+}
+
+static void bench_emit64(benchProgram_t *program, uint64_t value)
+{
+    memcpy(program->code + program->size, &value, sizeof(value));
+    program->size += sizeof(value);
+}
+
+static void bench_op(benchProgram_t *program, uint16_t opcode)
+{
+    bench_emit16(program, opcode);
+}
+
+static void bench_opImm(benchProgram_t *program, uint16_t opcode, uint64_t imm)
+{
+    bench_emit16(program, opcode);
+    bench_emit64(program, imm);
+}
+
+static void bench_opReg(benchProgram_t *program, uint16_t opcode, uint8_t reg, uint64_t imm)
+{
+    bench_emit16(program, opcode);
+    bench_emit8(program, reg);
+    bench_emit64(program, imm);
+}
+
+static void bench_opRegs(benchProgram_t *program, uint16_t opcode, uint8_t r1, uint8_t r2)
+{
+    bench_emit16(program, opcode);
+    bench_emit8(program, r1);
+    bench_emit8(program, r2);
+}
+
+static void bench_opIndexed(benchProgram_t *program, uint16_t opcode, uint8_t r1, uint8_t r2, uint8_t r3, uint8_t shift)
+{
+    bench_emit16(program, opcode);
+    bench_emit8(program, r1);
+    bench_emit8(program, r2);
+    bench_emit8(program, r3);
+    bench_emit8(program, shift);
+}
+
+static uint64_t bench_here(benchProgram_t *program)
+{
+    return BENCH_CODE + program->size;
+}
+
+// Register arithmetic and a compare-and-branch back edge
+#define BENCH_ALU_ITERATIONS 2000000
+static void bench_buildAlu(benchProgram_t *program)
+{
+    bench_opReg(program, LDI, REG_R1, 0);
+    bench_opReg(program, LDI, REG_R2, BENCH_ALU_ITERATIONS);
+    bench_opReg(program, LDI, REG_R4, 0);
+    const uint64_t loop = bench_here(program);
+    bench_opReg(program, ADDI, REG_R1, 3);
+    bench_opRegs(program, XOR, REG_R3, REG_R1);
+    bench_opReg(program, SHLI, REG_R3, 1);
+    bench_opRegs(program, ADD, REG_R4, REG_R3);
+    bench_opReg(program, SUBI, REG_R2, 1);
+    bench_opReg(program, CMPI, REG_R2, 0);
+    bench_opImm(program, JNE, loop);
+    bench_op(program, HLT);
+}
+
+static const char *bench_checkAlu(c64cpu_t *cpu)
+{
+    return c64cpu_getReg(cpu, REG_R1) == 3 * (uint64_t)BENCH_ALU_ITERATIONS ? NULL : "R1 is off";
+}
+
+// Naive recursive fibonacci, n in R1 and the result in ACC, which CALL and RTC leave alone
+#define BENCH_FIB_N 27
+#define BENCH_FIB_RESULT 196418
+static void bench_buildCalls(benchProgram_t *program)
+{
+    bench_opReg(program, LDI, REG_R1, BENCH_FIB_N);
+    bench_opImm(program, PUSHI, 0);
+    const size_t call = program->size;
+    bench_opImm(program, CALL, 0);
+    bench_op(program, HLT);
+
+    const uint64_t fib = bench_here(program);
+    memcpy(program->code + call + sizeof(uint16_t), &fib, sizeof(fib));
+    bench_opReg(program, CMPI, REG_R1, 2);
+    const size_t branch = program->size;
+    bench_opImm(program, JLT, 0);
+    // R1 and R2 come back unchanged from every call
+    bench_opReg(program, SUBI, REG_R1, 1);
+    bench_opImm(program, PUSHI, 0);
+    bench_opImm(program, CALL, fib);
+    bench_opRegs(program, TF, REG_ACC, REG_R2);
+    bench_opReg(program, SUBI, REG_R1, 1);
+    bench_opImm(program, PUSHI, 0);
+    bench_opImm(program, CALL, fib);
+    bench_opRegs(program, ADD, REG_ACC, REG_R2);
+    bench_op(program, RTC);
+
+    const uint64_t base = bench_here(program);
+    memcpy(program->code + branch + sizeof(uint16_t), &base, sizeof(base));
+    bench_opRegs(program, TF, REG_R1, REG_ACC);
+    bench_op(program, RTC);
+}
+
+static const char *bench_checkCalls(c64cpu_t *cpu)
+{
+    return c64cpu_getReg(cpu, REG_ACC) == BENCH_FIB_RESULT ? NULL : "ACC is not fib(n)";
+}
+
+// Copies BENCH_STREAM_WORDS words with indexed loads and stores, several passes
+#define BENCH_STREAM_PASSES 16
+static void bench_buildStream(benchProgram_t *program)
+{
+    bench_opReg(program, LDI, REG_R5, BENCH_SOURCE);
+    bench_opReg(program, LDI, REG_R6, BENCH_DEST);
+    bench_opReg(program, LDI, REG_R7, BENCH_STREAM_PASSES);
+    const uint64_t pass = bench_here(program);
+    bench_opReg(program, LDI, REG_R2, 0);
+    const uint64_t loop = bench_here(program);
+    bench_opIndexed(program, LDX, REG_R3, REG_R5, REG_R2, 3);
+    bench_opIndexed(program, STX, REG_R3, REG_R6, REG_R2, 3);
+    bench_opReg(program, ADDI, REG_R2, 1);
+    bench_opReg(program, CMPI, REG_R2, BENCH_STREAM_WORDS);
+    bench_opImm(program, JLT, loop);
+    bench_opReg(program, SUBI, REG_R7, 1);
+    bench_opReg(program, CMPI, REG_R7, 0);
+    bench_opImm(program, JNE, pass);
+    bench_op(program, HLT);
+}
+
+static const char *bench_checkStream(c64cpu_t *cpu)
+{
+    for (uint64_t i = 0; i < BENCH_STREAM_WORDS; i += 4099)
+    {
+        if (c64mm_getUint64(cpu->mm, BENCH_DEST + i * 8) != c64mm_getUint64(cpu->mm, BENCH_SOURCE + i * 8))
+        {
+            return "destination differs from source";
+        }
+    }
+    return NULL;
+}
+
+// Polls a device register until it has counted up to BENCH_MMIO_POLLS
+#define BENCH_MMIO_POLLS 1000000
+static void bench_buildMmio(benchProgram_t *program)
+{
+    const uint64_t loop = bench_here(program);
+    bench_opReg(program, LDM, REG_R1, BENCH_MMIO);
+    bench_opReg(program, CMPI, REG_R1, BENCH_MMIO_POLLS);
+    bench_opImm(program, JLT, loop);
+    bench_op(program, HLT);
+}
+
+static const char *bench_checkMmio(c64cpu_t *cpu)
+{
+    (void)cpu;
+    return benchPolls == BENCH_MMIO_POLLS ? NULL : "device was not polled once per iteration";
+}
+
+// Counts up while the host raises an interrupt every BENCH_SLICE instructions
+#define BENCH_STORM_ITERATIONS 1000000
+static void bench_buildStorm(benchProgram_t *program)
+{
+    bench_op(program, CLI);
+    bench_opReg(program, LDI, REG_R1, 0);
+    const uint64_t loop = bench_here(program);
+    bench_opReg(program, ADDI, REG_R1, 1);
+    bench_opReg(program, CMPI, REG_R1, BENCH_STORM_ITERATIONS);
+    bench_opImm(program, JLT, loop);
+    bench_op(program, HLT);
+}
+
+static void bench_tickStorm(c64cpu_t *cpu)
+{
+    if (!(cpu->pending & ((uint64_t)1 << BENCH_IRQ)))
+    {
+        benchInterrupts++;
+    }
+    c64cpu_raiseInterrupt(cpu, BENCH_IRQ);
+}
+
+static const char *bench_checkStorm(c64cpu_t *cpu)
+{
+    if (c64cpu_getReg(cpu, REG_R1) != BENCH_STORM_ITERATIONS)
+    {
+        return "R1 is off";
+    }
+    return benchInterrupts > 1 && c64mm_getUint64(cpu->mm, BENCH_COUNTER) != 0 ? NULL : "no interrupt was entered";
+}
+
+static const benchGuest_t benchGuests[] = {
+    {"guest.alu", bench_buildAlu, NULL, bench_checkAlu, 0},
+    {"guest.calls", bench_buildCalls, NULL, bench_checkCalls, 0},
+    {"guest.stream", bench_buildStream, NULL, bench_checkStream, 2.0 * BENCH_STREAM_WORDS * BENCH_STREAM_PASSES},
+    {"guest.mmio", bench_buildMmio, NULL, bench_checkMmio, BENCH_MMIO_POLLS},
+    {"guest.storm", bench_buildStorm, bench_tickStorm, bench_checkStorm, 0},
+};
+
+static uint64_t bench_pollStatus(c64dev_t *device, uint64_t address)
+{
+    (void)device;
+    (void)address;
+    return ++benchPolls;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of sorted samples
+static double bench_percentile(const double *sorted, size_t count, double percent)
+{
+    size_t rank = (size_t)(percent / 100.0 * count + 0.999999);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    return sorted[(rank > count ? count : rank) - 1];
+}
+
+static void bench_report(const char *name, const char *engine, const char *unit, double *samples, size_t count)
+{
+    qsort(samples, count, sizeof(double), bench_compare);
+    printf("{\"name\":\"%s\",\"engine\":\"%s\",\"unit\":\"%s\",\"value\":%.6g,\"p50\":%.6g,\"p90\":%.6g,\"p99\":%.6g,\"min\":%.6g,\"max\":%.6g,\"runs\":%zu}\n",
+           name, engine, unit, bench_percentile(samples, count, 50), bench_percentile(samples, count, 50),
+           bench_percentile(samples, count, 90), bench_percentile(samples, count, 99), samples[0], samples[count - 1], count);
+    fflush(stdout);
+}
+
+// RAM at 0 and the polled device at BENCH_MMIO, interrupt vectors at 0
+static c64cpu_t *bench_createMachine(char engine)
+{
+    c64mm_t *mm = c64mm_create();
+    c64cpu_t *cpu = c64cpu_create(mm, 0);
+    c64mm_map(mm, c64mem_createDevice(BENCH_RAM_SIZE, cpu), 0, BENCH_RAM_SIZE - 1, 1);
+
+    c64dev_t *status = c64mem_createDevice(0x1000, cpu);
+    strcpy(status->name, "Status");
+    status->host = NULL;
+    status->attributes = MM_READ | MM_WRITE | MM_MMIO;
+    status->getUint64 = bench_pollStatus;
+    c64mm_map(mm, status, BENCH_MMIO, BENCH_MMIO + 0xfff, 1);
+
+    c64cpu_setEngine(cpu, engine);
+    return cpu;
+}
+
+static void bench_reset(c64cpu_t *cpu)
+{
+    for (size_t i = REG_ACC; i <= REG_R8; i++)
+    {
+        c64cpu_setReg(cpu, i, 0);
+    }
+    c64cpu_setReg(cpu, REG_SP, BENCH_STACK);
+    c64cpu_setReg(cpu, REG_FP, BENCH_STACK);
+    c64cpu_setReg(cpu, REG_IP, BENCH_CODE);
+    c64cpu_setFlag(cpu, FLAG_INTERRUPT, 1);
+    cpu->pending = 0;
+    benchPolls = 0;
+    benchInterrupts = 0;
+    c64mm_setUint64(cpu->mm, BENCH_COUNTER, 0);
+}
+
+// Runs the program once, returns the nanoseconds it took and the instructions it retired
+static uint64_t bench_runGuest(c64cpu_t *cpu, const benchGuest_t *guest, uint64_t *retired)
+{
+    bench_reset(cpu);
+    const uint64_t before = cpu->retired;
+    const uint64_t start = monotonicNs();
+    for (;;)
+    {
+        const uint8_t stop = c64cpu_runFor(cpu, guest->tick != NULL ? BENCH_SLICE : UINT64_MAX);
+        if (stop == RUN_HALTED)
+        {
+            break;
+        }
+        if (stop == RUN_FAULT)
+        {
+            error("c64bench: %s faulted at 0x%lx\n", guest->name, (unsigned long)c64cpu_getReg(cpu, REG_IP));
+        }
+        if (guest->tick != NULL)
+        {
+            guest->tick(cpu);
+        }
+    }
+    const uint64_t elapsed = monotonicNs() - start;
+    *retired = cpu->retired - before;
+    return elapsed ? elapsed : 1;
+}
+
+static void bench_guest(const benchGuest_t *guest, char engine, size_t runs)
+{
+    c64cpu_t *cpu = bench_createMachine(engine);
+    benchProgram_t program = {{0}, 0};
+    guest->build(&program);
+    c64mm_write(cpu->mm, BENCH_CODE, program.code, program.size);
+
+    // The storm's handler records where the loop was. Interrupts do not save the
+    // flags, so it must not touch them or the interrupted compare is lost.
+    benchProgram_t handler = {{0}, 0};
+    bench_opReg(&handler, ST, REG_R1, BENCH_COUNTER);
+    bench_op(&handler, RTI);
+    c64mm_write(cpu->mm, BENCH_HANDLER, handler.code, handler.size);
+    c64mm_setUint64(cpu->mm, BENCH_IRQ * sizeof(uint64_t), BENCH_HANDLER);
+    for (uint64_t i = 0; i < BENCH_STREAM_WORDS; i++)
+    {
+        c64mm_setUint64(cpu->mm, BENCH_SOURCE + i * 8, i * 0x9e3779b97f4a7c15ull);
+    }
+
+    // Warms the decode cache and the JIT
+    uint64_t retired;
+    bench_runGuest(cpu, guest, &retired);
+
+    double rates[BENCH_MAX_RUNS];
+    double memoryOps[BENCH_MAX_RUNS];
+    for (size_t i = 0; i < runs; i++)
+    {
+        const uint64_t elapsed = bench_runGuest(cpu, guest, &retired);
+        const char *problem = guest->check(cpu);
+        if (problem != NULL)
+        {
+            error("c64bench: %s on %s: %s\n", guest->name, benchEngineNames[(int)engine], problem);
+        }
+        rates[i] = retired * 1e9 / elapsed;
+        memoryOps[i] = guest->memoryOps > 0 ? elapsed / guest->memoryOps : 0;
+    }
+    bench_report(guest->name, benchEngineNames[(int)engine], "instructions/s", rates, runs);
+    if (guest->memoryOps > 0)
+    {
+        bench_report(guest->name, benchEngineNames[(int)engine], "ns/memop", memoryOps, runs);
+    }
+    c64cpu_destroy(cpu);
+}
+
+// Host side, each run times BENCH_HOST_OPS calls
+#define BENCH_HOST_REGIONS 16
+#define BENCH_HOST_REGION_SIZE 0x10000
+
+static uint64_t bench_hostFindRegion(c64cpu_t *cpu, c64dev_t *device)
+{
+    (void)device;
+    uint64_t sum = 0;
+    uint64_t address = 0;
+    const uint64_t start = monotonicNs();
+    for (size_t i = 0; i < BENCH_HOST_OPS; i++)
+    {
+        // Walks all the regions, a few pages apart each time
+        address = (address + 0x13008) % ((uint64_t)BENCH_HOST_REGIONS * BENCH_HOST_REGION_SIZE);
+        sum += (uintptr_t)c64mm_findRegion(cpu->mm, address);
+    }
+    benchSink += sum;
+    return monotonicNs() - start;
+}
+
+static uint64_t bench_hostGetUint64(c64cpu_t *cpu, c64dev_t *device)
+{
+    (void)cpu;
+    uint64_t sum = 0;
+    const uint64_t start = monotonicNs();
+    for (size_t i = 0; i < BENCH_HOST_OPS; i++)
+    {
+        sum += c64mem_getUint64(device, (i * 8) & (BENCH_HOST_REGION_SIZE - 8));
+    }
+    benchSink += sum;
+    return monotonicNs() - start;
+}
+
+static uint64_t bench_hostSetUint64(c64cpu_t *cpu, c64dev_t *device)
+{
+    (void)cpu;
+    const uint64_t start = monotonicNs();
+    for (size_t i = 0; i < BENCH_HOST_OPS; i++)
+    {
+        c64mem_setUint64(device, (i * 8) & (BENCH_HOST_REGION_SIZE - 8), i);
+    }
+    return monotonicNs() - start;
+}
+
+static uint64_t bench_hostGetUint8(c64cpu_t *cpu, c64dev_t *device)
+{
+    (void)cpu;
+    uint64_t sum = 0;
+    const uint64_t start = monotonicNs();
+    for (size_t i = 0; i < BENCH_HOST_OPS; i++)
+    {
+        sum += c64mem_getUint8(device, i & (BENCH_HOST_REGION_SIZE - 1));
+    }
+    benchSink += sum;
+    return monotonicNs() - start;
+}
+
+static uint64_t bench_hostSetUint8(c64cpu_t *cpu, c64dev_t *device)
+{
+    (void)cpu;
+    const uint64_t start = monotonicNs();
+    for (size_t i = 0; i < BENCH_HOST_OPS; i++)
+    {
+        c64mem_setUint8(device, i & (BENCH_HOST_REGION_SIZE - 1), (uint8_t)i);
+    }
+    return monotonicNs() - start;
+}
+
+// Steps the ALU loop, which runs far longer than the benchmark does
+static uint64_t bench_hostStep(c64cpu_t *cpu, c64dev_t *device)
+{
+    (void)device;
+    const uint64_t start = monotonicNs();
+    for (size_t i = 0; i < BENCH_HOST_OPS; i++)
+    {
+        c64cpu_step(cpu);
+    }
+    return monotonicNs() - start;
+}
+
+typedef struct
+{
+    const char *name;
+    uint64_t (*run)(c64cpu_t *cpu, c64dev_t *device);
+} benchHost_t;
+
+static const benchHost_t benchHosts[] = {
+    {"host.c64mm_findRegion", bench_hostFindRegion},
+    {"host.c64mem_getUint64", bench_hostGetUint64},
+    {"host.c64mem_setUint64", bench_hostSetUint64},
+    {"host.c64mem_getUint8", bench_hostGetUint8},
+    {"host.c64mem_setUint8", bench_hostSetUint8},
+    {"host.c64cpu_step", bench_hostStep},
+};
+
+static void bench_host(const benchHost_t *host, size_t runs)
+{
+    // BENCH_HOST_REGIONS devices back to back, the last one is accessed directly
+    c64mm_t *mm = c64mm_create();
+    c64cpu_t *cpu = c64cpu_create(mm, 0);
+    c64dev_t *device = NULL;
+    for (uint64_t i = 0; i < BENCH_HOST_REGIONS; i++)
+    {
+        const uint64_t start = i * BENCH_HOST_REGION_SIZE;
+        device = c64mem_createDevice(BENCH_HOST_REGION_SIZE, cpu);
+        c64mm_map(mm, device, start, start + BENCH_HOST_REGION_SIZE - 1, 1);
+    }
+    benchProgram_t program = {{0}, 0};
+    bench_buildAlu(&program);
+    c64mm_write(mm, BENCH_CODE, program.code, program.size);
+    c64cpu_setReg(cpu, REG_IP, BENCH_CODE);
+
+    // Warm up, the device pages are touched and the code decoded
+    host->run(cpu, device);
+    double samples[BENCH_MAX_RUNS];
+    for (size_t i = 0; i < runs; i++)
+    {
+        samples[i] = (double)host->run(cpu, device) / BENCH_HOST_OPS;
+    }
+    bench_report(host->name, "host", "ns/op", samples, runs);
+    c64cpu_destroy(cpu);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 3)
+    {
+        out("Usage: c64bench [runs] [filter]");
+        return EXIT_FAILURE;
+    }
+    const size_t runs = argc > 1 ? (size_t)strtoul(argv[1], NULL, 0) : 10;
+    if (runs < 1 || runs > BENCH_MAX_RUNS)
+    {
+        error("c64bench: runs must be between 1 and %d\n", BENCH_MAX_RUNS);
+    }
+    // Only benchmarks with the filter in their name are run
+    const char *filter = argc > 2 ? argv[2] : "";
+
+    for (size_t i = 0; i < sizeof(benchGuests) / sizeof(benchGuests[0]); i++)
+    {
+        if (strstr(benchGuests[i].name, filter) == NULL)
+        {
+            continue;
+        }
+        for (char engine = ENGINE_SWITCH; engine <= ENGINE_JIT; engine++)
+        {
+            bench_guest(&benchGuests[i], engine, runs);
+        }
+    }
+    for (size_t i = 0; i < sizeof(benchHosts) / sizeof(benchHosts[0]); i++)
+    {
+        if (strstr(benchHosts[i].name, filter) != NULL)
+        {
+            bench_host(&benchHosts[i], runs);
+        }
+    }
+    return 0;
+}
\ No newline at end of file
@@ -17,6 +17,9 @@ along with c64vm. If not, see <https://mit-license.org/>.
 */
 #include <c64cpu.h>
 
+static uint64_t c64cpu_runThreaded(c64cpu_t *cpu, uint64_t count);
+static void c64cpu_reportFault(c64cpu_t *cpu);
+
 c64cpu_t *c64cpu_create(c64mm_t *mm, uint64_t interruptVectorAddress)
 {
     c64cpu_t *cpu = (c64cpu_t *)malloc(sizeof(c64cpu_t));
@@ -26,8 +29,11 @@ c64cpu_t *c64cpu_create(c64mm_t *mm, uint64_t interruptVectorAddress)
     }
 
     cpu->mm = mm;
+    c64mm_retain(mm);
+    c64tlb_init(&cpu->tlb, mm);
 
-    cpu->registers = c64cpu_createRegisters(cpu);
+    memset(cpu->regs, 0, sizeof(cpu->regs));
+    memset(cpu->vregs, 0, sizeof(cpu->vregs));
 
     cpu->regNames[REG_IP] = "IP";
     cpu->regNames[REG_ACC] = "ACC";
@@ -45,24 +51,57 @@ c64cpu_t *c64cpu_create(c64mm_t *mm, uint64_t interruptVectorAddress)
     cpu->regNames[REG_IM] = "IM";
 
     cpu->flags = 0;
+    cpu->flagsKind = FLAGS_NONE;
+    cpu->flagsPrevious = 0;
+    cpu->flagsResult = 0;
 
     cpu->interruptVectorAddress = interruptVectorAddress;
     c64cpu_setFlag(cpu, FLAG_INTERRUPT, 1);
-    c64cpu_setRegister(cpu, "IM", 0xffffffff);
+    c64cpu_setReg(cpu, REG_IM, 0xffffffff);
 
-    c64cpu_setRegister(cpu, "SP", 0xffffffff - 1);
-    c64cpu_setRegister(cpu, "FP", 0xffffffff - 1);
+    c64cpu_setReg(cpu, REG_SP, 0xffffffff - 1);
+    c64cpu_setReg(cpu, REG_FP, 0xffffffff - 1);
 
     cpu->stackFrameSize = 0;
+    cpu->leafReturn = 0;
+    cpu->stackHost = NULL;
+    cpu->stackLow = 0;
+    cpu->stackSize = 0;
+    cpu->stackGen = 0;
+    cpu->stackBounded = 0;
+    cpu->stackBottom = 0;
+    cpu->stackTop = UINT64_MAX;
+
+    cpu->rate = c64cpu_speed;
+    cpu->throttleStart = 0;
+    cpu->throttleCount = 0;
+
+    cpu->retired = 0;
+    cpu->stop = RUN_BUDGET;
+    cpu->fault = FAULT_NONE;
+    cpu->pending = 0;
+    cpu->breakpointCount = 0;
+
+    cpu->waitAddress = 0;
+    cpu->waitValue = 0;
+    cpu->waitWidth = sizeof(uint64_t);
+    cpu->woken = 0;
+    cpu->parked = 0;
+    cpu->waitCond = condCreate();
+    cpu->waitNext = NULL;
+
+    cpu->engine = ENGINE_SWITCH;
+    cpu->jit = NULL;
+    cpu->jitFuel = 0;
+    cpu->jitLastExit = NULL;
+    cpu->prof = NULL;
+    cpu->sampler = NULL;
+    c64cpu_runThreaded(NULL, 0);
+    c64decode_flush(cpu->icache, ICACHE_SIZE);
 
     return cpu;
 }
 
-c64dev_t *c64cpu_createRegisters(c64cpu_t *cpu)
-{
-    return c64mem_createDevice(REG_COUNT * sizeof(uint64_t), cpu);
-}
-
 size_t _c16cpu_getRegisterIndex(c64cpu_t *cpu, char *regName)
 {
     for (size_t i = 0; i < REG_COUNT; i++)
@@ -76,25 +115,103 @@ size_t _c16cpu_getRegisterIndex(c64cpu_t *cpu, char *regName)
     return 0;
 }
 
-uint64_t c64cpu_mapRegisterToOffset(c64cpu_t *cpu, char *regName)
+uint64_t c64cpu_getRegister(c64cpu_t *cpu, char *regName)
 {
-    return _c16cpu_getRegisterIndex(cpu, regName) * sizeof(uint64_t);
+    return cpu->regs[_c16cpu_getRegisterIndex(cpu, regName)];
 }
 
-uint64_t c64cpu_getRegister(c64cpu_t *cpu, char *regName)
+void c64cpu_setRegister(c64cpu_t *cpu, char *regName, uint64_t value)
 {
-    size_t offset = c64cpu_mapRegisterToOffset(cpu, regName);
-    return c64mem_getUint64(cpu->registers, offset);
+    cpu->regs[_c16cpu_getRegisterIndex(cpu, regName)] = value;
 }
 
-void c64cpu_setRegister(c64cpu_t *cpu, char *regName, uint64_t value)
+// Flags written by each FLAGS_* kind
+static const char c64cpu_flagsMask[FLAGS_COUNT] = {
+    [FLAGS_NONE] = 0,
+    [FLAGS_LOGIC] = FLAG_ZERO | FLAG_NEGATIVE,
+    [FLAGS_ADD] = FLAG_CARRY | FLAG_ZERO | FLAG_NEGATIVE | FLAG_OVERFLOW,
+    [FLAGS_SUB] = FLAG_CARRY | FLAG_ZERO | FLAG_NEGATIVE | FLAG_OVERFLOW,
+    [FLAGS_MULS] = FLAG_CARRY | FLAG_ZERO | FLAG_NEGATIVE | FLAG_OVERFLOW,
+    [FLAGS_DIVS] = FLAG_CARRY | FLAG_ZERO | FLAG_NEGATIVE | FLAG_OVERFLOW,
+    [FLAGS_SHL] = FLAG_CARRY | FLAG_ZERO | FLAG_NEGATIVE,
+    [FLAGS_SHR] = FLAG_CARRY | FLAG_ZERO | FLAG_NEGATIVE,
+    [FLAGS_CMP] = FLAG_CARRY | FLAG_ZERO | FLAG_NEGATIVE,
+};
+
+// C (and V where written) compare the result to the previous value:
+// above or below, signed compares flip the sign bit of both first
+static const char c64cpu_flagsAbove[FLAGS_COUNT] = {
+    [FLAGS_SUB] = 1,
+    [FLAGS_DIVS] = 1,
+    [FLAGS_SHR] = 1,
+    [FLAGS_CMP] = 1,
+};
+
+static const uint64_t c64cpu_flagsSign[FLAGS_COUNT] = {
+    [FLAGS_MULS] = 0x8000000000000000,
+    [FLAGS_DIVS] = 0x8000000000000000,
+};
+
+static inline char c64cpu_evalFlags(uint8_t kind, uint64_t previous, uint64_t result)
+{
+    const uint64_t p = previous ^ c64cpu_flagsSign[kind];
+    const uint64_t r = result ^ c64cpu_flagsSign[kind];
+    const char carry = c64cpu_flagsAbove[kind] ? r > p : r < p;
+
+    const char flags = (carry ? FLAG_CARRY | FLAG_OVERFLOW : 0) |
+                       (result == 0 ? FLAG_ZERO : 0) |
+                       ((result >> 63) ? FLAG_NEGATIVE : 0);
+    return flags & c64cpu_flagsMask[kind];
+}
+
+static inline void c64cpu_applyFlags(c64cpu_t *cpu)
+{
+    const uint8_t kind = cpu->flagsKind;
+    cpu->flags = (cpu->flags & ~c64cpu_flagsMask[kind]) | c64cpu_evalFlags(kind, cpu->flagsPrevious, cpu->flagsResult);
+    cpu->flagsKind = FLAGS_NONE;
+}
+
+void c64cpu_materializeFlags(c64cpu_t *cpu)
+{
+    c64cpu_applyFlags(cpu);
+}
+
+// Z or N for the conditional jumps. Every kind writes both from the
+// result alone, so a pending update is read without applying it.
+static inline char c64cpu_branchFlag(c64cpu_t *cpu, char flag)
+{
+#if LAZY_FLAGS
+    if (cpu->flagsKind != FLAGS_NONE)
+    {
+        return flag == FLAG_ZERO ? cpu->flagsResult == 0 : (cpu->flagsResult >> 63) != 0;
+    }
+#endif
+    return (cpu->flags & flag) != 0;
+}
+
+// Sets the flags of an ALU instruction from its previous and new value
+static inline void c64cpu_setFlags(c64cpu_t *cpu, uint8_t kind, uint64_t previous, uint64_t result)
 {
-    size_t offset = c64cpu_mapRegisterToOffset(cpu, regName);
-    c64mem_setUint64(cpu->registers, offset, value);
+#if LAZY_FLAGS
+    // Flags the new kind leaves alone may still be pending from the last one
+    if (c64cpu_flagsMask[cpu->flagsKind] & ~c64cpu_flagsMask[kind])
+    {
+        c64cpu_applyFlags(cpu);
+    }
+    cpu->flagsKind = kind;
+    cpu->flagsPrevious = previous;
+    cpu->flagsResult = result;
+#else
+    cpu->flags = (cpu->flags & ~c64cpu_flagsMask[kind]) | c64cpu_evalFlags(kind, previous, result);
+#endif
 }
 
 void c64cpu_setFlag(c64cpu_t *cpu, char flag, char value)
 {
+    if (c64cpu_flagsMask[cpu->flagsKind] & flag)
+    {
+        c64cpu_materializeFlags(cpu);
+    }
     if (value)
     {
         cpu->flags |= flag;
@@ -107,150 +224,282 @@ void c64cpu_setFlag(c64cpu_t *cpu, char flag, char value)
 
 char c64cpu_getFlag(c64cpu_t *cpu, char flag)
 {
+    if (c64cpu_flagsMask[cpu->flagsKind] & flag)
+    {
+        c64cpu_materializeFlags(cpu);
+    }
     return cpu->flags & flag;
 }
 
 uint8_t c64cpu_fetch(c64cpu_t *cpu)
 {
-    uint64_t nextInstructionAddress = c64cpu_getRegister(cpu, "IP");
-    uint8_t instruction = c64mm_getUint8(cpu->mm, nextInstructionAddress);
-    c64cpu_setRegister(cpu, "IP", nextInstructionAddress + sizeof(uint8_t));
+    uint64_t nextInstructionAddress = c64cpu_getReg(cpu, REG_IP);
+    uint8_t instruction = c64tlb_getUint8(&cpu->tlb, nextInstructionAddress);
+    c64cpu_setReg(cpu, REG_IP, nextInstructionAddress + sizeof(uint8_t));
     return instruction;
 }
 
 uint16_t c64cpu_fetch16(c64cpu_t *cpu)
 {
-    uint64_t nextInstructionAddress = c64cpu_getRegister(cpu, "IP");
-    uint16_t instruction = c64mm_getUint16(cpu->mm, nextInstructionAddress);
-    c64cpu_setRegister(cpu, "IP", nextInstructionAddress + sizeof(uint16_t));
+    uint64_t nextInstructionAddress = c64cpu_getReg(cpu, REG_IP);
+    uint16_t instruction = c64tlb_getUint16(&cpu->tlb, nextInstructionAddress);
+    c64cpu_setReg(cpu, REG_IP, nextInstructionAddress + sizeof(uint16_t));
     return instruction;
 }
 
 uint32_t c64cpu_fetch32(c64cpu_t *cpu)
 {
-    uint64_t nextInstructionAddress = c64cpu_getRegister(cpu, "IP");
-    uint32_t instruction = c64mm_getUint32(cpu->mm, nextInstructionAddress);
-    c64cpu_setRegister(cpu, "IP", nextInstructionAddress + sizeof(uint32_t));
+    uint64_t nextInstructionAddress = c64cpu_getReg(cpu, REG_IP);
+    uint32_t instruction = c64tlb_getUint32(&cpu->tlb, nextInstructionAddress);
+    c64cpu_setReg(cpu, REG_IP, nextInstructionAddress + sizeof(uint32_t));
     return instruction;
 }
 
 uint64_t c64cpu_fetch64(c64cpu_t *cpu)
 {
-    uint64_t nextInstructionAddress = c64cpu_getRegister(cpu, "IP");
-    uint64_t instruction = c64mm_getUint64(cpu->mm, nextInstructionAddress);
-    c64cpu_setRegister(cpu, "IP", nextInstructionAddress + sizeof(uint64_t));
+    uint64_t nextInstructionAddress = c64cpu_getReg(cpu, REG_IP);
+    uint64_t instruction = c64tlb_getUint64(&cpu->tlb, nextInstructionAddress);
+    c64cpu_setReg(cpu, REG_IP, nextInstructionAddress + sizeof(uint64_t));
     return instruction;
 }
 
-void c64cpu_push(c64cpu_t *cpu, uint64_t value)
+// Looks for the stack window around address, see c64cpu_stackWindow
+static uint8_t *c64cpu_findStack(c64cpu_t *cpu, uint64_t address, size_t size)
 {
-    uint64_t sp = c64cpu_getRegister(cpu, "SP");
-    c64mm_setUint64(cpu->mm, sp, value);
-    c64cpu_setRegister(cpu, "SP", sp - sizeof(uint64_t));
+    uint64_t low = cpu->stackBounded ? cpu->stackBottom : 0;
+    uint64_t high = cpu->stackBounded ? cpu->stackTop : UINT64_MAX;
+    // Taken first, a change on another thread while looking makes the window stale
+    cpu->stackGen = MM_LOAD(cpu->mm->mapGen);
+    cpu->stackHost = c64mm_hostRange(cpu->mm, address, &low, &high);
+    cpu->stackLow = low;
+    cpu->stackSize = cpu->stackHost == NULL ? 0 : high - low + 1;
+
+    const uint64_t offset = address - cpu->stackLow;
+    if (offset >= cpu->stackSize || cpu->stackSize - offset < size)
+    {
+        return NULL;
+    }
+    return cpu->stackHost + offset;
 }
 
-void c64cpu_push32(c64cpu_t *cpu, uint32_t value)
+// Host address of size bytes of stack at address, NULL if they are not in the
+// stack window
+static inline uint8_t *c64cpu_stackWindow(c64cpu_t *cpu, uint64_t address, size_t size)
 {
-    uint64_t sp = c64cpu_getRegister(cpu, "SP");
-    c64mm_setUint32(cpu->mm, sp, value);
-    c64cpu_setRegister(cpu, "SP", sp - sizeof(uint32_t));
+    const uint64_t offset = address - cpu->stackLow;
+    if (cpu->stackGen != MM_LOAD(cpu->mm->mapGen) || offset >= cpu->stackSize || cpu->stackSize - offset < size)
+    {
+        return c64cpu_findStack(cpu, address, size);
+    }
+    return cpu->stackHost + offset;
 }
 
-void c64cpu_push16(c64cpu_t *cpu, uint16_t value)
+// c64cpu_stackWindow for guest stack accesses, NULL if they have to go
+// through the TLB. While tracing they always do, so they are recorded.
+static inline uint8_t *c64cpu_stackAt(c64cpu_t *cpu, uint64_t address, size_t size)
 {
-    uint64_t sp = c64cpu_getRegister(cpu, "SP");
-    c64mm_setUint16(cpu->mm, sp, value);
-    c64cpu_setRegister(cpu, "SP", sp - sizeof(uint16_t));
+    return c64tlb_tracing(&cpu->tlb) ? NULL : c64cpu_stackWindow(cpu, address, size);
 }
 
-void c64cpu_push8(c64cpu_t *cpu, uint8_t value)
+void c64cpu_setStack(c64cpu_t *cpu, uint64_t bottom, uint64_t top)
 {
-    uint64_t sp = c64cpu_getRegister(cpu, "SP");
-    c64mm_setUint8(cpu->mm, sp, value);
-    c64cpu_setRegister(cpu, "SP", sp - sizeof(uint8_t));
+    cpu->stackBounded = bottom <= top;
+    cpu->stackBottom = cpu->stackBounded ? bottom : 0;
+    cpu->stackTop = cpu->stackBounded ? top : UINT64_MAX;
+    cpu->stackSize = 0;
+    // PUSHICALL is only fused without bounds
+    c64decode_flush(cpu->icache, ICACHE_SIZE);
 }
 
-uint64_t c64cpu_pop(c64cpu_t *cpu)
+size_t c64cpu_unwind(c64cpu_t *cpu, uint64_t *frames, size_t max)
 {
-    uint64_t nextSpAddress = c64cpu_getRegister(cpu, "SP") + sizeof(uint64_t);
-    c64cpu_setRegister(cpu, "SP", nextSpAddress);
-    cpu->stackFrameSize -= sizeof(uint64_t);
-    return c64mm_getUint64(cpu->mm, nextSpAddress);
+    size_t depth = 0;
+    uint64_t fp = c64cpu_getReg(cpu, REG_FP);
+    if (max == 0)
+    {
+        return 0;
+    }
+    frames[depth++] = c64cpu_getReg(cpu, REG_IP);
+    uint64_t below = c64cpu_getReg(cpu, REG_SP);
+    while (depth < max)
+    {
+        // Inside a CALLM leaf FP is still its caller's, the leaf's return
+        // address sits between that frame and whatever ran below it
+        if (cpu->leafReturn > below && cpu->leafReturn < fp)
+        {
+            const uint8_t *leaf = c64cpu_stackWindow(cpu, cpu->leafReturn, sizeof(uint64_t));
+            if (leaf == NULL)
+            {
+                break;
+            }
+            memcpy(&frames[depth++], leaf, sizeof(uint64_t));
+            if (depth == max)
+            {
+                break;
+            }
+        }
+        // The distance to the caller's frame and the return address, see c64cpu_pushState
+        const uint8_t *host = c64cpu_stackWindow(cpu, fp + sizeof(uint64_t), 2 * sizeof(uint64_t));
+        if (host == NULL)
+        {
+            break;
+        }
+        uint64_t frame[2];
+        memcpy(frame, host, sizeof(frame));
+        if (frame[0] < sizeof(uint64_t) || fp + frame[0] < fp)
+        {
+            break;
+        }
+        frames[depth++] = frame[1];
+        below = fp;
+        fp += frame[0];
+    }
+    return depth;
 }
 
-uint32_t c64cpu_pop32(c64cpu_t *cpu)
+// Whether count words pushed at sp (count > 0) or popped from above it
+// (count < 0) stay within the bounds set by c64cpu_setStack
+static inline char c64cpu_stackFits(const c64cpu_t *cpu, uint64_t sp, int64_t count)
 {
-    uint64_t nextSpAddress = c64cpu_getRegister(cpu, "SP") + sizeof(uint32_t);
-    c64cpu_setRegister(cpu, "SP", nextSpAddress);
-    cpu->stackFrameSize -= sizeof(uint32_t);
-    return c64mm_getUint32(cpu->mm, nextSpAddress);
+    if (!cpu->stackBounded)
+    {
+        return 1;
+    }
+    const uint64_t low = count > 0 ? sp - (uint64_t)(count - 1) * sizeof(uint64_t) : sp + sizeof(uint64_t);
+    const uint64_t high = count > 0 ? sp + sizeof(uint64_t) - 1 : sp + (uint64_t)(-count) * sizeof(uint64_t) + sizeof(uint64_t) - 1;
+    return low <= high && low >= cpu->stackBottom && high <= cpu->stackTop;
 }
 
-uint16_t c64cpu_pop16(c64cpu_t *cpu)
+// Pushes and pops go straight to the stack window while SP is in it
+#define STACK_ACCESS(suffix, type, name)                               \
+    void c64cpu_push##suffix(c64cpu_t *cpu, type value)                \
+    {                                                                  \
+        const uint64_t sp = c64cpu_getReg(cpu, REG_SP);                \
+        uint8_t *host = c64cpu_stackAt(cpu, sp, sizeof(type));         \
+        if (host != NULL)                                              \
+        {                                                              \
+            memcpy(host, &value, sizeof(type));                        \
+            c64mm_touch(cpu->mm, sp, sizeof(type));                    \
+        }                                                              \
+        else                                                           \
+        {                                                              \
+            c64tlb_set##name(&cpu->tlb, sp, value);                    \
+        }                                                              \
+        c64cpu_setReg(cpu, REG_SP, sp - sizeof(type));                 \
+        cpu->stackFrameSize += sizeof(type);                           \
+    }                                                                  \
+                                                                       \
+    type c64cpu_pop##suffix(c64cpu_t *cpu)                             \
+    {                                                                  \
+        const uint64_t sp = c64cpu_getReg(cpu, REG_SP) + sizeof(type); \
+        const uint8_t *host = c64cpu_stackAt(cpu, sp, sizeof(type));   \
+        type value;                                                    \
+        c64cpu_setReg(cpu, REG_SP, sp);                                \
+        cpu->stackFrameSize -= sizeof(type);                           \
+        if (host == NULL)                                              \
+        {                                                              \
+            return c64tlb_get##name(&cpu->tlb, sp);                    \
+        }                                                              \
+        memcpy(&value, host, sizeof(type));                            \
+        return value;                                                  \
+    }
+
+STACK_ACCESS(, uint64_t, Uint64)
+STACK_ACCESS(32, uint32_t, Uint32)
+STACK_ACCESS(16, uint16_t, Uint16)
+STACK_ACCESS(8, uint8_t, Uint8)
+#undef STACK_ACCESS
+
+// Stores count words ascending from address with a single copy when they
+// are in the stack window, word by word through the TLB otherwise
+static void c64cpu_storeWords(c64cpu_t *cpu, uint64_t address, const uint64_t *words, size_t count)
 {
-    uint64_t nextSpAddress = c64cpu_getRegister(cpu, "SP") + sizeof(uint16_t);
-    c64cpu_setRegister(cpu, "SP", nextSpAddress);
-    cpu->stackFrameSize -= sizeof(uint16_t);
-    return c64mm_getUint16(cpu->mm, nextSpAddress);
+    const size_t size = count * sizeof(uint64_t);
+    uint8_t *host = c64cpu_stackAt(cpu, address, size);
+    if (host == NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            c64tlb_setUint64(&cpu->tlb, address + i * sizeof(uint64_t), words[i]);
+        }
+        return;
+    }
+    memcpy(host, words, size);
+    c64mm_touchBlock(cpu->mm, address, size);
 }
 
-uint8_t c64cpu_pop8(c64cpu_t *cpu)
+static void c64cpu_loadWords(c64cpu_t *cpu, uint64_t address, uint64_t *words, size_t count)
 {
-    uint64_t nextSpAddress = c64cpu_getRegister(cpu, "SP") + sizeof(uint8_t);
-    c64cpu_setRegister(cpu, "SP", nextSpAddress);
-    cpu->stackFrameSize -= sizeof(uint8_t);
-    return c64mm_getUint8(cpu->mm, nextSpAddress);
+    const size_t size = count * sizeof(uint64_t);
+    const uint8_t *host = c64cpu_stackAt(cpu, address, size);
+    if (host == NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            words[i] = c64tlb_getUint64(&cpu->tlb, address + i * sizeof(uint64_t));
+        }
+        return;
+    }
+    memcpy(words, host, size);
 }
 
+// Pushes R1-R8, IP and the frame size as one block.
+// The frame looks as if every word was pushed on its own, R1 first.
+// The frame size is the distance from the new FP up to the caller's FP:
+// everything pushed since the caller's frame plus this frame.
 void c64cpu_pushState(c64cpu_t *cpu)
 {
-    c64cpu_push(cpu, c64cpu_getRegister(cpu, "R1"));
-    c64cpu_push(cpu, c64cpu_getRegister(cpu, "R2"));
-    c64cpu_push(cpu, c64cpu_getRegister(cpu, "R3"));
-    c64cpu_push(cpu, c64cpu_getRegister(cpu, "R4"));
-    c64cpu_push(cpu, c64cpu_getRegister(cpu, "R5"));
-    c64cpu_push(cpu, c64cpu_getRegister(cpu, "R6"));
-    c64cpu_push(cpu, c64cpu_getRegister(cpu, "R7"));
-    c64cpu_push(cpu, c64cpu_getRegister(cpu, "R8"));
-    c64cpu_push(cpu, c64cpu_getRegister(cpu, "IP"));
-    c64cpu_push(cpu, cpu->stackFrameSize + sizeof(uint64_t));
-
-    c64cpu_setRegister(cpu, "FP", c64cpu_getRegister(cpu, "SP"));
+    const uint64_t frame[] = {
+        cpu->stackFrameSize + c64cpu_stateWords * sizeof(uint64_t),
+        c64cpu_getReg(cpu, REG_IP),
+        c64cpu_getReg(cpu, REG_R8),
+        c64cpu_getReg(cpu, REG_R7),
+        c64cpu_getReg(cpu, REG_R6),
+        c64cpu_getReg(cpu, REG_R5),
+        c64cpu_getReg(cpu, REG_R4),
+        c64cpu_getReg(cpu, REG_R3),
+        c64cpu_getReg(cpu, REG_R2),
+        c64cpu_getReg(cpu, REG_R1),
+    };
+    const size_t count = sizeof(frame) / sizeof(frame[0]);
+    const uint64_t sp = c64cpu_getReg(cpu, REG_SP) - count * sizeof(uint64_t);
+    c64cpu_storeWords(cpu, sp + sizeof(uint64_t), frame, count);
+
+    c64cpu_setReg(cpu, REG_SP, sp);
+    c64cpu_setReg(cpu, REG_FP, sp);
     cpu->stackFrameSize = 0;
 }
 
+// Pops the frame pushed by c64cpu_pushState and the arguments below it as one block
 void c64cpu_popState(c64cpu_t *cpu)
 {
-    uint64_t fpa = c64cpu_getRegister(cpu, "FP");
-    c64cpu_setRegister(cpu, "SP", fpa);
-
-    cpu->stackFrameSize = c64cpu_pop(cpu);
-    const uint64_t sfs = cpu->stackFrameSize;
-
-    c64cpu_setRegister(cpu, "IP", c64cpu_pop(cpu));
-    c64cpu_setRegister(cpu, "R8", c64cpu_pop(cpu));
-    c64cpu_setRegister(cpu, "R7", c64cpu_pop(cpu));
-    c64cpu_setRegister(cpu, "R6", c64cpu_pop(cpu));
-    c64cpu_setRegister(cpu, "R5", c64cpu_pop(cpu));
-    c64cpu_setRegister(cpu, "R4", c64cpu_pop(cpu));
-    c64cpu_setRegister(cpu, "R3", c64cpu_pop(cpu));
-    c64cpu_setRegister(cpu, "R2", c64cpu_pop(cpu));
-    c64cpu_setRegister(cpu, "R1", c64cpu_pop(cpu));
-
-    const uint64_t nArgs = c64cpu_pop(cpu);
-    for (uint64_t i = 0; i < nArgs; i++)
-    {
-        c64cpu_pop(cpu);
-    }
-
-    c64cpu_setRegister(cpu, "FP", fpa + sfs);
+    const uint64_t fpa = c64cpu_getReg(cpu, REG_FP);
+    uint64_t frame[c64cpu_stateWords + 1];
+    c64cpu_loadWords(cpu, fpa + sizeof(uint64_t), frame, c64cpu_stateWords + 1);
+
+    const uint64_t sfs = frame[0];
+    c64cpu_setReg(cpu, REG_IP, frame[1]);
+    c64cpu_setReg(cpu, REG_R8, frame[2]);
+    c64cpu_setReg(cpu, REG_R7, frame[3]);
+    c64cpu_setReg(cpu, REG_R6, frame[4]);
+    c64cpu_setReg(cpu, REG_R5, frame[5]);
+    c64cpu_setReg(cpu, REG_R4, frame[6]);
+    c64cpu_setReg(cpu, REG_R3, frame[7]);
+    c64cpu_setReg(cpu, REG_R2, frame[8]);
+    c64cpu_setReg(cpu, REG_R1, frame[9]);
+
+    // The frame, its argument count and the arguments
+    const uint64_t popped = (c64cpu_stateWords + 1 + frame[c64cpu_stateWords]) * sizeof(uint64_t);
+    c64cpu_setReg(cpu, REG_SP, fpa + popped);
+    cpu->stackFrameSize = sfs - popped;
+    c64cpu_setReg(cpu, REG_FP, fpa + sfs);
 }
 
 size_t c64cpu_fetchRegisterIndex(c64cpu_t *cpu)
 {
     // Registers indexes are 1 byte long and reference a 64 bit register
     // Will always return a valid index even if the instruction is invalid
-    return (c64cpu_fetch(cpu) % REG_COUNT) * sizeof(uint64_t);
+    return c64cpu_fetch(cpu) % REG_COUNT;
 }
 
 void c64cpu_handleInterrupt(c64cpu_t *cpu, uint16_t value)
@@ -259,7 +508,7 @@ void c64cpu_handleInterrupt(c64cpu_t *cpu, uint16_t value)
 
     // If the interrupt is masked by the interrupt mask register
     // then do not enter the interrupt handler
-    const unsigned char isUnmasked = (1 << interruptBit) & c64cpu_getRegister(cpu, "IM");
+    const char isUnmasked = (((uint64_t)1 << interruptBit) & c64cpu_getReg(cpu, REG_IM)) != 0;
     if (!isUnmasked)
     {
         return;
@@ -268,7 +517,7 @@ void c64cpu_handleInterrupt(c64cpu_t *cpu, uint16_t value)
     // Calculate where in the interrupt vector we'll look
     const uint64_t interruptVectorAddress = cpu->interruptVectorAddress + (interruptBit * sizeof(uint64_t));
     // Get the address from the interrupt vector at that address
-    const uint64_t interruptHandlerAddress = c64mm_getUint64(cpu->mm, interruptVectorAddress);
+    const uint64_t interruptHandlerAddress = c64tlb_getUint64(&cpu->tlb, interruptVectorAddress);
 
     // We only save the state if we're not already in an interrupt handler
     if (!c64cpu_getFlag(cpu, FLAG_INTERRUPT))
@@ -282,1160 +531,2485 @@ void c64cpu_handleInterrupt(c64cpu_t *cpu, uint16_t value)
     }
 
     c64cpu_setFlag(cpu, FLAG_INTERRUPT, 1);
+    c64cpu_materializeFlags(cpu);
 
     // Jump to interrupt handler
-    c64cpu_setRegister(cpu, "IP", interruptHandlerAddress);
+    c64cpu_setReg(cpu, REG_IP, interruptHandlerAddress);
 }
 
-uint16_t c64cpu_execute(c64cpu_t *cpu, uint16_t opcode)
+void c64cpu_raiseInterrupt(c64cpu_t *cpu, uint16_t value)
 {
-    switch (opcode)
-    {
-    case LDI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64cpu_fetch64(cpu);
-        c64mem_setUint64(cpu->registers, regIndex, value);
-        return LDI;
-    }
-    case LDBI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint8_t value = c64cpu_fetch(cpu); 
-        c64mem_setUint64(cpu->registers, regIndex, value); // still 64 bit register
-        return LDBI;
-    }
-    case LDWI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint16_t value = c64cpu_fetch16(cpu);
-        c64mem_setUint64(cpu->registers, regIndex, value); // still 64 bit register
-        return LDWI;
-    }
-    case LDDI: // Load double word immediate 
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint32_t value = c64cpu_fetch32(cpu);
-        c64mem_setUint64(cpu->registers, regIndex, value); // still 64 bit register
-        return LDDI;
-    }
-    case LDM:
+    // Other cpus raise interrupts from their threads, the release pairs with
+    // the acquire when the interrupt is entered, see c64smp.h
+#if defined(__GNUC__)
+    // Sequentially consistent with the store to parked in c64cpu_wait, either
+    // the parked cpu sees the interrupt or this sees the cpu parked
+    __atomic_fetch_or(&cpu->pending, (uint64_t)1 << (value % 64), __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cpu->parked, __ATOMIC_SEQ_CST))
     {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64cpu_fetch64(cpu);
-        const uint64_t value = c64mm_getUint64(cpu->mm, address);
-        c64mem_setUint64(cpu->registers, regIndex, value);
-        return LDM;
+        c64cpu_wake(cpu);
     }
-    case LDBM:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64cpu_fetch64(cpu);
-        const uint8_t value = c64mm_getUint8(cpu->mm, address);
-        c64mem_setUint64(cpu->registers, regIndex, value);
-        return LDBM;
-    }
-    case LDWM:
+#else
+    cpu->pending |= (uint64_t)1 << (value % 64);
+    if (cpu->parked)
     {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64cpu_fetch64(cpu);
-        const uint16_t value = c64mm_getUint16(cpu->mm, address);
-        c64mem_setUint64(cpu->registers, regIndex, value);
-        return LDWM;
+        c64cpu_wake(cpu);
     }
-    case LDDM: // Load double word from memory
+#endif
+}
+
+// Raised interrupts out of pending that can be entered now. Masked ones stay
+// pending until IM lets them through.
+static inline uint64_t c64cpu_enterable(c64cpu_t *cpu, uint64_t pending)
+{
+    return c64cpu_getFlag(cpu, FLAG_INTERRUPT) ? 0 : pending & c64cpu_getReg(cpu, REG_IM);
+}
+
+static inline char c64cpu_canEnterInterrupt(c64cpu_t *cpu)
+{
+    return c64cpu_enterable(cpu, MM_LOAD(cpu->pending)) != 0;
+}
+
+// Puts IP back on the instruction and stops the engine with RUN_FAULT
+static inline void c64cpu_fault(c64cpu_t *cpu, const c64insn_t *insn, uint8_t fault)
+{
+    c64cpu_setReg(cpu, REG_IP, c64cpu_getReg(cpu, REG_IP) - insn->length);
+    cpu->fault = fault;
+    cpu->stop = RUN_FAULT;
+}
+
+// Faults with FAULT_STACK before insn pushes or pops count words at sp
+// outside the stack bounds, see c64cpu_stackFits
+static inline char c64cpu_stackFault(c64cpu_t *cpu, const c64insn_t *insn, uint64_t sp, int64_t count)
+{
+    if (c64cpu_stackFits(cpu, sp, count))
     {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64cpu_fetch64(cpu);
-        const uint32_t value = c64mm_getUint32(cpu->mm, address);
-        c64mem_setUint64(cpu->registers, regIndex, value);
-        return LDDM;
+        return 0;
     }
-    case ST:
+    c64cpu_fault(cpu, insn, FAULT_STACK);
+    return 1;
+}
+
+static inline void c64cpu_execLDI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = insn->imm;
+    cpu->regs[regIndex] = value;
+}
+
+static inline void c64cpu_execLDBI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint8_t value = insn->imm;
+    cpu->regs[regIndex] = value; // still 64 bit register
+}
+
+static inline void c64cpu_execLDWI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint16_t value = insn->imm;
+    cpu->regs[regIndex] = value; // still 64 bit register
+}
+
+// Load double word immediate
+static inline void c64cpu_execLDDI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint32_t value = insn->imm;
+    cpu->regs[regIndex] = value; // still 64 bit register
+}
+
+static inline void c64cpu_execLDM(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t address = insn->imm;
+    const uint64_t value = c64tlb_getUint64(&cpu->tlb, address);
+    cpu->regs[regIndex] = value;
+}
+
+static inline void c64cpu_execLDBM(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t address = insn->imm;
+    const uint8_t value = c64tlb_getUint8(&cpu->tlb, address);
+    cpu->regs[regIndex] = value;
+}
+
+static inline void c64cpu_execLDWM(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t address = insn->imm;
+    const uint16_t value = c64tlb_getUint16(&cpu->tlb, address);
+    cpu->regs[regIndex] = value;
+}
+
+// Load double word from memory
+static inline void c64cpu_execLDDM(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t address = insn->imm;
+    const uint32_t value = c64tlb_getUint32(&cpu->tlb, address);
+    cpu->regs[regIndex] = value;
+}
+
+static inline void c64cpu_execST(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t address = insn->imm;
+    const uint64_t value = cpu->regs[regIndex];
+    c64tlb_setUint64(&cpu->tlb, address, value);
+}
+
+static inline void c64cpu_execSTB(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t address = insn->imm;
+    // Lowest byte of the register
+    const uint8_t value = (uint8_t)cpu->regs[regIndex];
+    c64tlb_setUint8(&cpu->tlb, address, value);
+}
+
+static inline void c64cpu_execSTW(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t address = insn->imm;
+    // Lowest 2 bytes of the register
+    const uint16_t value = (uint16_t)cpu->regs[regIndex];
+    c64tlb_setUint16(&cpu->tlb, address, value);
+}
+
+// Store double word
+static inline void c64cpu_execSTD(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t address = insn->imm;
+    // Lowest 4 bytes of the register
+    const uint32_t value = (uint32_t)cpu->regs[regIndex];
+    c64tlb_setUint32(&cpu->tlb, address, value);
+}
+
+static inline uint64_t c64cpu_load(c64cpu_t *cpu, uint64_t address, int width)
+{
+    switch (width)
     {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64cpu_fetch64(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        c64mm_setUint64(cpu->mm, address, value);
-        return ST;
+    case 1:
+        return c64tlb_getUint8(&cpu->tlb, address);
+    case 2:
+        return c64tlb_getUint16(&cpu->tlb, address);
+    case 4:
+        return c64tlb_getUint32(&cpu->tlb, address);
+    default:
+        return c64tlb_getUint64(&cpu->tlb, address);
     }
-    case STB:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64cpu_fetch64(cpu);
-        // Add 7 to the address to get the last byte of the register
-        const uint8_t value = c64mem_getUint8(cpu->registers, regIndex + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t));
-        c64mm_setUint8(cpu->mm, address, value);
-        return STB;
+}
+
+static inline void c64cpu_store(c64cpu_t *cpu, uint64_t address, uint64_t value, int width)
+{
+    switch (width)
+    {
+    case 1:
+        c64tlb_setUint8(&cpu->tlb, address, (uint8_t)value);
+        break;
+    case 2:
+        c64tlb_setUint16(&cpu->tlb, address, (uint16_t)value);
+        break;
+    case 4:
+        c64tlb_setUint32(&cpu->tlb, address, (uint32_t)value);
+        break;
+    default:
+        c64tlb_setUint64(&cpu->tlb, address, value);
+        break;
     }
-    case STW:
+}
+
+// The register addressed loads and stores of one width, W is the name suffix
+// ([r2], [r2 + imm], [r2 + (r3 << s)] and [r2] with post increment).
+// Post increments update r2 before r1 is written, a load into r2 wins.
+#define ADDRESSED(W, width)                                                              \
+    static inline void c64cpu_execLD##W##R(c64cpu_t *cpu, const c64insn_t *insn)         \
+    {                                                                                    \
+        cpu->regs[insn->r1] = c64cpu_load(cpu, cpu->regs[insn->r2], width);              \
+    }                                                                                    \
+    static inline void c64cpu_execST##W##R(c64cpu_t *cpu, const c64insn_t *insn)         \
+    {                                                                                    \
+        c64cpu_store(cpu, cpu->regs[insn->r2], cpu->regs[insn->r1], width);              \
+    }                                                                                    \
+    static inline void c64cpu_execLD##W##O(c64cpu_t *cpu, const c64insn_t *insn)         \
+    {                                                                                    \
+        cpu->regs[insn->r1] = c64cpu_load(cpu, cpu->regs[insn->r2] + insn->imm, width);  \
+    }                                                                                    \
+    static inline void c64cpu_execST##W##O(c64cpu_t *cpu, const c64insn_t *insn)         \
+    {                                                                                    \
+        c64cpu_store(cpu, cpu->regs[insn->r2] + insn->imm, cpu->regs[insn->r1], width);  \
+    }                                                                                    \
+    static inline void c64cpu_execLD##W##X(c64cpu_t *cpu, const c64insn_t *insn)         \
+    {                                                                                    \
+        const uint64_t address = cpu->regs[insn->r2] + (cpu->regs[insn->r3] << (insn->imm & 3)); \
+        cpu->regs[insn->r1] = c64cpu_load(cpu, address, width);                          \
+    }                                                                                    \
+    static inline void c64cpu_execST##W##X(c64cpu_t *cpu, const c64insn_t *insn)         \
+    {                                                                                    \
+        const uint64_t address = cpu->regs[insn->r2] + (cpu->regs[insn->r3] << (insn->imm & 3)); \
+        c64cpu_store(cpu, address, cpu->regs[insn->r1], width);                          \
+    }                                                                                    \
+    static inline void c64cpu_execLD##W##P(c64cpu_t *cpu, const c64insn_t *insn)         \
+    {                                                                                    \
+        const uint64_t address = cpu->regs[insn->r2];                                    \
+        cpu->regs[insn->r2] = address + width;                                           \
+        cpu->regs[insn->r1] = c64cpu_load(cpu, address, width);                          \
+    }                                                                                    \
+    static inline void c64cpu_execST##W##P(c64cpu_t *cpu, const c64insn_t *insn)         \
+    {                                                                                    \
+        const uint64_t address = cpu->regs[insn->r2];                                    \
+        const uint64_t value = cpu->regs[insn->r1];                                      \
+        cpu->regs[insn->r2] = address + width;                                           \
+        c64cpu_store(cpu, address, value, width);                                        \
+    }
+ADDRESSED(, 8)
+ADDRESSED(B, 1)
+ADDRESSED(W, 2)
+ADDRESSED(D, 4)
+#undef ADDRESSED
+
+static inline void c64cpu_execTF(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndexFrom = insn->r1;
+    const size_t regIndexTo = insn->r2;
+    const uint64_t value = cpu->regs[regIndexFrom];
+    cpu->regs[regIndexTo] = value;
+}
+
+static inline void c64cpu_execADDI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = insn->imm;
+    const uint64_t currentValue = cpu->regs[regIndex];
+    const uint64_t newValue = currentValue + value;
+
+    c64cpu_setFlags(cpu, FLAGS_ADD, currentValue, newValue);
+
+    cpu->regs[regIndex] = newValue;
+}
+
+static inline void c64cpu_execSUBI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = insn->imm;
+    const uint64_t currentValue = cpu->regs[regIndex];
+    const uint64_t newValue = currentValue - value;
+
+    c64cpu_setFlags(cpu, FLAGS_SUB, currentValue, newValue);
+
+    cpu->regs[regIndex] = newValue;
+}
+
+// unsigned
+static inline void c64cpu_execMULI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = insn->imm;
+    const uint64_t currentValue = cpu->regs[regIndex];
+    const uint64_t newValue = currentValue * value;
+
+    c64cpu_setFlags(cpu, FLAGS_ADD, currentValue, newValue);
+
+    cpu->regs[regIndex] = newValue;
+}
+
+// unsigned
+static inline void c64cpu_execDIVI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = insn->imm;
+    if (value == 0)
     {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64cpu_fetch64(cpu);
-        // Add 6 to the address to get the last 2 bytes of the register
-        const uint16_t value = c64mem_getUint16(cpu->registers, regIndex + sizeof(uint32_t) + sizeof(uint16_t));
-        c64mm_setUint16(cpu->mm, address, value);
-        return STW;
+        c64cpu_fault(cpu, insn, FAULT_DIVIDE);
+        return;
     }
-    case STD: // Store double word
+    const uint64_t currentValue = cpu->regs[regIndex];
+    const uint64_t newValue = currentValue / value;
+
+    c64cpu_setFlags(cpu, FLAGS_SUB, currentValue, newValue);
+
+    cpu->regs[regIndex] = newValue;
+}
+
+static inline void c64cpu_execMODI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = insn->imm;
+    if (value == 0)
     {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64cpu_fetch64(cpu);
-        // Add 4 to the address to get the last 4 bytes of the register
-        const uint32_t value = c64mem_getUint32(cpu->registers, regIndex + sizeof(uint32_t));
-        c64mm_setUint32(cpu->mm, address, value);
-        return STD;
+        c64cpu_fault(cpu, insn, FAULT_DIVIDE);
+        return;
     }
-    case TF:
-    {
-        const size_t regIndexFrom = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndexTo = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndexFrom);
-        c64mem_setUint64(cpu->registers, regIndexTo, value);
-        return TF;
-    }
-    case ADDI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64cpu_fetch64(cpu);
-        const uint64_t currentValue = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t newValue = currentValue + value;
-
-        // Flags
-        const char isOverflow = newValue < currentValue;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return ADDI;
-    }
-    case SUBI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64cpu_fetch64(cpu);
-        const uint64_t currentValue = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t newValue = currentValue - value;
-
-        // Flags
-        const char isOverflow = newValue > currentValue;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return SUBI;
-    }
-    case MULI: // unsigned
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64cpu_fetch64(cpu);
-        const uint64_t currentValue = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t newValue = currentValue * value;
-
-        // Flags
-        const char isOverflow = newValue < currentValue;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return MULI;
-    }
-    case DIVI: // unsigned
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64cpu_fetch64(cpu);
-        const uint64_t currentValue = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t newValue = currentValue / value;
-
-        // Flags
-        const char isOverflow = newValue > currentValue;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return DIVI;
-    }
-    case MODI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64cpu_fetch64(cpu);
-        const uint64_t currentValue = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t newValue = currentValue % value;
-
-        // Flags
-        const char isOverflow = newValue > currentValue;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return MODI;
-    }
-    case MULIS: // signed
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const int64_t value = c64cpu_fetch64(cpu);
-        const int64_t currentValue = c64mem_getUint64(cpu->registers, regIndex);
-        const int64_t newValue = currentValue * value;
-
-        // Flags
-        const char isOverflow = newValue < currentValue;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue < 0;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return MULIS;
-    }
-    case DIVIS:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const int64_t value = c64cpu_fetch64(cpu);
-        const int64_t currentValue = c64mem_getUint64(cpu->registers, regIndex);
-        const int64_t newValue = currentValue / value;
-
-        // Flags
-        const char isOverflow = newValue > currentValue;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue < 0;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return DIVIS;
-    }
-    case ADD:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 + value2;
-
-        // Flags
-        const char isOverflow = newValue < value1;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return ADD;
-    }
-    case SUB:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 - value2;
-
-        // Flags
-        const char isOverflow = newValue > value1;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return SUB;
-    }
-    case MUL: // unsigned
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 * value2;
-
-        // Flags
-        const char isOverflow = newValue < value1;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return MUL;
-    }
-    case DIV: // unsigned
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 / value2;
-
-        // Flags
-        const char isOverflow = newValue > value1;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return DIV;
-    }
-    case MOD:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 % value2;
-
-        // Flags
-        const char isOverflow = newValue > value1;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
-
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    const uint64_t currentValue = cpu->regs[regIndex];
+    const uint64_t newValue = currentValue % value;
 
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return MOD;
-    }
-    case MULS: // signed
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const int64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const int64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const int64_t newValue = value1 * value2;
+    c64cpu_setFlags(cpu, FLAGS_SUB, currentValue, newValue);
 
-        // Flags
-        const char isOverflow = newValue < value1;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    cpu->regs[regIndex] = newValue;
+}
 
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+// signed
+static inline void c64cpu_execMULIS(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const int64_t value = insn->imm;
+    const int64_t currentValue = cpu->regs[regIndex];
+    const int64_t newValue = currentValue * value;
 
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return MULS;
-    }
-    case DIVS: // signed
+    c64cpu_setFlags(cpu, FLAGS_MULS, (uint64_t)currentValue, (uint64_t)newValue);
+
+    cpu->regs[regIndex] = newValue;
+}
+
+static inline void c64cpu_execDIVIS(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const int64_t value = insn->imm;
+    const int64_t currentValue = cpu->regs[regIndex];
+    if (value == 0 || (value == -1 && currentValue == INT64_MIN))
     {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const int64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const int64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const int64_t newValue = value1 / value2;
+        c64cpu_fault(cpu, insn, FAULT_DIVIDE);
+        return;
+    }
+    const int64_t newValue = currentValue / value;
 
-        // Flags
-        const char isOverflow = newValue > value1;
-        const char isCarry = isOverflow;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_DIVS, (uint64_t)currentValue, (uint64_t)newValue);
 
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, isOverflow);
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return DIVS;
-    }
-    case ANDI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t imm = c64cpu_fetch64(cpu);
-        const uint64_t newValue = value & imm;
+static inline void c64cpu_execADD(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = value1 + value2;
 
-        // Flags
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_ADD, value1, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex1] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return ANDI;
-    }
-    case ORI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t imm = c64cpu_fetch64(cpu);
-        const uint64_t newValue = value | imm;
+static inline void c64cpu_execSUB(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = value1 - value2;
 
-        // Flags
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_SUB, value1, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex1] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return ORI;
-    }
-    case XORI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t imm = c64cpu_fetch64(cpu);
-        const uint64_t newValue = value ^ imm;
+// unsigned
+static inline void c64cpu_execMUL(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = value1 * value2;
 
-        // Flags
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_ADD, value1, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex1] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return XORI;
-    }
-    case NOTI:
+// unsigned
+static inline void c64cpu_execDIV(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    if (value2 == 0)
     {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t newValue = ~value;
+        c64cpu_fault(cpu, insn, FAULT_DIVIDE);
+        return;
+    }
+    const uint64_t newValue = value1 / value2;
 
-        // Flags
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_SUB, value1, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex1] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return NOTI;
-    }
-    case SHLI:
+static inline void c64cpu_execMOD(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    if (value2 == 0)
     {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t imm = c64cpu_fetch64(cpu);
-        const uint64_t newValue = value << imm;
+        c64cpu_fault(cpu, insn, FAULT_DIVIDE);
+        return;
+    }
+    const uint64_t newValue = value1 % value2;
 
-        // Flags
-        const char isCarry = newValue < value;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_SUB, value1, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex1] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return SHLI;
-    }
-    case SHRI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t imm = c64cpu_fetch64(cpu);
-        const uint64_t newValue = value >> imm;
+// signed
+static inline void c64cpu_execMULS(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const int64_t value1 = cpu->regs[regIndex1];
+    const int64_t value2 = cpu->regs[regIndex2];
+    const int64_t newValue = value1 * value2;
 
-        // Flags
-        const char isCarry = newValue > value;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_MULS, (uint64_t)value1, (uint64_t)newValue);
 
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex1] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return SHRI;
-    }
-    case RORI:
+// signed
+static inline void c64cpu_execDIVS(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const int64_t value1 = cpu->regs[regIndex1];
+    const int64_t value2 = cpu->regs[regIndex2];
+    if (value2 == 0 || (value2 == -1 && value1 == INT64_MIN))
     {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t imm = c64cpu_fetch64(cpu);
-        const uint64_t newValue = (value >> imm) | (value << (64 - imm));
+        c64cpu_fault(cpu, insn, FAULT_DIVIDE);
+        return;
+    }
+    const int64_t newValue = value1 / value2;
 
-        // Flags
-        const char isCarry = newValue > value;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_DIVS, (uint64_t)value1, (uint64_t)newValue);
 
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex1] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return RORI;
-    }
-    case ROLI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t imm = c64cpu_fetch64(cpu);
-        const uint64_t newValue = (value << imm) | (value >> (64 - imm));
+static inline void c64cpu_execANDI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = cpu->regs[regIndex];
+    const uint64_t imm = insn->imm;
+    const uint64_t newValue = value & imm;
 
-        // Flags
-        const char isCarry = newValue < value;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_LOGIC, value, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return ROLI;
-    }
-    case AND:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 & value2;
+static inline void c64cpu_execORI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = cpu->regs[regIndex];
+    const uint64_t imm = insn->imm;
+    const uint64_t newValue = value | imm;
 
-        // Flags
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_LOGIC, value, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return AND;
-    }
-    case OR:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 | value2;
+static inline void c64cpu_execXORI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = cpu->regs[regIndex];
+    const uint64_t imm = insn->imm;
+    const uint64_t newValue = value ^ imm;
 
-        // Flags
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_LOGIC, value, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return OR;
-    }
-    case XOR:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 ^ value2;
+static inline void c64cpu_execNOTI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = cpu->regs[regIndex];
+    const uint64_t newValue = ~value;
 
-        // Flags
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_LOGIC, value, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return XOR;
-    }
-    case NOT:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t newValue = ~value;
+static inline void c64cpu_execSHLI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = cpu->regs[regIndex];
+    const uint64_t imm = insn->imm;
+    const uint64_t newValue = value << imm;
 
-        // Flags
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_SHL, value, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex, newValue);
-        return NOT;
-    }
-    case SHL:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 << value2;
+static inline void c64cpu_execSHRI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = cpu->regs[regIndex];
+    const uint64_t imm = insn->imm;
+    const uint64_t newValue = value >> imm;
 
-        // Flags
-        const char isCarry = newValue < value1;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_SHR, value, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return SHL;
-    }
-    case SHR:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 >> value2;
+static inline void c64cpu_execRORI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = cpu->regs[regIndex];
+    const uint64_t imm = insn->imm;
+    const uint64_t newValue = (value >> imm) | (value << (64 - imm));
 
-        // Flags
-        const char isCarry = newValue > value1;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_SHR, value, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return SHR;
-    }
-    case ROL:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = (value1 << value2) | (value1 >> (64 - value2));
+static inline void c64cpu_execROLI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = cpu->regs[regIndex];
+    const uint64_t imm = insn->imm;
+    const uint64_t newValue = (value << imm) | (value >> (64 - imm));
 
-        // Flags
-        const char isCarry = newValue < value1;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_SHL, value, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return ROL;
-    }
-    case ROR:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = (value1 >> value2) | (value1 << (64 - value2));
+static inline void c64cpu_execAND(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = value1 & value2;
 
-        // Flags
-        const char isCarry = newValue > value1;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_LOGIC, value1, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
+    cpu->regs[regIndex1] = newValue;
+}
 
-        c64mem_setUint64(cpu->registers, regIndex1, newValue);
-        return ROR;
-    }
-    case CMPI:
-    {
-        const size_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t value2 = c64cpu_fetch64(cpu);
-        const uint64_t newValue = value1 - value2;
+static inline void c64cpu_execOR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = value1 | value2;
 
-        // Flags
-        const char isCarry = newValue > value1;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+    c64cpu_setFlags(cpu, FLAGS_LOGIC, value1, newValue);
 
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-        return CMPI;
-    }
-    case CMP:
-    {
-        const size_t regIndex1 = c64cpu_fetchRegisterIndex(cpu);
-        const size_t regIndex2 = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value1 = c64mem_getUint64(cpu->registers, regIndex1);
-        const uint64_t value2 = c64mem_getUint64(cpu->registers, regIndex2);
-        const uint64_t newValue = value1 - value2;
+    cpu->regs[regIndex1] = newValue;
+}
 
-        // Flags
-        const char isCarry = newValue > value1;
-        const char isZero = newValue == 0;
-        const char isNegative = newValue & 0x8000000000000000;
+static inline void c64cpu_execXOR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = value1 ^ value2;
 
-        c64cpu_setFlag(cpu, FLAG_CARRY, isCarry);
-        c64cpu_setFlag(cpu, FLAG_ZERO, isZero);
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, isNegative);
-        return CMP;
-    }
-    case JMP:
-    {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        c64cpu_setRegister(cpu, "IP", address);
-        return JMP;
-    }
-    case JEQ:
+    c64cpu_setFlags(cpu, FLAGS_LOGIC, value1, newValue);
+
+    cpu->regs[regIndex1] = newValue;
+}
+
+static inline void c64cpu_execNOT(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value = cpu->regs[regIndex];
+    const uint64_t newValue = ~value;
+
+    c64cpu_setFlags(cpu, FLAGS_LOGIC, value, newValue);
+
+    cpu->regs[regIndex] = newValue;
+}
+
+static inline void c64cpu_execSHL(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = value1 << value2;
+
+    c64cpu_setFlags(cpu, FLAGS_SHL, value1, newValue);
+
+    cpu->regs[regIndex1] = newValue;
+}
+
+static inline void c64cpu_execSHR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = value1 >> value2;
+
+    c64cpu_setFlags(cpu, FLAGS_SHR, value1, newValue);
+
+    cpu->regs[regIndex1] = newValue;
+}
+
+static inline void c64cpu_execROL(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = (value1 << value2) | (value1 >> (64 - value2));
+
+    c64cpu_setFlags(cpu, FLAGS_SHL, value1, newValue);
+
+    cpu->regs[regIndex1] = newValue;
+}
+
+static inline void c64cpu_execROR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = (value1 >> value2) | (value1 << (64 - value2));
+
+    c64cpu_setFlags(cpu, FLAGS_SHR, value1, newValue);
+
+    cpu->regs[regIndex1] = newValue;
+}
+
+static inline void c64cpu_execCMPI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex = insn->r1;
+    const uint64_t value1 = cpu->regs[regIndex];
+    const uint64_t value2 = insn->imm;
+    const uint64_t newValue = value1 - value2;
+
+    c64cpu_setFlags(cpu, FLAGS_CMP, value1, newValue);
+}
+
+static inline void c64cpu_execCMP(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const size_t regIndex1 = insn->r1;
+    const size_t regIndex2 = insn->r2;
+    const uint64_t value1 = cpu->regs[regIndex1];
+    const uint64_t value2 = cpu->regs[regIndex2];
+    const uint64_t newValue = value1 - value2;
+
+    c64cpu_setFlags(cpu, FLAGS_CMP, value1, newValue);
+}
+
+// Fused compare and conditional jump, see c64cpu_fuse. The flags are set as
+// by the compare and the condition is read off its result like the jump would.
+#define FUSED_COMPARE(jump, taken)                                                \
+    static inline void c64cpu_execCMP##jump(c64cpu_t *cpu, const c64insn_t *insn)  \
+    {                                                                             \
+        const uint64_t value1 = cpu->regs[insn->r1];                              \
+        const uint64_t result = value1 - cpu->regs[insn->r2];                     \
+        c64cpu_setFlags(cpu, FLAGS_CMP, value1, result);                          \
+        if (taken)                                                                \
+        {                                                                         \
+            c64cpu_setReg(cpu, REG_IP, insn->target);                             \
+        }                                                                         \
+    }                                                                             \
+                                                                                  \
+    static inline void c64cpu_execCMPI##jump(c64cpu_t *cpu, const c64insn_t *insn) \
+    {                                                                             \
+        const uint64_t value1 = cpu->regs[insn->r1];                              \
+        const uint64_t result = value1 - insn->imm;                               \
+        c64cpu_setFlags(cpu, FLAGS_CMP, value1, result);                          \
+        if (taken)                                                                \
+        {                                                                         \
+            c64cpu_setReg(cpu, REG_IP, insn->target);                             \
+        }                                                                         \
+    }
+
+FUSED_COMPARE(JEQ, result == 0)
+FUSED_COMPARE(JNE, result != 0)
+FUSED_COMPARE(JGT, result != 0 && (result >> 63) == 0)
+FUSED_COMPARE(JLT, (result >> 63) != 0)
+FUSED_COMPARE(JGE, (result >> 63) == 0)
+FUSED_COMPARE(JLE, result == 0 || (result >> 63) != 0)
+#undef FUSED_COMPARE
+
+// LDI r, imm followed by ADD r2, r3
+static inline void c64cpu_execLDIADD(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    cpu->regs[insn->r1] = insn->imm;
+    const uint64_t value1 = cpu->regs[insn->r2];
+    const uint64_t newValue = value1 + cpu->regs[insn->r3];
+    c64cpu_setFlags(cpu, FLAGS_ADD, value1, newValue);
+    cpu->regs[insn->r2] = newValue;
+}
+
+static inline void c64cpu_execJMP(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    c64cpu_setReg(cpu, REG_IP, address);
+}
+
+static inline void c64cpu_execJEQ(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (c64cpu_branchFlag(cpu, FLAG_ZERO))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJNE(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (!c64cpu_branchFlag(cpu, FLAG_ZERO))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJGT(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (!c64cpu_branchFlag(cpu, FLAG_ZERO) && !c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJLT(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJGE(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (!c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJLE(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (c64cpu_branchFlag(cpu, FLAG_ZERO) || c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBRA(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+    {
+        return;
+    }
+    const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+    c64cpu_push(cpu, retAdd);
+    c64cpu_setReg(cpu, REG_IP, address);
+}
+
+static inline void c64cpu_execBEQ(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (c64cpu_branchFlag(cpu, FLAG_ZERO))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBNE(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (!c64cpu_branchFlag(cpu, FLAG_ZERO))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBGT(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (!c64cpu_branchFlag(cpu, FLAG_ZERO) && !c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBLT(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBGE(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (!c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBLE(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (c64cpu_branchFlag(cpu, FLAG_ZERO) || c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJMPR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    c64cpu_setReg(cpu, REG_IP, address);
+}
+
+static inline void c64cpu_execJEQR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (c64cpu_branchFlag(cpu, FLAG_ZERO))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJNER(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (!c64cpu_branchFlag(cpu, FLAG_ZERO))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJGTR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (!c64cpu_branchFlag(cpu, FLAG_ZERO) && !c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJLTR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJGER(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (!c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execJLER(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (c64cpu_branchFlag(cpu, FLAG_ZERO) || c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBRAR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+    {
+        return;
+    }
+    const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+    c64cpu_push(cpu, retAdd);
+    c64cpu_setReg(cpu, REG_IP, address);
+}
+
+static inline void c64cpu_execBEQR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (c64cpu_branchFlag(cpu, FLAG_ZERO))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBNER(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (!c64cpu_branchFlag(cpu, FLAG_ZERO))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBGTR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (!c64cpu_branchFlag(cpu, FLAG_ZERO) && !c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBLTR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBGER(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (!c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execBLER(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (c64cpu_branchFlag(cpu, FLAG_ZERO) || c64cpu_branchFlag(cpu, FLAG_NEGATIVE))
+    {
+        if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+        {
+            return;
+        }
+        const uint64_t retAdd = c64cpu_getReg(cpu, REG_IP);
+        c64cpu_push(cpu, retAdd);
+        c64cpu_setReg(cpu, REG_IP, address);
+    }
+}
+
+static inline void c64cpu_execRET(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), -1))
+    {
+        return;
+    }
+    const uint64_t retAdd = c64cpu_pop(cpu);
+    c64cpu_setReg(cpu, REG_IP, retAdd);
+}
+
+static inline void c64cpu_execPUSHI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t value = insn->imm;
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+    {
+        return;
+    }
+    c64cpu_push(cpu, value);
+}
+
+static inline void c64cpu_execPUSH(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t value = cpu->regs[regIndex];
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), 1))
+    {
+        return;
+    }
+    c64cpu_push(cpu, value);
+}
+
+static inline void c64cpu_execPOP(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), -1))
+    {
+        return;
+    }
+    const uint64_t value = c64cpu_pop(cpu);
+    cpu->regs[regIndex] = value;
+}
+
+static inline void c64cpu_execCALL(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = insn->imm;
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), c64cpu_stateWords))
+    {
+        return;
+    }
+    c64cpu_pushState(cpu);
+    c64cpu_setReg(cpu, REG_IP, address);
+}
+
+static inline void c64cpu_execCALLR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t regIndex = insn->r1;
+    const uint64_t address = cpu->regs[regIndex];
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), c64cpu_stateWords))
+    {
+        return;
+    }
+    c64cpu_pushState(cpu);
+    c64cpu_setReg(cpu, REG_IP, address);
+}
+
+static inline void c64cpu_execRTC(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    // The frame and the argument count above FP, the arguments are skipped
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_FP), -(c64cpu_stateWords + 1)))
+    {
+        return;
+    }
+    c64cpu_popState(cpu);
+}
+
+// PUSHI imm followed by CALL, the argument count and the frame of the usual
+// calling convention. Only fused while the stack has no bounds, so it cannot fault.
+static inline void c64cpu_execPUSHICALL(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    c64cpu_push(cpu, insn->imm);
+    c64cpu_pushState(cpu);
+    c64cpu_setReg(cpu, REG_IP, insn->target);
+}
+
+// Leaf calls only save IP and the registers in the mask, R1 is pushed first
+static inline void c64cpu_execCALLM(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    uint64_t frame[9];
+    size_t count = 0;
+    frame[count++] = c64cpu_getReg(cpu, REG_IP);
+    for (int i = 7; i >= 0; i--)
+    {
+        if (insn->r1 & (1 << i))
+        {
+            frame[count++] = c64cpu_getReg(cpu, REG_R1 + i);
+        }
+    }
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), (int64_t)count))
+    {
+        return;
+    }
+    const uint64_t sp = c64cpu_getReg(cpu, REG_SP) - count * sizeof(uint64_t);
+    c64cpu_storeWords(cpu, sp + sizeof(uint64_t), frame, count);
+    c64cpu_setReg(cpu, REG_SP, sp);
+    cpu->stackFrameSize += count * sizeof(uint64_t);
+    cpu->leafReturn = sp + sizeof(uint64_t);
+    c64cpu_setReg(cpu, REG_IP, insn->imm);
+}
+
+static inline void c64cpu_execRETM(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    uint64_t frame[9];
+    size_t count = 1;
+    for (int i = 0; i < 8; i++)
+    {
+        count += (insn->r1 >> i) & 1;
+    }
+    const uint64_t sp = c64cpu_getReg(cpu, REG_SP);
+    if (c64cpu_stackFault(cpu, insn, sp, -(int64_t)count))
+    {
+        return;
+    }
+    c64cpu_loadWords(cpu, sp + sizeof(uint64_t), frame, count);
+    c64cpu_setReg(cpu, REG_IP, frame[0]);
+    for (int i = 7, next = 1; i >= 0; i--)
+    {
+        if (insn->r1 & (1 << i))
+        {
+            c64cpu_setReg(cpu, REG_R1 + i, frame[next++]);
+        }
+    }
+    c64cpu_setReg(cpu, REG_SP, sp + count * sizeof(uint64_t));
+    cpu->stackFrameSize -= count * sizeof(uint64_t);
+    cpu->leafReturn = 0;
+}
+
+static inline void c64cpu_execCLC(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    c64cpu_setFlag(cpu, FLAG_CARRY, 0);
+}
+
+static inline void c64cpu_execSEC(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    c64cpu_setFlag(cpu, FLAG_CARRY, 1);
+}
+
+static inline void c64cpu_execCLZ(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    c64cpu_setFlag(cpu, FLAG_ZERO, 0);
+}
+
+static inline void c64cpu_execSEZ(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    c64cpu_setFlag(cpu, FLAG_ZERO, 1);
+}
+
+static inline void c64cpu_execCLN(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    c64cpu_setFlag(cpu, FLAG_NEGATIVE, 0);
+}
+
+static inline void c64cpu_execSEN(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    c64cpu_setFlag(cpu, FLAG_NEGATIVE, 1);
+}
+
+static inline void c64cpu_execCLV(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    c64cpu_setFlag(cpu, FLAG_OVERFLOW, 0);
+}
+
+static inline void c64cpu_execSEV(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    c64cpu_setFlag(cpu, FLAG_OVERFLOW, 1);
+}
+
+static inline void c64cpu_execCLI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    c64cpu_setFlag(cpu, FLAG_INTERRUPT, 0);
+}
+
+static inline void c64cpu_execSEI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    c64cpu_setFlag(cpu, FLAG_INTERRUPT, 1);
+}
+
+static inline void c64cpu_execFENCE(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)cpu;
+    (void)insn;
+#if defined(__GNUC__)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#elif defined(_WIN32)
+    MemoryBarrier();
+#endif
+}
+
+// Low width bytes of value
+static inline uint64_t c64cpu_truncate(uint64_t value, uint8_t width)
+{
+    return width == sizeof(uint64_t) ? value : value & (((uint64_t)1 << (width * 8)) - 1);
+}
+
+// Host address of the width bytes at address for atomic accesses, NULL unless
+// they are naturally aligned and readable and writable host memory
+static inline uint8_t *c64cpu_atomicHost(c64cpu_t *cpu, uint64_t address, uint8_t width)
+{
+#if defined(__GNUC__)
+    if ((address & (width - 1)) != 0)
+    {
+        return NULL;
+    }
+    uint8_t *host = c64tlb_write(&cpu->tlb, address, width);
+    if (host != NULL && c64tlb_read(&cpu->tlb, address, width) != NULL)
+    {
+        return host;
+    }
+    host = c64tlb_lookup(&cpu->tlb, address, MM_WRITE);
+    return host != NULL && c64tlb_lookup(&cpu->tlb, address, MM_READ) != NULL ? host : NULL;
+#else
+    (void)cpu;
+    (void)address;
+    (void)width;
+    return NULL;
+#endif
+}
+
+#if defined(__GNUC__)
+// Host atomics on width bytes, they return the old value
+static inline uint64_t c64cpu_hostLoad(uint8_t *host, uint8_t width)
+{
+    switch (width)
+    {
+    case 1:
+        return __atomic_load_n(host, __ATOMIC_SEQ_CST);
+    case 2:
+        return __atomic_load_n((uint16_t *)host, __ATOMIC_SEQ_CST);
+    case 4:
+        return __atomic_load_n((uint32_t *)host, __ATOMIC_SEQ_CST);
+    default:
+        return __atomic_load_n((uint64_t *)host, __ATOMIC_SEQ_CST);
+    }
+}
+
+static inline uint64_t c64cpu_hostExchange(uint8_t *host, uint64_t value, uint8_t width)
+{
+    switch (width)
+    {
+    case 1:
+        return __atomic_exchange_n(host, (uint8_t)value, __ATOMIC_SEQ_CST);
+    case 2:
+        return __atomic_exchange_n((uint16_t *)host, (uint16_t)value, __ATOMIC_SEQ_CST);
+    case 4:
+        return __atomic_exchange_n((uint32_t *)host, (uint32_t)value, __ATOMIC_SEQ_CST);
+    default:
+        return __atomic_exchange_n((uint64_t *)host, value, __ATOMIC_SEQ_CST);
+    }
+}
+
+static inline uint64_t c64cpu_hostFetchAdd(uint8_t *host, uint64_t value, uint8_t width)
+{
+    switch (width)
+    {
+    case 1:
+        return __atomic_fetch_add(host, (uint8_t)value, __ATOMIC_SEQ_CST);
+    case 2:
+        return __atomic_fetch_add((uint16_t *)host, (uint16_t)value, __ATOMIC_SEQ_CST);
+    case 4:
+        return __atomic_fetch_add((uint32_t *)host, (uint32_t)value, __ATOMIC_SEQ_CST);
+    default:
+        return __atomic_fetch_add((uint64_t *)host, value, __ATOMIC_SEQ_CST);
+    }
+}
+
+// Stores value if the old value is expected, which is truncated to width
+static inline uint64_t c64cpu_hostCompareExchange(uint8_t *host, uint64_t expected, uint64_t value, uint8_t width)
+{
+    uint8_t old8 = (uint8_t)expected;
+    uint16_t old16 = (uint16_t)expected;
+    uint32_t old32 = (uint32_t)expected;
+    switch (width)
+    {
+    case 1:
+        __atomic_compare_exchange_n(host, &old8, (uint8_t)value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        return old8;
+    case 2:
+        __atomic_compare_exchange_n((uint16_t *)host, &old16, (uint16_t)value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        return old16;
+    case 4:
+        __atomic_compare_exchange_n((uint32_t *)host, &old32, (uint32_t)value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        return old32;
+    default:
+        __atomic_compare_exchange_n((uint64_t *)host, &expected, value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        return expected;
+    }
+}
+#endif
+
+#define ATOMIC_CAS 0
+#define ATOMIC_XCHG 1
+#define ATOMIC_ADD 2
+
+// Applies the ATOMIC_* kind to the width bytes at address and returns the old
+// value. Host memory takes the host atomics, everything else (MMIO, unaligned
+// accesses) a load and a store under mm->atomicLock. Under a tracer the host
+// atomics are recorded as a read of the old value and, if it stored, a write.
+static inline uint64_t c64cpu_atomic(c64cpu_t *cpu, uint8_t kind, uint64_t address, uint64_t expected, uint64_t value, uint8_t width)
+{
+    expected = c64cpu_truncate(expected, width);
+    uint8_t *host = c64cpu_atomicHost(cpu, address, width);
+    uint64_t old;
+#if defined(__GNUC__)
+    if (host != NULL)
+    {
+        switch (kind)
+        {
+        case ATOMIC_CAS:
+            old = c64cpu_hostCompareExchange(host, expected, value, width);
+            break;
+        case ATOMIC_XCHG:
+            old = c64cpu_hostExchange(host, value, width);
+            break;
+        default:
+            old = c64cpu_hostFetchAdd(host, value, width);
+            break;
+        }
+        const char stored = kind != ATOMIC_CAS || old == expected;
+        if (stored)
+        {
+            c64mm_touch(cpu->mm, address, width);
+        }
+        if (c64tlb_tracing(&cpu->tlb))
+        {
+            c64trace_record(cpu->tlb.trace, TRACE_READ, address, width, old);
+            if (stored)
+            {
+                c64trace_record(cpu->tlb.trace, TRACE_WRITE, address, width,
+                                c64cpu_truncate(kind == ATOMIC_ADD ? old + value : value, width));
+            }
+        }
+        return old;
+    }
+#else
+    (void)host;
+#endif
+    mutexLock(cpu->mm->atomicLock);
+    old = c64cpu_load(cpu, address, width);
+    if (kind != ATOMIC_CAS || old == expected)
+    {
+        c64cpu_store(cpu, address, kind == ATOMIC_ADD ? old + value : value, width);
+    }
+    mutexUnlock(cpu->mm->atomicLock);
+    return old;
+}
+
+static inline void c64cpu_execCAS(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint8_t width = c64vec_laneSize(insn->opcode);
+    const uint64_t expected = c64cpu_truncate(cpu->regs[insn->r1], width);
+    const uint64_t old = c64cpu_atomic(cpu, ATOMIC_CAS, cpu->regs[insn->r2], expected, cpu->regs[insn->r3], width);
+    cpu->regs[insn->r1] = old;
+    c64cpu_setFlag(cpu, FLAG_ZERO, old == expected);
+}
+
+static inline void c64cpu_execXCHG(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint8_t width = c64vec_laneSize(insn->opcode);
+    cpu->regs[insn->r1] = c64cpu_atomic(cpu, ATOMIC_XCHG, cpu->regs[insn->r2], 0, cpu->regs[insn->r1], width);
+}
+
+static inline void c64cpu_execFETCHADD(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint8_t width = c64vec_laneSize(insn->opcode);
+    cpu->regs[insn->r1] = c64cpu_atomic(cpu, ATOMIC_ADD, cpu->regs[insn->r2], 0, cpu->regs[insn->r1], width);
+}
+
+// Stops the engine with RUN_WAIT if the value is still there, the thread
+// running the cpu parks in c64cpu_wait. Anywhere but aligned host memory
+// it returns as if it was woken.
+static inline void c64cpu_execWAITADDR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+#if defined(__GNUC__)
+    const uint8_t width = c64vec_laneSize(insn->opcode);
+    const uint64_t address = cpu->regs[insn->r2];
+    const uint64_t expected = c64cpu_truncate(cpu->regs[insn->r1], width);
+    uint8_t *host = c64cpu_atomicHost(cpu, address, width);
+    if (host == NULL)
+    {
+        return;
+    }
+    const uint64_t value = c64cpu_hostLoad(host, width);
+    if (c64tlb_tracing(&cpu->tlb))
+    {
+        c64trace_record(cpu->tlb.trace, TRACE_READ, address, width, value);
+    }
+    if (value != expected)
+    {
+        return;
+    }
+    cpu->waitAddress = address;
+    cpu->waitValue = expected;
+    cpu->waitWidth = width;
+    cpu->stop = RUN_WAIT;
+#else
+    (void)cpu;
+    (void)insn;
+#endif
+}
+
+// Unlinks the cpu at link from mm->waiters and wakes it, mm->waitLock is held
+static void c64cpu_unpark(c64cpu_t **link)
+{
+    c64cpu_t *cpu = *link;
+    *link = cpu->waitNext;
+    cpu->waitNext = NULL;
+    cpu->woken = 1;
+    condSignal(cpu->waitCond);
+}
+
+static inline void c64cpu_execWAKEADDR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t address = cpu->regs[insn->r2];
+    const uint64_t count = cpu->regs[insn->r1];
+    uint64_t woken = 0;
+    mutexLock(cpu->mm->waitLock);
+    c64cpu_t **link = &cpu->mm->waiters;
+    while (*link != NULL && woken < count)
+    {
+        if ((*link)->waitAddress == address)
+        {
+            c64cpu_unpark(link);
+            woken++;
+        }
+        else
+        {
+            link = &(*link)->waitNext;
+        }
+    }
+    mutexUnlock(cpu->mm->waitLock);
+    cpu->regs[insn->r1] = woken;
+}
+
+void c64cpu_wait(c64cpu_t *cpu)
+{
+    if (cpu->stop != RUN_WAIT)
+    {
+        return;
+    }
+    c64mm_t *mm = cpu->mm;
+    mutexLock(mm->waitLock);
+    // The value is checked under the lock WAKEADDR takes, so a store and
+    // WAKEADDR on another cpu either come before it or find the cpu parked
+#if defined(__GNUC__)
+    __atomic_store_n(&cpu->parked, 1, __ATOMIC_SEQ_CST);
+    const char interrupted = c64cpu_enterable(cpu, __atomic_load_n(&cpu->pending, __ATOMIC_SEQ_CST)) != 0;
+    uint8_t *host = c64cpu_atomicHost(cpu, cpu->waitAddress, cpu->waitWidth);
+    if (!cpu->woken && !interrupted && host != NULL && c64cpu_hostLoad(host, cpu->waitWidth) == cpu->waitValue)
+    {
+        cpu->waitNext = mm->waiters;
+        mm->waiters = cpu;
+        while (!cpu->woken)
+        {
+            condWait(cpu->waitCond, mm->waitLock);
+        }
+    }
+    MM_STORE(cpu->parked, 0);
+#endif
+    cpu->woken = 0;
+    cpu->stop = RUN_BUDGET;
+    mutexUnlock(mm->waitLock);
+}
+
+void c64cpu_wake(c64cpu_t *cpu)
+{
+    c64mm_t *mm = cpu->mm;
+    mutexLock(mm->waitLock);
+    for (c64cpu_t **link = &mm->waiters; *link != NULL; link = &(*link)->waitNext)
+    {
+        if (*link == cpu)
+        {
+            c64cpu_unpark(link);
+            mutexUnlock(mm->waitLock);
+            return;
+        }
+    }
+    cpu->woken = 1;
+    mutexUnlock(mm->waitLock);
+}
+
+static inline void c64cpu_exec_INT(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const uint64_t value = insn->imm;
+    if (!c64cpu_getFlag(cpu, FLAG_INTERRUPT) &&
+        c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_SP), c64cpu_stateWords + 1))
+    {
+        return;
+    }
+    c64cpu_handleInterrupt(cpu, value);
+}
+
+static inline void c64cpu_execRTI(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    if (c64cpu_stackFault(cpu, insn, c64cpu_getReg(cpu, REG_FP), -(c64cpu_stateWords + 1)))
+    {
+        return;
+    }
+    c64cpu_setFlag(cpu, FLAG_INTERRUPT, 0);
+    c64cpu_popState(cpu);
+}
+
+// Bytes of a block run that stay on the pages of both addresses, at most size.
+// Every run is handed to the libc kernels (memcpy, memset, memcmp, memchr) if
+// both pages are host memory and walked byte by byte through the TLB otherwise.
+static inline uint64_t c64cpu_blockRun(uint64_t size, uint64_t address1, uint64_t address2)
+{
+    const uint64_t left1 = MM_PAGE_SIZE - (address1 & MM_PAGE_MASK);
+    const uint64_t left2 = MM_PAGE_SIZE - (address2 & MM_PAGE_MASK);
+    const uint64_t run = left1 < left2 ? left1 : left2;
+    return run < size ? run : size;
+}
+
+// Runs the block instruction again unless its count is used up
+static inline void c64cpu_blockContinue(c64cpu_t *cpu, const c64insn_t *insn, uint64_t count)
+{
+    if (count != 0)
+    {
+        c64cpu_setReg(cpu, REG_IP, c64cpu_getReg(cpu, REG_IP) - insn->length);
+    }
+}
+
+static inline void c64cpu_execMCPY(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    uint64_t destination = cpu->regs[insn->r1];
+    uint64_t source = cpu->regs[insn->r2];
+    uint64_t count = cpu->regs[insn->r3];
+    uint64_t chunk = count < c64cpu_blockChunk ? count : c64cpu_blockChunk;
+
+    while (chunk > 0)
+    {
+        const uint64_t run = c64cpu_blockRun(chunk, destination, source);
+        const uint8_t *from = c64tlb_lookup(&cpu->tlb, source, MM_READ);
+        uint8_t *to = c64tlb_lookup(&cpu->tlb, destination, MM_WRITE);
+        if (from != NULL && to != NULL)
+        {
+            // Copies ascending like the byte loop, a destination just above
+            // the source repeats the bytes in between
+            if (to > from && to < from + run)
+            {
+                const uint64_t distance = (uint64_t)(to - from);
+                for (uint64_t done = 0; done < run; done += distance)
+                {
+                    memcpy(to + done, from + done, run - done < distance ? run - done : distance);
+                }
+            }
+            else
+            {
+                memmove(to, from, run);
+            }
+            c64mm_touchBlock(cpu->mm, destination, run);
+        }
+        else
+        {
+            for (uint64_t i = 0; i < run; i++)
+            {
+                c64tlb_setUint8(&cpu->tlb, destination + i, c64tlb_getUint8(&cpu->tlb, source + i));
+            }
+        }
+        destination += run;
+        source += run;
+        count -= run;
+        chunk -= run;
+    }
+
+    cpu->regs[insn->r1] = destination;
+    cpu->regs[insn->r2] = source;
+    cpu->regs[insn->r3] = count;
+    c64cpu_blockContinue(cpu, insn, count);
+}
+
+static inline void c64cpu_execMSET(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    uint64_t destination = cpu->regs[insn->r1];
+    const uint8_t value = (uint8_t)cpu->regs[insn->r2];
+    uint64_t count = cpu->regs[insn->r3];
+    uint64_t chunk = count < c64cpu_blockChunk ? count : c64cpu_blockChunk;
+
+    while (chunk > 0)
+    {
+        const uint64_t run = c64cpu_blockRun(chunk, destination, destination);
+        uint8_t *to = c64tlb_lookup(&cpu->tlb, destination, MM_WRITE);
+        if (to != NULL)
+        {
+            memset(to, value, run);
+            c64mm_touchBlock(cpu->mm, destination, run);
+        }
+        else
+        {
+            for (uint64_t i = 0; i < run; i++)
+            {
+                c64tlb_setUint8(&cpu->tlb, destination + i, value);
+            }
+        }
+        destination += run;
+        count -= run;
+        chunk -= run;
+    }
+
+    cpu->regs[insn->r1] = destination;
+    cpu->regs[insn->r3] = count;
+    c64cpu_blockContinue(cpu, insn, count);
+}
+
+static inline void c64cpu_execMCMP(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    uint64_t address1 = cpu->regs[insn->r1];
+    uint64_t address2 = cpu->regs[insn->r2];
+    uint64_t count = cpu->regs[insn->r3];
+    uint64_t chunk = count < c64cpu_blockChunk ? count : c64cpu_blockChunk;
+    uint64_t offset = UINT64_MAX; // of the first difference in the run
+
+    while (chunk > 0 && offset == UINT64_MAX)
+    {
+        const uint64_t run = c64cpu_blockRun(chunk, address1, address2);
+        const uint8_t *bytes1 = c64tlb_lookup(&cpu->tlb, address1, MM_READ);
+        const uint8_t *bytes2 = c64tlb_lookup(&cpu->tlb, address2, MM_READ);
+        if (bytes1 != NULL && bytes2 != NULL)
+        {
+            if (memcmp(bytes1, bytes2, run) != 0)
+            {
+                for (offset = 0; bytes1[offset] == bytes2[offset]; offset++)
+                {
+                }
+            }
+        }
+        else
+        {
+            for (uint64_t i = 0; i < run && offset == UINT64_MAX; i++)
+            {
+                if (c64tlb_getUint8(&cpu->tlb, address1 + i) != c64tlb_getUint8(&cpu->tlb, address2 + i))
+                {
+                    offset = i;
+                }
+            }
+        }
+        const uint64_t done = offset == UINT64_MAX ? run : offset;
+        address1 += done;
+        address2 += done;
+        count -= done;
+        chunk -= done;
+    }
+
+    cpu->regs[insn->r1] = address1;
+    cpu->regs[insn->r2] = address2;
+    cpu->regs[insn->r3] = count;
+    if (offset != UINT64_MAX)
+    {
+        // As CMP on the differing bytes
+        const uint64_t value1 = c64tlb_getUint8(&cpu->tlb, address1);
+        const uint64_t value2 = c64tlb_getUint8(&cpu->tlb, address2);
+        c64cpu_setFlags(cpu, FLAGS_CMP, value1, value1 - value2);
+    }
+    else if (count == 0)
+    {
+        c64cpu_setFlags(cpu, FLAGS_CMP, 0, 0);
+    }
+    else
+    {
+        c64cpu_blockContinue(cpu, insn, count);
+    }
+}
+
+static inline void c64cpu_execMSCAN(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    uint64_t address = cpu->regs[insn->r1];
+    const uint8_t value = (uint8_t)cpu->regs[insn->r2];
+    uint64_t count = cpu->regs[insn->r3];
+    uint64_t chunk = count < c64cpu_blockChunk ? count : c64cpu_blockChunk;
+    uint64_t offset = UINT64_MAX; // of the match in the run
+
+    while (chunk > 0 && offset == UINT64_MAX)
+    {
+        const uint64_t run = c64cpu_blockRun(chunk, address, address);
+        const uint8_t *bytes = c64tlb_lookup(&cpu->tlb, address, MM_READ);
+        if (bytes != NULL)
+        {
+            const uint8_t *match = memchr(bytes, value, run);
+            if (match != NULL)
+            {
+                offset = (uint64_t)(match - bytes);
+            }
+        }
+        else
+        {
+            for (uint64_t i = 0; i < run && offset == UINT64_MAX; i++)
+            {
+                if (c64tlb_getUint8(&cpu->tlb, address + i) == value)
+                {
+                    offset = i;
+                }
+            }
+        }
+        const uint64_t done = offset == UINT64_MAX ? run : offset;
+        address += done;
+        count -= done;
+        chunk -= done;
+    }
+
+    cpu->regs[insn->r1] = address;
+    cpu->regs[insn->r3] = count;
+    if (offset != UINT64_MAX || count == 0)
+    {
+        // Z if found, the previous and result values only serve to set it
+        const uint64_t found = offset != UINT64_MAX;
+        c64cpu_setFlags(cpu, FLAGS_CMP, !found, !found);
+    }
+    else
+    {
+        c64cpu_blockContinue(cpu, insn, count);
+    }
+}
+
+static inline void c64cpu_execVLD(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    c64vec_t *vector = &cpu->vregs[insn->r1];
+    const uint64_t address = cpu->regs[insn->r2];
+    const uint8_t *host = c64tlb_tracing(&cpu->tlb) ? NULL : c64tlb_read(&cpu->tlb, address, VREG_SIZE);
+    if (host != NULL)
+    {
+        memcpy(vector, host, VREG_SIZE);
+        return;
+    }
+    vector->u64[0] = c64tlb_getUint64(&cpu->tlb, address);
+    vector->u64[1] = c64tlb_getUint64(&cpu->tlb, address + 8);
+}
+
+static inline void c64cpu_execVST(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    const c64vec_t *vector = &cpu->vregs[insn->r1];
+    const uint64_t address = cpu->regs[insn->r2];
+    uint8_t *host = c64tlb_tracing(&cpu->tlb) ? NULL : c64tlb_write(&cpu->tlb, address, VREG_SIZE);
+    if (host != NULL)
+    {
+        memcpy(host, vector, VREG_SIZE);
+        c64mm_touch(cpu->mm, address, VREG_SIZE);
+        return;
+    }
+    c64tlb_setUint64(&cpu->tlb, address, vector->u64[0]);
+    c64tlb_setUint64(&cpu->tlb, address + 8, vector->u64[1]);
+}
+
+static inline void c64cpu_execVMOV(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    cpu->vregs[insn->r1] = cpu->vregs[insn->r2];
+}
+
+static inline void c64cpu_execVSPLAT(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    c64vec_splat(&cpu->vregs[insn->r1], cpu->regs[insn->r2], c64vec_laneSize(insn->opcode));
+}
+
+// v1 = v1 op v2 with the lane width of the opcode
+#define VEC_LANEWISE(name, kernel)                                                                      \
+    static inline void c64cpu_exec##name(c64cpu_t *cpu, const c64insn_t *insn)                          \
+    {                                                                                                   \
+        kernel(&cpu->vregs[insn->r1], &cpu->vregs[insn->r2], c64vec_laneSize(insn->opcode));            \
+    }
+VEC_LANEWISE(VADD, c64vec_add)
+VEC_LANEWISE(VSUB, c64vec_sub)
+VEC_LANEWISE(VMUL, c64vec_mul)
+VEC_LANEWISE(VMIN, c64vec_min)
+VEC_LANEWISE(VMAX, c64vec_max)
+VEC_LANEWISE(VCMPEQ, c64vec_cmpeq)
+VEC_LANEWISE(VCMPGT, c64vec_cmpgt)
+#undef VEC_LANEWISE
+
+static inline void c64cpu_execVAND(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    c64vec_and(&cpu->vregs[insn->r1], &cpu->vregs[insn->r2]);
+}
+
+static inline void c64cpu_execVOR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    c64vec_or(&cpu->vregs[insn->r1], &cpu->vregs[insn->r2]);
+}
+
+static inline void c64cpu_execVXOR(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    c64vec_xor(&cpu->vregs[insn->r1], &cpu->vregs[insn->r2]);
+}
+
+static inline void c64cpu_execVSHUF(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    c64vec_shuffle(&cpu->vregs[insn->r1], &cpu->vregs[insn->r2]);
+}
+
+static inline void c64cpu_execVHADD(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    cpu->regs[insn->r1] = c64vec_reduceAdd(&cpu->vregs[insn->r2], c64vec_laneSize(insn->opcode));
+}
+
+static inline void c64cpu_execVHMIN(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    cpu->regs[insn->r1] = c64vec_reduceMin(&cpu->vregs[insn->r2], c64vec_laneSize(insn->opcode));
+}
+
+static inline void c64cpu_execVHMAX(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    cpu->regs[insn->r1] = c64vec_reduceMax(&cpu->vregs[insn->r2], c64vec_laneSize(insn->opcode));
+}
+
+static inline void c64cpu_execVMASK(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    cpu->regs[insn->r1] = c64vec_mask(&cpu->vregs[insn->r2]);
+}
+
+static inline void c64cpu_execNOP(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)cpu;
+    (void)insn;
+}
+
+static inline void c64cpu_execHLT(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    (void)insn;
+    cpu->stop = RUN_HALTED;
+}
+
+static inline void c64cpu_execBREAK(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    c64cpu_setReg(cpu, REG_IP, c64cpu_getReg(cpu, REG_IP) - insn->length);
+    cpu->stop = RUN_BREAKPOINT;
+}
+
+static inline void c64cpu_execINVALID(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    // c64cpu_decodeMiss leaves instructions it may not execute empty
+    c64cpu_fault(cpu, insn, insn->length == 0 ? FAULT_EXECUTE : FAULT_INVALID_OPCODE);
+}
+
+// Handlers that may set cpu->stop, everything else runs on unchecked
+#define CAN_STOP(op) ((op) == OP_HLT || (op) == OP_DIVI || (op) == OP_MODI || (op) == OP_DIVIS || \
+                      (op) == OP_DIV || (op) == OP_MOD || (op) == OP_DIVS || (op) == OP_WAITADDR ||  \
+                      USES_STACK(op))
+// Whether the instruction that set cpu->stop counts as run. HLT and WAITADDR
+// do, a fault or breakpoint leaves IP on the instruction.
+#define STOP_RAN(stop) ((stop) == RUN_HALTED || (stop) == RUN_WAIT)
+// Handlers that fault on leaving the stack bounds
+#define USES_STACK(op) (((op) >= OP_BRA && (op) <= OP_BLE) || ((op) >= OP_BRAR && (op) <= OP_BLER) ||        \
+                        (op) == OP_PUSH || (op) == OP_PUSHI || (op) == OP_POP || (op) == OP_RET ||            \
+                        (op) == OP_CALL || (op) == OP_CALLR || (op) == OP_RTC || (op) == OP_CALLM ||          \
+                        (op) == OP_RETM || (op) == OP__INT || (op) == OP_RTI)
+
+uint16_t c64cpu_executeInstruction(c64cpu_t *cpu, const c64insn_t *insn)
+{
+    switch (insn->op)
+    {
+#define X(name)                            \
+    case OP_##name:                        \
+        c64cpu_exec##name(cpu, insn);      \
+        break;
+        C64_OPCODES(X)
+        C64_FUSED_OPS(X)
+#undef X
+    case OP_BREAK:
+        c64cpu_execBREAK(cpu, insn);
+        break;
+    default:
+        c64cpu_execINVALID(cpu, insn);
+    }
+    return insn->opcode;
+}
+
+// Executes opcode as if it had just been fetched, its operands are read from IP
+uint16_t c64cpu_execute(c64cpu_t *cpu, uint16_t opcode)
+{
+    c64insn_t insn;
+    const uint64_t address = c64cpu_getReg(cpu, REG_IP) - sizeof(uint16_t);
+    c64decode_operands(cpu->mm, &insn, address, opcode);
+    c64cpu_setReg(cpu, REG_IP, address + insn.length);
+    return c64cpu_executeInstruction(cpu, &insn);
+}
+
+// Drops everything cached from the memory map once it changed
+static void c64cpu_syncMap(c64cpu_t *cpu)
+{
+    if (c64tlb_isCurrent(&cpu->tlb))
     {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (c64cpu_getFlag(cpu, FLAG_ZERO))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JEQ;
+        return;
     }
-    case JNE:
+    c64tlb_flush(&cpu->tlb);
+    c64decode_flush(cpu->icache, ICACHE_SIZE);
+    if (cpu->jit != NULL)
     {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (!c64cpu_getFlag(cpu, FLAG_ZERO))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JNE;
+        c64jit_flush(cpu->jit);
+        cpu->jitLastExit = NULL;
     }
-    case JGT:
+}
+
+uint16_t c64cpu_step(c64cpu_t *cpu)
+{
+    c64cpu_syncMap(cpu);
+    const uint64_t ip = c64cpu_getReg(cpu, REG_IP);
+    const c64insn_t *insn = c64cpu_decodeAt(cpu, ip);
+    c64insn_t single;
+    // Steps through fused pairs one instruction at a time, and runs the
+    // instruction under a breakpoint instead of stopping in front of it
+    if (insn->op == OP_BREAK && insn->length == 0)
     {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (!c64cpu_getFlag(cpu, FLAG_ZERO) && !c64cpu_getFlag(cpu, FLAG_NEGATIVE))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JGT;
+        // The breakpoint is on a page that is not executable
+        single = *insn;
+        single.op = OP_INVALID;
+        insn = &single;
     }
-    case JLT:
+    else if (insn->split != 0 || insn->op == OP_BREAK)
     {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (c64cpu_getFlag(cpu, FLAG_NEGATIVE))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JLT;
+        c64decode(cpu->mm, &single, ip);
+        insn = &single;
     }
-    case JGE:
+    c64cpu_setReg(cpu, REG_IP, ip + insn->length);
+    cpu->stop = RUN_BUDGET;
+    const uint16_t opcode = c64cpu_executeInstruction(cpu, insn);
+    if (cpu->stop == RUN_FAULT)
     {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (!c64cpu_getFlag(cpu, FLAG_NEGATIVE))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JGE;
+        c64cpu_reportFault(cpu);
     }
-    case JLE:
+    cpu->retired++;
+    return opcode;
+}
+
+#if defined(__GNUC__)
+// Handler labels of c64cpu_runThreaded, published when the first cpu is
+// created so decoded instructions can carry their dispatch target
+static const void *const *c64cpu_labels = NULL;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+// Direct threaded dispatch. Every handler ends in its own indirect jump
+// to the handler stored in the next decoded instruction.
+// Returns the number of instructions run.
+static uint64_t c64cpu_runThreaded(c64cpu_t *cpu, uint64_t count)
+{
+    static const void *const labels[OP_COUNT] = {
+#define X(name) [OP_##name] = &&exec##name,
+        C64_OPCODES(X)
+        C64_FUSED_OPS(X)
+#undef X
+        [OP_BREAK] = &&execBREAK,
+        [OP_INVALID] = &&execINVALID,
+    };
+    const c64insn_t *insn;
+    c64insn_t single;
+    uint64_t remaining = count;
+    uint64_t ip;
+
+    if (cpu == NULL)
     {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (c64cpu_getFlag(cpu, FLAG_ZERO) || c64cpu_getFlag(cpu, FLAG_NEGATIVE))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JLE;
-    }
-    case BRA:
+        c64cpu_labels = labels;
+        return 0;
+    }
+
+#define DISPATCH()                                     \
+    do                                                 \
+    {                                                  \
+        if (remaining == 0)                            \
+        {                                              \
+            return count;                              \
+        }                                              \
+        remaining--;                                   \
+        ip = c64cpu_getReg(cpu, REG_IP);               \
+        insn = c64cpu_decodeAt(cpu, ip);               \
+        c64cpu_setReg(cpu, REG_IP, ip + insn->length); \
+        goto *insn->handler;                           \
+    } while (0)
+
+    DISPATCH();
+
+    // See STOP_RAN for what counts as run
+#define X(name)                                                          \
+    exec##name:                                                          \
+    c64cpu_exec##name(cpu, insn);                                        \
+    if (CAN_STOP(OP_##name) && cpu->stop != RUN_BUDGET)                  \
+    {                                                                    \
+        return count - remaining - !STOP_RAN(cpu->stop);            \
+    }                                                                    \
+    DISPATCH();
+    C64_OPCODES(X)
+#undef X
+
+    // A fused pair counts as two instructions, with room for one only its first runs
+#define X(name)                                         \
+    exec##name:                                         \
+    if (remaining == 0)                                 \
+    {                                                   \
+        c64decode(cpu->mm, &single, ip);                \
+        c64cpu_setReg(cpu, REG_IP, ip + single.length); \
+        c64cpu_executeInstruction(cpu, &single);        \
+        return count;                                   \
+    }                                                   \
+    remaining--;                                        \
+    c64cpu_exec##name(cpu, insn);                       \
+    DISPATCH();
+    C64_FUSED_OPS(X)
+#undef X
+
+execBREAK:
+    c64cpu_execBREAK(cpu, insn);
+    return count - remaining - 1;
+execINVALID:
+    c64cpu_execINVALID(cpu, insn);
+    return count - remaining - 1;
+#undef DISPATCH
+}
+#pragma GCC diagnostic pop
+#else
+typedef void (*c64cpu_handler_t)(c64cpu_t *cpu, const c64insn_t *insn);
+
+// Portable fallback, calls the handlers through a table indexed by OP_*
+static uint64_t c64cpu_runThreaded(c64cpu_t *cpu, uint64_t count)
+{
+    static const c64cpu_handler_t handlers[OP_COUNT] = {
+#define X(name) [OP_##name] = c64cpu_exec##name,
+        C64_OPCODES(X)
+        C64_FUSED_OPS(X)
+#undef X
+        [OP_BREAK] = c64cpu_execBREAK,
+        [OP_INVALID] = c64cpu_execINVALID,
+    };
+
+    if (cpu == NULL)
     {
-        const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-        c64cpu_push(cpu, retAdd);
-        const uint64_t address = c64cpu_fetch64(cpu);
-        c64cpu_setRegister(cpu, "IP", address);
-        return BRA;
+        return 0;
     }
-    case BEQ:
+    for (uint64_t i = 0; i < count; i++)
     {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (c64cpu_getFlag(cpu, FLAG_ZERO))
+        const uint64_t ip = c64cpu_getReg(cpu, REG_IP);
+        const c64insn_t *insn = c64cpu_decodeAt(cpu, ip);
+        c64insn_t single;
+        if (insn->split != 0 && ++i == count)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            c64decode(cpu->mm, &single, ip);
+            insn = &single;
+            i--;
         }
-        return BEQ;
-    }
-    case BNE:
-    {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (!c64cpu_getFlag(cpu, FLAG_ZERO))
+        c64cpu_setReg(cpu, REG_IP, ip + insn->length);
+        handlers[insn->op](cpu, insn);
+        if (cpu->stop != RUN_BUDGET)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            return i + STOP_RAN(cpu->stop);
         }
-        return BNE;
     }
-    case BGT:
-    {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (!c64cpu_getFlag(cpu, FLAG_ZERO) && !c64cpu_getFlag(cpu, FLAG_NEGATIVE))
+    return count;
+}
+#endif
+
+// Fused pair of insn and the instruction after it, OP_INVALID if there is none
+static uint8_t c64cpu_fusedOp(c64cpu_t *cpu, const c64insn_t *insn, const c64insn_t *next)
+{
+    static const uint8_t compares[][2] = {
+        [OP_JEQ - OP_JEQ] = {OP_CMPJEQ, OP_CMPIJEQ},
+        [OP_JNE - OP_JEQ] = {OP_CMPJNE, OP_CMPIJNE},
+        [OP_JGT - OP_JEQ] = {OP_CMPJGT, OP_CMPIJGT},
+        [OP_JLT - OP_JEQ] = {OP_CMPJLT, OP_CMPIJLT},
+        [OP_JGE - OP_JEQ] = {OP_CMPJGE, OP_CMPIJGE},
+        [OP_JLE - OP_JEQ] = {OP_CMPJLE, OP_CMPIJLE},
+    };
+    switch (next->op)
+    {
+    case OP_JEQ:
+    case OP_JNE:
+    case OP_JGT:
+    case OP_JLT:
+    case OP_JGE:
+    case OP_JLE:
+        if (insn->op == OP_CMP || insn->op == OP_CMPI)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            return compares[next->op - OP_JEQ][insn->op == OP_CMPI];
         }
-        return BGT;
-    }
-    case BLT:
-    {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (c64cpu_getFlag(cpu, FLAG_NEGATIVE))
+        break;
+    case OP_ADD:
+        if (insn->op == OP_LDI)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            return OP_LDIADD;
         }
-        return BLT;
-    }
-    case BGE:
-    {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (!c64cpu_getFlag(cpu, FLAG_NEGATIVE))
+        break;
+    case OP_CALL:
+        if (insn->op == OP_PUSHI && !cpu->stackBounded)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            return OP_PUSHICALL;
         }
-        return BGE;
+        break;
+    }
+    return OP_INVALID;
+}
+
+// Fuses insn with the instruction after it into a superinstruction if the pair
+// is one of C64_FUSED_OPS. Both have to be on the line insn is cached for and
+// the second must not be a breakpoint, it then never runs on its own.
+static void c64cpu_fuse(c64cpu_t *cpu, c64insn_t *insn)
+{
+    const uint64_t address = insn->address;
+    const uint64_t following = address + insn->length;
+    c64insn_t next;
+
+    if (cpu->engine == ENGINE_JIT || address == UINT64_MAX)
+    {
+        return;
     }
-    case BLE:
+    if (insn->op != OP_CMP && insn->op != OP_CMPI && insn->op != OP_LDI && insn->op != OP_PUSHI)
     {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        if (c64cpu_getFlag(cpu, FLAG_ZERO) || c64cpu_getFlag(cpu, FLAG_NEGATIVE))
-        {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return BLE;
+        return;
     }
-    case JMPR:
+    // Room for the longest instruction, decoding it must not leave the page
+    if ((following & MM_PAGE_MASK) > MM_PAGE_SIZE - 16 || (cpu->breakpointCount > 0 && c64cpu_isBreakpoint(cpu, following)))
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        c64cpu_setRegister(cpu, "IP", address);
-        return JMPR;
+        return;
     }
-    case JEQR:
+    c64decode(cpu->mm, &next, following);
+    if (next.address == UINT64_MAX || (following + next.length - 1) >> MM_LINE_SHIFT != address >> MM_LINE_SHIFT)
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (c64cpu_getFlag(cpu, FLAG_ZERO))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JEQR;
+        return;
     }
-    case JNER:
+
+    const uint8_t op = c64cpu_fusedOp(cpu, insn, &next);
+    if (op == OP_INVALID)
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (!c64cpu_getFlag(cpu, FLAG_ZERO))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JNER;
+        return;
     }
-    case JGTR:
+    insn->op = op;
+    insn->split = insn->length;
+    insn->length += next.length;
+    insn->target = next.imm;
+    if (op == OP_LDIADD)
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (!c64cpu_getFlag(cpu, FLAG_ZERO) && !c64cpu_getFlag(cpu, FLAG_NEGATIVE))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JGTR;
+        insn->r2 = next.r1;
+        insn->r3 = next.r2;
     }
-    case JLTR:
+}
+
+void c64cpu_decodeMiss(c64cpu_t *cpu, c64insn_t *insn, uint64_t address)
+{
+    const uint8_t attributes = c64mm_getAttributes(cpu->mm, address);
+    if (!(attributes & MM_EXEC))
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (c64cpu_getFlag(cpu, FLAG_NEGATIVE))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JLTR;
+        memset(insn, 0, sizeof(*insn));
+        insn->address = address;
+        insn->gen = c64mm_getWriteGen(cpu->mm, address);
+        insn->op = OP_INVALID;
     }
-    case JGER:
+    else
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (!c64cpu_getFlag(cpu, FLAG_NEGATIVE))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JGER;
+        c64decode(cpu->mm, insn, address);
     }
-    case JLER:
+    if (cpu->breakpointCount > 0 && c64cpu_isBreakpoint(cpu, address))
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (c64cpu_getFlag(cpu, FLAG_ZERO) || c64cpu_getFlag(cpu, FLAG_NEGATIVE))
-        {
-            c64cpu_setRegister(cpu, "IP", address);
-        }
-        return JLER;
+        insn->op = OP_BREAK;
     }
-    case BRAR:
+    else if (!(attributes & MM_MMIO))
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-        c64cpu_push(cpu, retAdd);
-        c64cpu_setRegister(cpu, "IP", address);
-        return BRAR;
+        c64cpu_fuse(cpu, insn);
     }
-    case BEQR:
+#if defined(__GNUC__)
+    insn->handler = c64cpu_labels[insn->op];
+#endif
+}
+
+// Runs translated blocks where there are any. In between, instructions are
+// interpreted up to the next jump or translatable instruction, so only
+// block heads are counted towards translation.
+static uint64_t c64cpu_runJit(c64cpu_t *cpu, uint64_t count)
+{
+    uint64_t remaining = count;
+    while (remaining > 0)
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (c64cpu_getFlag(cpu, FLAG_ZERO))
+        remaining -= c64jit_run(cpu, remaining);
+        while (remaining > 0)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            const uint64_t ip = c64cpu_getReg(cpu, REG_IP);
+            const c64insn_t *insn = c64cpu_decodeAt(cpu, ip);
+            const uint64_t next = ip + insn->length;
+            c64cpu_setReg(cpu, REG_IP, next);
+            c64cpu_executeInstruction(cpu, insn);
+            if (cpu->stop != RUN_BUDGET)
+            {
+                return count - remaining + STOP_RAN(cpu->stop);
+            }
+            remaining--;
+            if (c64cpu_getReg(cpu, REG_IP) != next || c64jit_canTranslate(c64cpu_decodeAt(cpu, next)))
+            {
+                break;
+            }
         }
-        return BEQR;
     }
-    case BNER:
+    return count;
+}
+
+static uint64_t c64cpu_runSwitch(c64cpu_t *cpu, uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (!c64cpu_getFlag(cpu, FLAG_ZERO))
+        const uint64_t ip = c64cpu_getReg(cpu, REG_IP);
+        const c64insn_t *insn = c64cpu_decodeAt(cpu, ip);
+        c64insn_t single;
+        // A fused pair counts as two instructions, with room for one only its first runs
+        if (insn->split != 0 && ++i == count)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            c64decode(cpu->mm, &single, ip);
+            insn = &single;
+            i--;
         }
-        return BNER;
-    }
-    case BGTR:
-    {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (!c64cpu_getFlag(cpu, FLAG_ZERO) && !c64cpu_getFlag(cpu, FLAG_NEGATIVE))
+        c64cpu_setReg(cpu, REG_IP, ip + insn->length);
+        c64cpu_executeInstruction(cpu, insn);
+        if (cpu->stop != RUN_BUDGET)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            return i + STOP_RAN(cpu->stop);
         }
-        return BGTR;
     }
-    case BLTR:
+    return count;
+}
+
+#if C64_PROFILE || C64_TRACE
+// c64cpu_runSwitch for the profiler and the tracer, which see every
+// instruction. Fused pairs are run apart so each instruction shows up with
+// its own opcode.
+static uint64_t c64cpu_runInstrumented(c64cpu_t *cpu, uint64_t count)
+{
+#if C64_PROFILE
+    uint64_t start = c64prof_now();
+#endif
+    for (uint64_t i = 0; i < count; i++)
     {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (c64cpu_getFlag(cpu, FLAG_NEGATIVE))
+        const uint64_t ip = c64cpu_getReg(cpu, REG_IP);
+        const c64insn_t *insn = c64cpu_decodeAt(cpu, ip);
+        c64insn_t single;
+        if (insn->split != 0)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            c64decode(cpu->mm, &single, ip);
+            insn = &single;
         }
-        return BLTR;
-    }
-    case BGER:
-    {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (!c64cpu_getFlag(cpu, FLAG_NEGATIVE))
+        if (c64tlb_tracing(&cpu->tlb) && insn->op != OP_BREAK)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            c64trace_record(cpu->tlb.trace, TRACE_INSN, ip, 0, insn->opcode);
         }
-        return BGER;
-    }
-    case BLER:
-    {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        if (c64cpu_getFlag(cpu, FLAG_ZERO) || c64cpu_getFlag(cpu, FLAG_NEGATIVE))
+        c64cpu_setReg(cpu, REG_IP, ip + insn->length);
+        c64cpu_executeInstruction(cpu, insn);
+        if (cpu->stop == RUN_BREAKPOINT || cpu->stop == RUN_FAULT)
         {
-            const uint64_t retAdd = c64cpu_getRegister(cpu, "IP");
-            c64cpu_push(cpu, retAdd);
-            c64cpu_setRegister(cpu, "IP", address);
+            return i;
+        }
+#if C64_PROFILE
+        if (cpu->prof != NULL)
+        {
+            const uint64_t end = c64prof_now();
+            c64prof_count(cpu->prof, insn, ip, end - start);
+            start = end;
+        }
+#endif
+        if (cpu->stop != RUN_BUDGET)
+        {
+            return i + 1;
         }
-        return BLER;
-    }
-    case RET:
-    {
-        const uint64_t retAdd = c64cpu_pop(cpu);
-        c64cpu_setRegister(cpu, "IP", retAdd);
-        return RET;
-    }
-    case PUSHI:
-    {
-        const uint64_t value = c64cpu_fetch64(cpu);
-        c64cpu_push(cpu, value);
-        return PUSHI;
-    }
-    case PUSH:
-    {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64mem_getUint64(cpu->registers, regIndex);
-        c64cpu_push(cpu, value);
-        return PUSH;
-    }
-    case POP:
-    {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t value = c64cpu_pop(cpu);
-        c64mem_setUint64(cpu->registers, regIndex, value);
-        return POP;
-    }
-    case CALL:
-    {
-        const uint64_t address = c64cpu_fetch64(cpu);
-        c64cpu_pushState(cpu);
-        c64cpu_setRegister(cpu, "IP", address);
-        return CALL;
-    }
-    case CALLR:
-    {
-        const uint64_t regIndex = c64cpu_fetchRegisterIndex(cpu);
-        const uint64_t address = c64mem_getUint64(cpu->registers, regIndex);
-        c64cpu_pushState(cpu);
-        c64cpu_setRegister(cpu, "IP", address);
-        return CALLR;
     }
-    case RTC:
+    return count;
+}
+#endif
+
+// Runs up to count instructions, fewer if cpu->stop gets set.
+// Returns the number of instructions run.
+static uint64_t c64cpu_runEngine(c64cpu_t *cpu, uint64_t count)
+{
+    uint64_t done;
+    c64cpu_syncMap(cpu);
+    cpu->stop = RUN_BUDGET;
+#if C64_PROFILE || C64_TRACE
+    if (cpu->prof != NULL || c64tlb_tracing(&cpu->tlb))
     {
-        c64cpu_popState(cpu);
-        return RTC;
+        done = c64cpu_runInstrumented(cpu, count);
     }
-    case CLC:
+    else
+#endif
+    if (cpu->engine == ENGINE_THREADED)
     {
-        c64cpu_setFlag(cpu, FLAG_CARRY, 0);
-        return CLC;
+        done = c64cpu_runThreaded(cpu, count);
     }
-    case SEC:
+    else if (cpu->engine == ENGINE_JIT)
     {
-        c64cpu_setFlag(cpu, FLAG_CARRY, 1);
-        return SEC;
+        done = c64cpu_runJit(cpu, count);
     }
-    case CLZ:
+    else
     {
-        c64cpu_setFlag(cpu, FLAG_ZERO, 0);
-        return CLZ;
+        done = c64cpu_runSwitch(cpu, count);
     }
-    case SEZ:
+    cpu->retired += done;
+    return done;
+}
+
+uint16_t c64cpu_stepMany(c64cpu_t *cpu, uint64_t count)
+{
+    c64cpu_runEngine(cpu, count);
+    return cpu->stop == RUN_HALTED ? HLT : NOP;
+}
+
+void c64cpu_setEngine(c64cpu_t *cpu, char engine)
+{
+    if (engine == ENGINE_JIT && cpu->jit == NULL)
     {
-        c64cpu_setFlag(cpu, FLAG_ZERO, 1);
-        return SEZ;
+        cpu->jit = c64jit_create();
+        if (cpu->jit == NULL)
+        {
+            warning("c64cpu_setEngine: no JIT on this host, using the threaded engine\n");
+            engine = ENGINE_THREADED;
+        }
     }
-    case CLN:
+    if (engine != cpu->engine)
     {
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, 0);
-        return CLN;
+        // Fusion depends on the engine
+        c64decode_flush(cpu->icache, ICACHE_SIZE);
     }
-    case SEN:
+    cpu->engine = engine;
+}
+
+void c64cpu_setProfiler(c64cpu_t *cpu, c64prof_t *prof)
+{
+#if !C64_PROFILE
+    if (prof != NULL)
     {
-        c64cpu_setFlag(cpu, FLAG_NEGATIVE, 1);
-        return SEN;
+        warning("c64cpu_setProfiler: built without C64_PROFILE, nothing is counted\n");
     }
-    case CLV:
+#endif
+    cpu->prof = prof;
+}
+
+void c64cpu_setTracer(c64cpu_t *cpu, c64trace_t *trace)
+{
+#if !C64_TRACE
+    if (trace != NULL)
     {
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, 0);
-        return CLV;
+        warning("c64cpu_setTracer: built without C64_TRACE, nothing is recorded\n");
     }
-    case SEV:
+#endif
+    if (trace != NULL && trace->cpu != NULL && trace->cpu != cpu)
     {
-        c64cpu_setFlag(cpu, FLAG_OVERFLOW, 1);
-        return SEV;
+        warning("c64cpu_setTracer: the trace is attached to another cpu, every cpu needs its own\n");
+        return;
     }
-    case CLI:
+    if (cpu->tlb.trace != NULL)
     {
-        c64cpu_setFlag(cpu, FLAG_INTERRUPT, 0);
-        return CLI;
+        cpu->tlb.trace->cpu = NULL;
     }
-    case SEI:
+    if (trace != NULL)
     {
-        c64cpu_setFlag(cpu, FLAG_INTERRUPT, 1);
-        return SEI;
+        trace->cpu = cpu;
     }
-    case _INT:
+    cpu->tlb.trace = trace;
+}
+
+void c64cpu_setSampler(c64cpu_t *cpu, c64sample_t *sampler)
+{
+    cpu->sampler = sampler;
+}
+
+char c64cpu_isBreakpoint(c64cpu_t *cpu, uint64_t address)
+{
+    for (size_t i = 0; i < cpu->breakpointCount; i++)
     {
-        const uint64_t value = c64cpu_fetch64(cpu);
-        c64cpu_handleInterrupt(cpu, value);
-        return _INT;
+        if (cpu->breakpoints[i] == address)
+        {
+            return 1;
+        }
     }
-    case RTI:
+    return 0;
+}
+
+// Drops decoded and translated code after a breakpoint changed. All of it, a
+// fused pair cached before the breakpoint may hold the instruction under it too.
+static void c64cpu_invalidateCode(c64cpu_t *cpu)
+{
+    c64decode_flush(cpu->icache, ICACHE_SIZE);
+    if (cpu->jit != NULL)
     {
-        c64cpu_setFlag(cpu, FLAG_INTERRUPT, 0);
-        c64cpu_popState(cpu);
-        return RTI;
+        c64jit_flush(cpu->jit);
+        cpu->jitLastExit = NULL;
     }
-    case NOP:
+}
+
+void c64cpu_setBreakpoint(c64cpu_t *cpu, uint64_t address)
+{
+    if (c64cpu_isBreakpoint(cpu, address))
     {
-        return NOP;
+        return;
     }
-    case HLT:
+    if (cpu->breakpointCount == c64cpu_maxBreakpoints)
     {
-        return HLT;
-    }
+        warning("c64cpu_setBreakpoint: no room for a breakpoint at 0x%016llx\n", address);
+        return;
     }
-
-    c64cpu_debug(cpu);
-    out("IP: 0x%08x", c64cpu_getRegister(cpu, "IP"));
-    c64cpu_viewMemoryAtWithHighlightedByte(cpu, c64cpu_getRegister(cpu, "IP") - 8, 16, c64cpu_getRegister(cpu, "IP") - 1);
-
-    error("Invalid opcode: 0x%04x", opcode);
-
-    return opcode;
+    cpu->breakpoints[cpu->breakpointCount++] = address;
+    c64cpu_invalidateCode(cpu);
 }
 
-uint16_t c64cpu_step(c64cpu_t *cpu)
+void c64cpu_clearBreakpoint(c64cpu_t *cpu, uint64_t address)
 {
-    uint16_t opcode = c64cpu_fetch16(cpu);
-    return c64cpu_execute(cpu, opcode);
+    for (size_t i = 0; i < cpu->breakpointCount; i++)
+    {
+        if (cpu->breakpoints[i] == address)
+        {
+            cpu->breakpoints[i] = cpu->breakpoints[--cpu->breakpointCount];
+            c64cpu_invalidateCode(cpu);
+            return;
+        }
+    }
 }
 
 void c64cpu_debug(c64cpu_t *cpu)
@@ -1443,17 +3017,25 @@ void c64cpu_debug(c64cpu_t *cpu)
     out("Registers:");
     for (int i = 0; i < REG_COUNT; i++)
     {
-        out("  %s: 0x%08x", cpu->regNames[i], c64cpu_getRegister(cpu, cpu->regNames[i]));
+        out("  %s: 0x%08x", cpu->regNames[i], cpu->regs[i]);
     }
+    c64cpu_materializeFlags(cpu);
+    out("Flags: C=%d Z=%d N=%d V=%d I=%d", (cpu->flags & FLAG_CARRY) != 0, (cpu->flags & FLAG_ZERO) != 0,
+        (cpu->flags & FLAG_NEGATIVE) != 0, (cpu->flags & FLAG_OVERFLOW) != 0, (cpu->flags & FLAG_INTERRUPT) != 0);
     out("");
 }
 
 void c64cpu_viewMemoryAt(c64cpu_t *cpu, uint64_t offset, size_t size)
 {
     printf("0x%08llx: ", offset);
+    uint8_t bytes[64];
     for (size_t i = 0; i < size; i++)
     {
-        printf("%02x ", c64mm_getUint8(cpu->mm, offset + i));
+        if (i % sizeof(bytes) == 0)
+        {
+            c64mm_read(cpu->mm, offset + i, bytes, size - i < sizeof(bytes) ? size - i : sizeof(bytes));
+        }
+        printf("%02x ", bytes[i % sizeof(bytes)]);
     }
     printf("\n");
 }
@@ -1461,13 +3043,18 @@ void c64cpu_viewMemoryAt(c64cpu_t *cpu, uint64_t offset, size_t size)
 void c64cpu_viewMemoryAtWithHighlightedByte(c64cpu_t *cpu, uint64_t offset, size_t size, uint64_t highlightedByte)
 {
     printf("0x%08llx: ", offset);
+    uint8_t bytes[64];
     for (size_t i = 0; i < size; i++)
     {
+        if (i % sizeof(bytes) == 0)
+        {
+            c64mm_read(cpu->mm, offset + i, bytes, size - i < sizeof(bytes) ? size - i : sizeof(bytes));
+        }
         if (offset + i == highlightedByte)
         {
             printf("\033[40m\033[91m");
         }
-        printf("%02x ", c64mm_getUint8(cpu->mm, offset + i));
+        printf("%02x ", bytes[i % sizeof(bytes)]);
         if (offset + i == highlightedByte)
         {
             printf("\033[0m");
@@ -1482,6 +3069,7 @@ void c64cpu_attachDebugger(c64cpu_t *cpu, void (*debugger)(c64cpu_t *cpu))
     char input[256];
     while (1)
     {
+        c64cpu_materializeFlags(cpu);
         debugger(cpu);
         printf("\n");
         printf("enter s to step, c to continue, or q to quit, or a number to step that many times: ");
@@ -1495,6 +3083,7 @@ void c64cpu_attachDebugger(c64cpu_t *cpu, void (*debugger)(c64cpu_t *cpu))
             const int n = atoi(input);
             for (int i = 0; i < n; i++)
             {
+                c64cpu_materializeFlags(cpu);
                 debugger(cpu);
             }
             continue;
@@ -1506,59 +3095,188 @@ void c64cpu_attachDebugger(c64cpu_t *cpu, void (*debugger)(c64cpu_t *cpu))
 
 void c64cpu_destroy(c64cpu_t *cpu)
 {
-    c64mm_destroy(cpu->mm);
-    c64mem_destroy(cpu->registers);
+    c64jit_destroy(cpu->jit);
+    condDestroy(cpu->waitCond);
+    c64mm_release(cpu->mm);
     free(cpu);
 }
 
-void c64cpu_run(c64cpu_t *cpu, char debug)
+uint8_t c64cpu_runFor(c64cpu_t *cpu, uint64_t budget)
 {
-#ifdef _WIN32
-    // Windows
-    LARGE_INTEGER frequency;
-    LARGE_INTEGER start, end;
+    // Continuing from a breakpoint runs the instruction under it
+    const uint64_t ip = c64cpu_getReg(cpu, REG_IP);
+    if (budget > 0 && cpu->stop == RUN_BREAKPOINT && c64cpu_isBreakpoint(cpu, ip))
+    {
+        c64insn_t insn;
+        c64decode(cpu->mm, &insn, ip);
+        c64cpu_setReg(cpu, REG_IP, ip + insn.length);
+        cpu->stop = RUN_BUDGET;
+        if (c64tlb_tracing(&cpu->tlb))
+        {
+            c64trace_record(cpu->tlb.trace, TRACE_INSN, ip, 0, insn.opcode);
+        }
+#if C64_PROFILE
+        const uint64_t start = c64prof_now();
+#endif
+        c64cpu_executeInstruction(cpu, &insn);
+        if (cpu->stop != RUN_FAULT)
+        {
+            cpu->retired++;
+            budget--;
+#if C64_PROFILE
+            if (cpu->prof != NULL)
+            {
+                c64prof_count(cpu->prof, &insn, ip, c64prof_now() - start);
+            }
+#endif
+        }
+        if (cpu->stop != RUN_BUDGET)
+        {
+            return cpu->stop;
+        }
+    }
+
+    // Enter the lowest raised and unmasked interrupt, the others wait until its RTI.
+    // Its bit is only cleared once the handler is entered.
+    const uint64_t enterable = c64cpu_enterable(cpu, MM_LOAD(cpu->pending));
+    if (enterable != 0)
+    {
+        if (!c64cpu_stackFits(cpu, c64cpu_getReg(cpu, REG_SP), c64cpu_stateWords + 1))
+        {
+            cpu->fault = FAULT_STACK;
+            cpu->stop = RUN_FAULT;
+            return RUN_FAULT;
+        }
+        uint16_t interrupt = 0;
+        while (!(enterable & ((uint64_t)1 << interrupt)))
+        {
+            interrupt++;
+        }
+        c64cpu_handleInterrupt(cpu, interrupt);
+#if defined(__GNUC__)
+        __atomic_fetch_and(&cpu->pending, ~((uint64_t)1 << interrupt), __ATOMIC_ACQ_REL);
 #else
-    // Linux
-    struct timespec start, end;
+        cpu->pending &= ~((uint64_t)1 << interrupt);
 #endif
+    }
 
-    double elapsed_ms, target_ms, sleep_ms;
+    // Interrupts are raised from outside the engines, so they are only
+    // looked for between slices
+    while (budget > 0)
+    {
+        uint64_t slice = budget < c64cpu_sliceSize ? budget : c64cpu_sliceSize;
+        if (cpu->sampler != NULL)
+        {
+            slice = c64sample_slice(cpu->sampler, cpu, slice);
+        }
+        budget -= c64cpu_runEngine(cpu, slice);
+        if (cpu->sampler != NULL)
+        {
+            c64sample_check(cpu->sampler, cpu);
+        }
+        if (cpu->stop != RUN_BUDGET)
+        {
+            return cpu->stop;
+        }
+        if (c64cpu_canEnterInterrupt(cpu))
+        {
+            return RUN_INTERRUPT;
+        }
+    }
+    return RUN_BUDGET;
+}
 
-#ifdef _WIN32
-    QueryPerformanceFrequency(&frequency);
-#endif
+static void c64cpu_reportFault(c64cpu_t *cpu)
+{
+    const uint64_t ip = c64cpu_getReg(cpu, REG_IP);
+    c64cpu_debug(cpu);
+    out("IP: 0x%08x", ip);
+    if (cpu->fault == FAULT_EXECUTE)
+    {
+        error("Not executable: 0x%016llx", ip);
+    }
+    if (cpu->fault == FAULT_STACK)
+    {
+        error("Stack out of bounds: SP 0x%016llx", c64cpu_getReg(cpu, REG_SP));
+    }
+    c64cpu_viewMemoryAtWithHighlightedByte(cpu, ip - 8, 16, ip);
+
+    if (cpu->fault == FAULT_DIVIDE)
+    {
+        error("Division fault: 0x%04x", c64mm_getUint16(cpu->mm, ip));
+    }
+    error("Invalid opcode: 0x%04x", c64mm_getUint16(cpu->mm, ip));
+}
+
+void c64cpu_run(c64cpu_t *cpu, char debug)
+{
+    cpu->throttleStart = monotonicNs();
+    cpu->throttleCount = 0;
 
     while (1)
     {
-#ifdef _WIN32
-        QueryPerformanceCounter(&start);
-#else
-        clock_gettime(CLOCK_MONOTONIC, &start);
-#endif
+        const uint64_t rate = cpu->rate;
+        uint64_t quantum = rate == 0 ? 1 << 20 : rate / (1000000000 / c64cpu_quantumNs);
+        if (quantum == 0 || debug)
+        {
+            quantum = 1;
+        }
 
-        uint16_t opcode = c64cpu_step(cpu);
+        const uint64_t retired = cpu->retired;
+        const uint8_t reason = c64cpu_runFor(cpu, quantum);
         if (debug)
         {
             c64cpu_debug(cpu);
         }
-        if (opcode == HLT)
+        if (reason == RUN_HALTED)
         {
+#if C64_PROFILE
+            if (cpu->prof != NULL)
+            {
+                c64prof_report(cpu->prof, stdout);
+            }
+#endif
             break;
         }
-#ifdef _WIN32
-        QueryPerformanceCounter(&end);
-        elapsed_ms = (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart;
-#else
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        elapsed_ms = (end.tv_sec - start.tv_sec) * 1000.0;
-        elapsed_ms += (end.tv_nsec - start.tv_nsec) / 1000000.0;
-#endif
-        target_ms = 1000.0 / c64cpu_speed;
+        if (reason == RUN_FAULT)
+        {
+            c64cpu_reportFault(cpu);
+        }
+        if (reason == RUN_WAIT)
+        {
+            c64cpu_wait(cpu);
+        }
+        if (rate == 0)
+        {
+            continue;
+        }
 
-        sleep_ms = target_ms - elapsed_ms;
-        if (sleep_ms > 0)
+        // Sleep until the wall clock catches up with the instructions run so far.
+        // Measuring against the start instead of per quantum keeps sleep
+        // overshoot from adding up.
+        cpu->throttleCount += cpu->retired - retired;
+        const uint64_t count = cpu->throttleCount;
+        const uint64_t due = count / rate * 1000000000 + count % rate * 1000000000 / rate;
+        const uint64_t elapsed = monotonicNs() - cpu->throttleStart;
+        if (due > elapsed)
         {
-            SLEEP_MS(sleep_ms);
+            sleepNs(due - elapsed);
+        }
+        else if (elapsed - due > c64cpu_maxLagNs)
+        {
+            cpu->throttleStart += elapsed - due;
         }
     }
+}
+
+void c64cpu_setRate(c64cpu_t *cpu, uint64_t rate)
+{
+    cpu->rate = rate;
+    cpu->throttleStart = monotonicNs();
+    cpu->throttleCount = 0;
+}
+
+uint64_t c64cpu_getRate(c64cpu_t *cpu)
+{
+    return cpu->rate;
 }
\ No newline at end of file
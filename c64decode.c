@@ -0,0 +1,620 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#include <c64decode.h>
+#include <c64mm.h>
+#include <c64instructions.h>
+#include <stdio.h>
+
+// Lane width variants decode like the instruction with 8 byte lanes
+static uint16_t c64decode_laneBase(uint16_t opcode)
+{
+    switch (opcode & 0xfcff)
+    {
+#define X(name) case name:
+        C64_LANE_OPCODES(X)
+#undef X
+        return opcode & 0xfcff;
+    }
+    return opcode;
+}
+
+uint8_t c64decode_format(uint16_t opcode)
+{
+    switch (c64decode_laneBase(opcode))
+    {
+    case NOP:
+    case RET:
+    case RTC:
+    case CLC:
+    case SEC:
+    case CLZ:
+    case SEZ:
+    case CLN:
+    case SEN:
+    case CLV:
+    case SEV:
+    case CLI:
+    case SEI:
+    case RTI:
+    case FENCE:
+    case HLT:
+        return FMT_NONE;
+    case NOTI:
+    case NOT:
+    case JMPR:
+    case JEQR:
+    case JNER:
+    case JGTR:
+    case JLTR:
+    case JGER:
+    case JLER:
+    case BRAR:
+    case BEQR:
+    case BNER:
+    case BGTR:
+    case BLTR:
+    case BGER:
+    case BLER:
+    case PUSH:
+    case POP:
+    case CALLR:
+        return FMT_R;
+    case TF:
+    case ADD:
+    case SUB:
+    case MUL:
+    case DIV:
+    case MOD:
+    case MULS:
+    case DIVS:
+    case AND:
+    case OR:
+    case XOR:
+    case SHL:
+    case SHR:
+    case ROL:
+    case ROR:
+    case CMP:
+    case LDR:
+    case LDBR:
+    case LDWR:
+    case LDDR:
+    case STR:
+    case STBR:
+    case STWR:
+    case STDR:
+    case LDP:
+    case LDBP:
+    case LDWP:
+    case LDDP:
+    case STP:
+    case STBP:
+    case STWP:
+    case STDP:
+    case XCHG:
+    case FETCHADD:
+    case WAITADDR:
+    case WAKEADDR:
+        return FMT_RR;
+    case LDO:
+    case LDBO:
+    case LDWO:
+    case LDDO:
+    case STO:
+    case STBO:
+    case STWO:
+    case STDO:
+        return FMT_RRI32;
+    case LDX:
+    case LDBX:
+    case LDWX:
+    case LDDX:
+    case STX:
+    case STBX:
+    case STWX:
+    case STDX:
+        return FMT_RRRI8;
+    case LDBI:
+        return FMT_RI8;
+    case LDWI:
+        return FMT_RI16;
+    case LDDI:
+        return FMT_RI32;
+    case LDI:
+    case LDM:
+    case LDBM:
+    case LDWM:
+    case LDDM:
+    case ST:
+    case STB:
+    case STW:
+    case STD:
+    case ADDI:
+    case SUBI:
+    case MULI:
+    case DIVI:
+    case MODI:
+    case MULIS:
+    case DIVIS:
+    case ANDI:
+    case ORI:
+    case XORI:
+    case SHLI:
+    case SHRI:
+    case RORI:
+    case ROLI:
+    case CMPI:
+        return FMT_RI64;
+    case JMP:
+    case JEQ:
+    case JNE:
+    case JGT:
+    case JLT:
+    case JGE:
+    case JLE:
+    case BRA:
+    case BEQ:
+    case BNE:
+    case BGT:
+    case BLT:
+    case BGE:
+    case BLE:
+    case PUSHI:
+    case CALL:
+    case _INT:
+        return FMT_I64;
+    case MCPY:
+    case MSET:
+    case MCMP:
+    case MSCAN:
+    case CAS:
+        return FMT_RRR;
+    case VLD:
+    case VST:
+    case VSPLAT:
+        return FMT_VR;
+    case VMOV:
+    case VADD:
+    case VSUB:
+    case VMUL:
+    case VMIN:
+    case VMAX:
+    case VCMPEQ:
+    case VCMPGT:
+    case VAND:
+    case VOR:
+    case VXOR:
+    case VSHUF:
+        return FMT_VV;
+    case VHADD:
+    case VHMIN:
+    case VHMAX:
+    case VMASK:
+        return FMT_RV;
+    case CALLM:
+        return FMT_MI64;
+    case RETM:
+        return FMT_M;
+    }
+    return FMT_INVALID;
+}
+
+uint8_t c64decode_op(uint16_t opcode)
+{
+    switch (c64decode_laneBase(opcode))
+    {
+#define X(name)   \
+    case name:    \
+        return OP_##name;
+        C64_OPCODES(X)
+#undef X
+    }
+    return OP_INVALID;
+}
+
+uint8_t c64decode_length(uint8_t format)
+{
+    // Opcode + register index + immediate
+    static const uint8_t lengths[] = {
+        [FMT_NONE] = 2,
+        [FMT_R] = 2 + 1,
+        [FMT_RR] = 2 + 1 + 1,
+        [FMT_RI8] = 2 + 1 + 1,
+        [FMT_RI16] = 2 + 1 + 2,
+        [FMT_RI32] = 2 + 1 + 4,
+        [FMT_RI64] = 2 + 1 + 8,
+        [FMT_I64] = 2 + 8,
+        [FMT_INVALID] = 2,
+        [FMT_RRR] = 2 + 1 + 1 + 1,
+        [FMT_VR] = 2 + 1 + 1,
+        [FMT_VV] = 2 + 1 + 1,
+        [FMT_RV] = 2 + 1 + 1,
+        [FMT_RRI32] = 2 + 1 + 1 + 4,
+        [FMT_RRRI8] = 2 + 1 + 1 + 1 + 1,
+        [FMT_MI64] = 2 + 1 + 8,
+        [FMT_M] = 2 + 1,
+    };
+    return lengths[format];
+}
+
+// Instructions whose short immediates are relative in the compact encoding
+static char c64decode_isRelative(uint16_t opcode)
+{
+    switch (opcode)
+    {
+    case JMP:
+    case JEQ:
+    case JNE:
+    case JGT:
+    case JLT:
+    case JGE:
+    case JLE:
+    case BRA:
+    case BEQ:
+    case BNE:
+    case BGT:
+    case BLT:
+    case BGE:
+    case BLE:
+    case CALL:
+    case CALLM:
+        return 1;
+    }
+    return 0;
+}
+
+// Reads a compact immediate of 1 << size bytes and sign extends it
+static uint64_t c64decode_sized(c64mm_t *mm, uint64_t address, uint8_t size)
+{
+    switch (size & 3)
+    {
+    case 0:
+        return (uint64_t)(int64_t)(int8_t)c64mm_getUint8(mm, address);
+    case 1:
+        return (uint64_t)(int64_t)(int16_t)c64mm_getUint16(mm, address);
+    case 2:
+        return (uint64_t)(int64_t)(int32_t)c64mm_getUint32(mm, address);
+    }
+    return c64mm_getUint64(mm, address);
+}
+
+// Decodes operands in the compact encoding, see c64decode.h.
+// Returns 0 for formats that are encoded as usual.
+static char c64decode_compact(c64mm_t *mm, c64insn_t *insn, uint64_t operands, uint8_t format)
+{
+    if (format == FMT_NONE || format == FMT_INVALID || format == FMT_R || format == FMT_M ||
+        format == FMT_RI8 || format == FMT_RI16 || format == FMT_RI32)
+    {
+        return 0;
+    }
+
+    const uint8_t first = c64mm_getUint8(mm, operands);
+    const uint8_t low = first & 0x0f;
+    const uint8_t high = first >> 4;
+    uint8_t second;
+
+    switch (format)
+    {
+    case FMT_RR:
+        insn->r1 = low % REG_COUNT;
+        insn->r2 = high % REG_COUNT;
+        insn->length = 2 + 1;
+        break;
+    case FMT_RRR:
+        insn->r1 = low % REG_COUNT;
+        insn->r2 = high % REG_COUNT;
+        insn->r3 = c64mm_getUint8(mm, operands + 1) % REG_COUNT;
+        insn->length = 2 + 1 + 1;
+        break;
+    case FMT_VR:
+        insn->r1 = low % VREG_COUNT;
+        insn->r2 = high % REG_COUNT;
+        insn->length = 2 + 1;
+        break;
+    case FMT_VV:
+        insn->r1 = low % VREG_COUNT;
+        insn->r2 = high % VREG_COUNT;
+        insn->length = 2 + 1;
+        break;
+    case FMT_RV:
+        insn->r1 = low % REG_COUNT;
+        insn->r2 = high % VREG_COUNT;
+        insn->length = 2 + 1;
+        break;
+    case FMT_RRI32:
+        insn->r1 = low % REG_COUNT;
+        insn->r2 = high % REG_COUNT;
+        insn->imm = (uint64_t)(int64_t)(int32_t)c64mm_getUint32(mm, operands + 1);
+        insn->length = 2 + 1 + 4;
+        break;
+    case FMT_RRRI8:
+        second = c64mm_getUint8(mm, operands + 1);
+        insn->r1 = low % REG_COUNT;
+        insn->r2 = high % REG_COUNT;
+        insn->r3 = (second & 0x0f) % REG_COUNT;
+        insn->imm = second >> 4;
+        insn->length = 2 + 1 + 1;
+        break;
+    case FMT_RI64:
+        insn->r1 = low % REG_COUNT;
+        insn->imm = c64decode_sized(mm, operands + 1, high);
+        insn->length = 2 + 1 + (1 << (high & 3));
+        break;
+    case FMT_I64:
+        insn->imm = c64decode_sized(mm, operands + 1, first);
+        insn->length = 2 + 1 + (1 << (first & 3));
+        if ((first & 3) != 3 && c64decode_isRelative(insn->opcode))
+        {
+            insn->imm += operands - sizeof(uint16_t) + insn->length;
+        }
+        break;
+    case FMT_MI64:
+        second = c64mm_getUint8(mm, operands + 1);
+        insn->r1 = first;
+        insn->imm = c64decode_sized(mm, operands + 2, second);
+        insn->length = 2 + 1 + 1 + (1 << (second & 3));
+        if ((second & 3) != 3)
+        {
+            insn->imm += operands - sizeof(uint16_t) + insn->length;
+        }
+        break;
+    }
+    return 1;
+}
+
+void c64decode_operands(c64mm_t *mm, c64insn_t *insn, uint64_t address, uint16_t opcode)
+{
+    const uint8_t format = c64decode_format(opcode);
+    const uint64_t operands = address + sizeof(uint16_t);
+
+    insn->opcode = opcode;
+    insn->op = c64decode_op(opcode);
+    insn->length = c64decode_length(format);
+    insn->r1 = 0;
+    insn->r2 = 0;
+    insn->r3 = 0;
+    insn->imm = 0;
+    insn->target = 0;
+    insn->split = 0;
+
+    if ((c64mm_getAttributes(mm, address) & MM_COMPACT) && c64decode_compact(mm, insn, operands, format))
+    {
+        return;
+    }
+
+    switch (format)
+    {
+    case FMT_R:
+        insn->r1 = c64mm_getUint8(mm, operands) % REG_COUNT;
+        break;
+    case FMT_RR:
+        insn->r1 = c64mm_getUint8(mm, operands) % REG_COUNT;
+        insn->r2 = c64mm_getUint8(mm, operands + 1) % REG_COUNT;
+        break;
+    case FMT_RI8:
+        insn->r1 = c64mm_getUint8(mm, operands) % REG_COUNT;
+        insn->imm = c64mm_getUint8(mm, operands + 1);
+        break;
+    case FMT_RI16:
+        insn->r1 = c64mm_getUint8(mm, operands) % REG_COUNT;
+        insn->imm = c64mm_getUint16(mm, operands + 1);
+        break;
+    case FMT_RI32:
+        insn->r1 = c64mm_getUint8(mm, operands) % REG_COUNT;
+        insn->imm = c64mm_getUint32(mm, operands + 1);
+        break;
+    case FMT_RI64:
+        insn->r1 = c64mm_getUint8(mm, operands) % REG_COUNT;
+        insn->imm = c64mm_getUint64(mm, operands + 1);
+        break;
+    case FMT_I64:
+        insn->imm = c64mm_getUint64(mm, operands);
+        break;
+    case FMT_RRR:
+        insn->r1 = c64mm_getUint8(mm, operands) % REG_COUNT;
+        insn->r2 = c64mm_getUint8(mm, operands + 1) % REG_COUNT;
+        insn->r3 = c64mm_getUint8(mm, operands + 2) % REG_COUNT;
+        break;
+    case FMT_VR:
+        insn->r1 = c64mm_getUint8(mm, operands) % VREG_COUNT;
+        insn->r2 = c64mm_getUint8(mm, operands + 1) % REG_COUNT;
+        break;
+    case FMT_VV:
+        insn->r1 = c64mm_getUint8(mm, operands) % VREG_COUNT;
+        insn->r2 = c64mm_getUint8(mm, operands + 1) % VREG_COUNT;
+        break;
+    case FMT_RV:
+        insn->r1 = c64mm_getUint8(mm, operands) % REG_COUNT;
+        insn->r2 = c64mm_getUint8(mm, operands + 1) % VREG_COUNT;
+        break;
+    case FMT_RRI32:
+        insn->r1 = c64mm_getUint8(mm, operands) % REG_COUNT;
+        insn->r2 = c64mm_getUint8(mm, operands + 1) % REG_COUNT;
+        insn->imm = (uint64_t)(int64_t)(int32_t)c64mm_getUint32(mm, operands + 2);
+        break;
+    case FMT_RRRI8:
+        insn->r1 = c64mm_getUint8(mm, operands) % REG_COUNT;
+        insn->r2 = c64mm_getUint8(mm, operands + 1) % REG_COUNT;
+        insn->r3 = c64mm_getUint8(mm, operands + 2) % REG_COUNT;
+        insn->imm = c64mm_getUint8(mm, operands + 3);
+        break;
+    case FMT_MI64:
+        insn->r1 = c64mm_getUint8(mm, operands);
+        insn->imm = c64mm_getUint64(mm, operands + 1);
+        break;
+    case FMT_M:
+        insn->r1 = c64mm_getUint8(mm, operands);
+        break;
+    }
+}
+
+void c64decode(c64mm_t *mm, c64insn_t *insn, uint64_t address)
+{
+    const uint32_t gen = c64mm_getWriteGen(mm, address);
+    c64decode_operands(mm, insn, address, c64mm_getUint16(mm, address));
+
+    // Instructions crossing a line are only valid for this one execution,
+    // only the generation of the first line is tracked
+    const char crossesLine = (address >> MM_LINE_SHIFT) != ((address + insn->length - 1) >> MM_LINE_SHIFT);
+    insn->address = crossesLine ? UINT64_MAX : address;
+    insn->gen = gen;
+}
+
+void c64decode_flush(c64insn_t *cache, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        cache[i].address = UINT64_MAX;
+    }
+}
+
+static const char *const c64decode_regNames[REG_COUNT] = {
+    [REG_IP] = "IP",
+    [REG_ACC] = "ACC",
+    [REG_R1] = "R1",
+    [REG_R2] = "R2",
+    [REG_R3] = "R3",
+    [REG_R4] = "R4",
+    [REG_R5] = "R5",
+    [REG_R6] = "R6",
+    [REG_R7] = "R7",
+    [REG_R8] = "R8",
+    [REG_SP] = "SP",
+    [REG_FP] = "FP",
+    [REG_MB] = "MB",
+    [REG_IM] = "IM",
+};
+
+static const char *const c64decode_opNames[OP_COUNT] = {
+#define X(name) [OP_##name] = #name,
+    C64_OPCODES(X)
+    C64_FUSED_OPS(X)
+#undef X
+    [OP_BREAK] = "BREAK",
+    [OP_INVALID] = "INVALID",
+};
+
+const char *c64decode_opName(uint8_t op)
+{
+    return op < OP_COUNT ? c64decode_opNames[op] : "INVALID";
+}
+
+int c64decode_disassemble(const c64insn_t *insn, char *buffer, size_t size)
+{
+    static const char laneSuffixes[4][2] = {"", "B", "W", "D"};
+    const char *name = c64decode_opNames[insn->op];
+    // _INT is only named so to stay clear of the INT type
+    if (name[0] == '_')
+    {
+        name++;
+    }
+    const char *suffix = c64decode_laneBase(insn->opcode) != insn->opcode ? laneSuffixes[(insn->opcode >> 8) & 3] : "";
+    const char *r1 = c64decode_regNames[insn->r1 % REG_COUNT];
+    const char *r2 = c64decode_regNames[insn->r2 % REG_COUNT];
+    const char *r3 = c64decode_regNames[insn->r3 % REG_COUNT];
+    const unsigned long long imm = insn->imm;
+
+    switch (insn->op)
+    {
+    case OP_LDR:
+    case OP_LDBR:
+    case OP_LDWR:
+    case OP_LDDR:
+    case OP_STR:
+    case OP_STBR:
+    case OP_STWR:
+    case OP_STDR:
+        return snprintf(buffer, size, "%s %s, [%s]", name, r1, r2);
+    case OP_LDP:
+    case OP_LDBP:
+    case OP_LDWP:
+    case OP_LDDP:
+    case OP_STP:
+    case OP_STBP:
+    case OP_STWP:
+    case OP_STDP:
+        return snprintf(buffer, size, "%s %s, [%s]+", name, r1, r2);
+    case OP_CAS:
+        return snprintf(buffer, size, "%s%s %s, [%s], %s", name, suffix, r1, r2, r3);
+    case OP_XCHG:
+    case OP_FETCHADD:
+    case OP_WAITADDR:
+        return snprintf(buffer, size, "%s%s %s, [%s]", name, suffix, r1, r2);
+    case OP_VLD:
+    case OP_VST:
+        return snprintf(buffer, size, "%s V%u, [%s]", name, insn->r1, r2);
+    case OP_BREAK:
+        return snprintf(buffer, size, "%s", name);
+    case OP_CMPJEQ:
+    case OP_CMPJNE:
+    case OP_CMPJGT:
+    case OP_CMPJLT:
+    case OP_CMPJGE:
+    case OP_CMPJLE:
+        return snprintf(buffer, size, "%s %s, %s, 0x%llx", name, r1, r2, (unsigned long long)insn->target);
+    case OP_CMPIJEQ:
+    case OP_CMPIJNE:
+    case OP_CMPIJGT:
+    case OP_CMPIJLT:
+    case OP_CMPIJGE:
+    case OP_CMPIJLE:
+        return snprintf(buffer, size, "%s %s, 0x%llx, 0x%llx", name, r1, imm, (unsigned long long)insn->target);
+    case OP_LDIADD:
+        return snprintf(buffer, size, "%s %s, 0x%llx, %s, %s", name, r1, imm, r2, r3);
+    case OP_PUSHICALL:
+        return snprintf(buffer, size, "%s 0x%llx, 0x%llx", name, imm, (unsigned long long)insn->target);
+    }
+
+    switch (c64decode_format(insn->opcode))
+    {
+    case FMT_R:
+        return snprintf(buffer, size, "%s %s", name, r1);
+    case FMT_RR:
+        return snprintf(buffer, size, "%s %s, %s", name, r1, r2);
+    case FMT_RI8:
+    case FMT_RI16:
+    case FMT_RI32:
+    case FMT_RI64:
+        return snprintf(buffer, size, "%s %s, 0x%llx", name, r1, imm);
+    case FMT_I64:
+        return snprintf(buffer, size, "%s 0x%llx", name, imm);
+    case FMT_RRR:
+        return snprintf(buffer, size, "%s %s, %s, %s", name, r1, r2, r3);
+    case FMT_VR:
+        return snprintf(buffer, size, "%s%s V%u, %s", name, suffix, insn->r1, r2);
+    case FMT_VV:
+        return snprintf(buffer, size, "%s%s V%u, V%u", name, suffix, insn->r1, insn->r2);
+    case FMT_RV:
+        return snprintf(buffer, size, "%s%s %s, V%u", name, suffix, r1, insn->r2);
+    case FMT_RRI32:
+        if ((int64_t)imm < 0)
+        {
+            return snprintf(buffer, size, "%s %s, [%s - 0x%llx]", name, r1, r2, 0 - imm);
+        }
+        return snprintf(buffer, size, "%s %s, [%s + 0x%llx]", name, r1, r2, imm);
+    case FMT_RRRI8:
+        return snprintf(buffer, size, "%s %s, [%s + %s * %u]", name, r1, r2, r3, 1u << (imm & 3));
+    case FMT_MI64:
+        return snprintf(buffer, size, "%s 0x%02x, 0x%llx", name, insn->r1, imm);
+    case FMT_M:
+        return snprintf(buffer, size, "%s 0x%02x", name, insn->r1);
+    case FMT_INVALID:
+        return snprintf(buffer, size, "%s 0x%04x", name, insn->opcode);
+    }
+    return snprintf(buffer, size, "%s", name);
+}
\ No newline at end of file
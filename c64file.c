@@ -0,0 +1,210 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+// open, fstat and mmap are not part of C99
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#define _DARWIN_C_SOURCE
+#include <c64file.h>
+#include <stdio.h>
+
+#if C64FILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static c64dev_t *c64file_createDevice(const char *name, void *data, size_t size, c64cpu_t *cpu)
+{
+    c64dev_t *device = malloc(sizeof(c64dev_t));
+    if (device == NULL)
+    {
+        error("c64file_createDevice: malloc failed\n");
+    }
+    device->getUint64 = c64mem_getUint64;
+    device->getUint32 = c64mem_getUint32;
+    device->getUint16 = c64mem_getUint16;
+    device->getUint8 = c64mem_getUint8;
+    device->setUint64 = c64mem_setUint64;
+    device->setUint32 = c64mem_setUint32;
+    device->setUint16 = c64mem_setUint16;
+    device->setUint8 = c64mem_setUint8;
+    device->readBlock = c64mem_readBlock;
+    device->writeBlock = c64mem_writeBlock;
+    // The image lives in memory from c64mem_createMemory or mmap, both released by munmap
+    device->destroy = c64mem_destroy;
+    device->data = data;
+    device->dataSize = size;
+    device->host = (uint8_t *)data;
+    device->attributes = 0;
+    device->cpu = cpu;
+
+    strcpy(device->name, name);
+
+    return device;
+}
+
+#if C64FILE_MMAP
+static int c64file_open(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        error("c64file_open: cannot open %s\n", path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        error("c64file_open: cannot stat %s\n", path);
+    }
+    *size = (size_t)st.st_size;
+    return fd;
+}
+#else
+static FILE *c64file_open(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        error("c64file_open: cannot open %s\n", path);
+    }
+    if (fseek(file, 0, SEEK_END) != 0)
+    {
+        error("c64file_open: cannot seek %s\n", path);
+    }
+    long end = ftell(file);
+    if (end < 0)
+    {
+        error("c64file_open: cannot tell the size of %s\n", path);
+    }
+    rewind(file);
+    *size = (size_t)end;
+    return file;
+}
+#endif
+
+c64dev_t *c64file_createRom(const char *path, c64cpu_t *cpu)
+{
+    size_t size;
+#if C64FILE_MMAP
+    int fd = c64file_open(path, &size);
+    if (size == 0)
+    {
+        error("c64file_createRom: %s is empty\n", path);
+    }
+    // Shares the page cache with every other mapping of the file
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        error("c64file_createRom: mmap of %s failed\n", path);
+    }
+    close(fd);
+#else
+    FILE *file = c64file_open(path, &size);
+    if (size == 0)
+    {
+        error("c64file_createRom: %s is empty\n", path);
+    }
+    void *data = c64mem_createMemory(size);
+    if (fread(data, 1, size, file) != size)
+    {
+        error("c64file_createRom: cannot read %s\n", path);
+    }
+    fclose(file);
+#endif
+
+    c64dev_t *device = c64file_createDevice("File ROM", data, size, cpu);
+    device->setUint64 = c64file_setUint64;
+    device->setUint32 = c64file_setUint32;
+    device->setUint16 = c64file_setUint16;
+    device->setUint8 = c64file_setUint8;
+    device->writeBlock = c64file_writeBlock;
+    device->attributes = MM_READ | MM_EXEC;
+    return device;
+}
+
+c64dev_t *c64file_createRam(const char *path, size_t size, c64cpu_t *cpu)
+{
+    size_t fileSize;
+#if C64FILE_MMAP
+    int fd = c64file_open(path, &fileSize);
+#else
+    FILE *file = c64file_open(path, &fileSize);
+#endif
+    if (size == 0)
+    {
+        size = fileSize;
+    }
+    if (size == 0)
+    {
+        error("c64file_createRam: %s is empty\n", path);
+    }
+    if (fileSize > size)
+    {
+        fileSize = size;
+    }
+
+    // Demand zero memory for the whole device, the image is placed over its start
+    void *data = c64mem_createMemory(size);
+#if C64FILE_MMAP
+    if (fileSize > 0 && mmap(data, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        error("c64file_createRam: mmap of %s failed\n", path);
+    }
+    close(fd);
+#else
+    if (fread(data, 1, fileSize, file) != fileSize)
+    {
+        error("c64file_createRam: cannot read %s\n", path);
+    }
+    fclose(file);
+#endif
+
+    return c64file_createDevice("File RAM", data, size, cpu);
+}
+
+void c64file_setUint64(c64dev_t *device, uint64_t address, uint64_t value)
+{
+    (void)value;
+    warning("c64file_setUint64: %s is read only, write to 0x%016llx ignored\n", device->name, (unsigned long long)address);
+}
+
+void c64file_setUint32(c64dev_t *device, uint64_t address, uint32_t value)
+{
+    (void)value;
+    warning("c64file_setUint32: %s is read only, write to 0x%016llx ignored\n", device->name, (unsigned long long)address);
+}
+
+void c64file_setUint16(c64dev_t *device, uint64_t address, uint16_t value)
+{
+    (void)value;
+    warning("c64file_setUint16: %s is read only, write to 0x%016llx ignored\n", device->name, (unsigned long long)address);
+}
+
+void c64file_setUint8(c64dev_t *device, uint64_t address, uint8_t value)
+{
+    (void)value;
+    warning("c64file_setUint8: %s is read only, write to 0x%016llx ignored\n", device->name, (unsigned long long)address);
+}
+
+void c64file_writeBlock(c64dev_t *device, uint64_t address, const void *buffer, size_t size)
+{
+    (void)buffer;
+    warning("c64file_writeBlock: %s is read only, write of %zu bytes to 0x%016llx ignored\n", device->name, size, (unsigned long long)address);
+}
\ No newline at end of file
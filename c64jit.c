@@ -0,0 +1,1331 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+// mmap with MAP_ANONYMOUS is not part of C99
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#define _DARWIN_C_SOURCE
+#include <c64jit.h>
+#include <c64cpu.h>
+
+#if C64JIT_AVAILABLE
+#include <sys/mman.h>
+#include <unistd.h>
+
+// x86-64 register numbers
+enum
+{
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15
+};
+
+// Condition codes of jcc and setcc
+#define CC_B 0x2
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+#define CC_L 0xC
+#define CC_G 0xF
+
+// ModRM reg field of the group 2 shifts
+#define SHIFT_ROL 0
+#define SHIFT_ROR 1
+#define SHIFT_SHL 4
+#define SHIFT_SHR 5
+
+#define ARITH_FLAGS (FLAG_CARRY | FLAG_ZERO | FLAG_NEGATIVE | FLAG_OVERFLOW)
+
+// Longest encoded guest instruction
+#define INSN_MAX_LENGTH 11
+
+#define CPU_REG(index) ((int32_t)(offsetof(c64cpu_t, regs) + sizeof(uint64_t) * (index)))
+#define CPU_FLAGS ((int32_t)offsetof(c64cpu_t, flags))
+#define CPU_MM ((int32_t)offsetof(c64cpu_t, mm))
+#define CPU_FUEL ((int32_t)offsetof(c64cpu_t, jitFuel))
+#define CPU_LAST_EXIT ((int32_t)offsetof(c64cpu_t, jitLastExit))
+#define CPU_TLB ((int32_t)offsetof(c64cpu_t, tlb))
+#define CPU_TLB_ENTRY(address, field) \
+    (CPU_TLB + (int32_t)(offsetof(c64tlb_t, entries) + sizeof(c64tlbEntry_t) * (((address) >> MM_PAGE_SHIFT) & (TLB_SIZE - 1)) + offsetof(c64tlbEntry_t, field)))
+
+// Callee saved, so cached guest registers survive the calls into c64mm.
+// r15 holds the cpu, rax, rcx, rdx, rsi, rdi and r8 - r10 are scratch.
+static const uint8_t c64jit_cachedHost[JIT_CACHED_REGS] = {RBX, RBP, R12, R13, R14};
+
+// State of the block being translated
+typedef struct
+{
+    c64jit_t *jit;
+    c64mm_t *mm;
+    int8_t host[REG_COUNT]; // host register caching each guest register, -1 if it stays in memory
+    uint16_t written;       // guest registers written so far, by bit
+} c64jitCtx_t;
+
+static void c64jit_emit8(c64jit_t *jit, uint8_t value)
+{
+    jit->code[jit->used++] = value;
+}
+
+static void c64jit_emit32(c64jit_t *jit, uint32_t value)
+{
+    memcpy(jit->code + jit->used, &value, sizeof(value));
+    jit->used += sizeof(value);
+}
+
+static void c64jit_emit64(c64jit_t *jit, uint64_t value)
+{
+    memcpy(jit->code + jit->used, &value, sizeof(value));
+    jit->used += sizeof(value);
+}
+
+static void c64jit_emitBytes(c64jit_t *jit, const uint8_t *bytes, size_t count)
+{
+    memcpy(jit->code + jit->used, bytes, count);
+    jit->used += count;
+}
+
+// REX prefix, left out when empty unless a byte register needs it
+static void c64jit_emitRex(c64jit_t *jit, int wide, int reg, int rm, int force)
+{
+    const uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40 || force)
+    {
+        c64jit_emit8(jit, rex);
+    }
+}
+
+static void c64jit_emitModRM(c64jit_t *jit, int mod, int reg, int rm)
+{
+    c64jit_emit8(jit, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op r/m64, r64 with two registers
+static void c64jit_emitRR(c64jit_t *jit, uint8_t op, int rm, int reg)
+{
+    c64jit_emitRex(jit, 1, reg, rm, 0);
+    c64jit_emit8(jit, op);
+    c64jit_emitModRM(jit, 3, reg, rm);
+}
+
+// op with a [base + disp32] operand, base must not be rsp or r12
+static void c64jit_emitMem(c64jit_t *jit, int wide, uint8_t op, int reg, int base, int32_t disp)
+{
+    c64jit_emitRex(jit, wide, reg, base, 0);
+    c64jit_emit8(jit, op);
+    c64jit_emitModRM(jit, 2, reg, base);
+    c64jit_emit32(jit, (uint32_t)disp);
+}
+
+// movzx r32, byte [base + disp32]
+static void c64jit_emitLoadByte(c64jit_t *jit, int reg, int base, int32_t disp)
+{
+    c64jit_emitRex(jit, 0, reg, base, 0);
+    c64jit_emit8(jit, 0x0F);
+    c64jit_emit8(jit, 0xB6);
+    c64jit_emitModRM(jit, 2, reg, base);
+    c64jit_emit32(jit, (uint32_t)disp);
+}
+
+// Always the 10 byte form, its length is relied on by c64jit_emitExit
+static void c64jit_emitMovImm64(c64jit_t *jit, int reg, uint64_t value)
+{
+    c64jit_emitRex(jit, 1, 0, reg, 0);
+    c64jit_emit8(jit, 0xB8 + (reg & 7));
+    c64jit_emit64(jit, value);
+}
+
+static void c64jit_emitMovImm(c64jit_t *jit, int reg, uint64_t value)
+{
+    if (value <= UINT32_MAX)
+    {
+        // mov r32, imm32 zero extends
+        c64jit_emitRex(jit, 0, 0, reg, 0);
+        c64jit_emit8(jit, 0xB8 + (reg & 7));
+        c64jit_emit32(jit, (uint32_t)value);
+    }
+    else if ((int64_t)value == (int32_t)value)
+    {
+        // mov r/m64, imm32 sign extends
+        c64jit_emitRex(jit, 1, 0, reg, 0);
+        c64jit_emit8(jit, 0xC7);
+        c64jit_emitModRM(jit, 3, 0, reg);
+        c64jit_emit32(jit, (uint32_t)value);
+    }
+    else
+    {
+        c64jit_emitMovImm64(jit, reg, value);
+    }
+}
+
+// Shift or rotate by an immediate, or by cl if count is negative
+static void c64jit_emitShift(c64jit_t *jit, int kind, int reg, int count)
+{
+    c64jit_emitRex(jit, 1, 0, reg, 0);
+    if (count < 0)
+    {
+        c64jit_emit8(jit, 0xD3);
+        c64jit_emitModRM(jit, 3, kind, reg);
+    }
+    else
+    {
+        c64jit_emit8(jit, 0xC1);
+        c64jit_emitModRM(jit, 3, kind, reg);
+        c64jit_emit8(jit, (uint8_t)count);
+    }
+}
+
+// reg = condition ? 1 : 0
+static void c64jit_emitSetcc(c64jit_t *jit, int cc, int reg)
+{
+    c64jit_emitRex(jit, 0, 0, reg, 1);
+    c64jit_emit8(jit, 0x0F);
+    c64jit_emit8(jit, 0x90 + cc);
+    c64jit_emitModRM(jit, 3, 0, reg);
+    c64jit_emitRex(jit, 0, reg, reg, 1);
+    c64jit_emit8(jit, 0x0F);
+    c64jit_emit8(jit, 0xB6);
+    c64jit_emitModRM(jit, 3, reg, reg);
+}
+
+// Clears all but the low width bytes of reg
+static void c64jit_emitZeroExtend(c64jit_t *jit, int reg, int width)
+{
+    if (width == 1 || width == 2)
+    {
+        // movzx r32, r8 / r16
+        c64jit_emitRex(jit, 0, reg, reg, width == 1);
+        c64jit_emit8(jit, 0x0F);
+        c64jit_emit8(jit, width == 1 ? 0xB6 : 0xB7);
+        c64jit_emitModRM(jit, 3, reg, reg);
+    }
+    else if (width == 4)
+    {
+        // mov r32, r32
+        c64jit_emitRex(jit, 0, reg, reg, 0);
+        c64jit_emit8(jit, 0x89);
+        c64jit_emitModRM(jit, 3, reg, reg);
+    }
+}
+
+static void c64jit_patch(uint8_t *site, const uint8_t *target)
+{
+    const int32_t rel = (int32_t)(target - (site + sizeof(int32_t)));
+    memcpy(site, &rel, sizeof(rel));
+}
+
+// The code buffer is never writable and executable at the same time.
+// Pages are made writable for size bytes at start and executable again
+// once the code there is written or patched.
+static void c64jit_setWritable(c64jit_t *jit, uint8_t *start, size_t size, char writable)
+{
+    const uintptr_t mask = jit->pageSize - 1;
+    uint8_t *first = (uint8_t *)((uintptr_t)start & ~mask);
+    uint8_t *last = (uint8_t *)(((uintptr_t)(start + size) + mask) & ~mask);
+    if (last > jit->code + JIT_CODE_SIZE)
+    {
+        last = jit->code + JIT_CODE_SIZE;
+    }
+    if (mprotect(first, last - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0)
+    {
+        error("c64jit_setWritable: mprotect failed\n");
+    }
+}
+
+// jmp (cc < 0) or jcc with a rel32 to target, returns where the rel32 lives
+static uint8_t *c64jit_emitJump(c64jit_t *jit, int cc, const uint8_t *target)
+{
+    if (cc < 0)
+    {
+        c64jit_emit8(jit, 0xE9);
+    }
+    else
+    {
+        c64jit_emit8(jit, 0x0F);
+        c64jit_emit8(jit, 0x80 + cc);
+    }
+    uint8_t *site = jit->code + jit->used;
+    c64jit_emit32(jit, 0);
+    if (target != NULL)
+    {
+        c64jit_patch(site, target);
+    }
+    return site;
+}
+
+static void c64jit_emitCall(c64jit_t *jit, uint64_t function)
+{
+    c64jit_emitMovImm(jit, RAX, function);
+    c64jit_emit8(jit, 0xFF);
+    c64jit_emitModRM(jit, 3, 2, RAX);
+}
+
+static void c64jit_loadReg(c64jitCtx_t *ctx, int host, size_t reg)
+{
+    if (ctx->host[reg] < 0)
+    {
+        c64jit_emitMem(ctx->jit, 1, 0x8B, host, R15, CPU_REG(reg));
+    }
+    else if (ctx->host[reg] != host)
+    {
+        c64jit_emitRR(ctx->jit, 0x89, host, ctx->host[reg]);
+    }
+}
+
+static void c64jit_storeReg(c64jitCtx_t *ctx, size_t reg, int host)
+{
+    ctx->written |= 1 << reg;
+    if (ctx->host[reg] < 0)
+    {
+        c64jit_emitMem(ctx->jit, 1, 0x89, host, R15, CPU_REG(reg));
+    }
+    else
+    {
+        c64jit_emitRR(ctx->jit, 0x89, ctx->host[reg], host);
+    }
+}
+
+// Cached registers written by the block go back into cpu->regs
+static void c64jit_emitWriteBack(c64jitCtx_t *ctx)
+{
+    for (size_t reg = 0; reg < REG_COUNT; reg++)
+    {
+        if (ctx->host[reg] >= 0 && (ctx->written & (1 << reg)))
+        {
+            c64jit_emitMem(ctx->jit, 1, 0x89, ctx->host[reg], R15, CPU_REG(reg));
+        }
+    }
+}
+
+// Leaves the block towards target. The jump at the end first goes back to
+// c64jit_run, which patches it to the block at target once there is one.
+static void c64jit_emitExit(c64jitCtx_t *ctx, uint64_t target)
+{
+    c64jit_t *jit = ctx->jit;
+    c64jit_emitWriteBack(ctx);
+    c64jit_emitMovImm(jit, RAX, target);
+    c64jit_emitMem(jit, 1, 0x89, RAX, R15, CPU_REG(REG_IP));
+
+    // mov rax, imm64 (10 bytes) + mov [r15 + disp32], rax (7 bytes) + jmp opcode
+    const uint8_t *site = jit->code + jit->used + 10 + 7 + 1;
+    c64jit_emitMovImm64(jit, RAX, (uint64_t)(uintptr_t)site);
+    c64jit_emitMem(jit, 1, 0x89, RAX, R15, CPU_LAST_EXIT);
+    c64jit_emitJump(jit, -1, jit->exit);
+}
+
+// Leaves the block towards the address in a guest register, never linked
+static void c64jit_emitExitReg(c64jitCtx_t *ctx, size_t reg)
+{
+    c64jit_t *jit = ctx->jit;
+    c64jit_loadReg(ctx, RAX, reg);
+    c64jit_emitWriteBack(ctx);
+    c64jit_emitMem(jit, 1, 0x89, RAX, R15, CPU_REG(REG_IP));
+    c64jit_emitMem(jit, 1, 0xC7, 0, R15, CPU_LAST_EXIT);
+    c64jit_emit32(jit, 0);
+    c64jit_emitJump(jit, -1, jit->exit);
+}
+
+// Computes the flags in need from the result in rax and the previous
+// value in r8, the same way the interpreter does, and merges them into
+// cpu->flags. carry is the condition comparing result to previous value
+// that the instruction uses for C and V.
+static void c64jit_emitFlags(c64jit_t *jit, uint8_t need, int carry)
+{
+    if (need == 0)
+    {
+        return;
+    }
+
+    // xor r9d, r9d
+    c64jit_emitRex(jit, 0, R9, R9, 0);
+    c64jit_emit8(jit, 0x31);
+    c64jit_emitModRM(jit, 3, R9, R9);
+    if (need & (FLAG_CARRY | FLAG_OVERFLOW))
+    {
+        c64jit_emitRR(jit, 0x39, RAX, R8);
+        c64jit_emitSetcc(jit, carry, R10);
+        if (need & FLAG_CARRY)
+        {
+            c64jit_emitRR(jit, 0x09, R9, R10);
+        }
+        if (need & FLAG_OVERFLOW)
+        {
+            c64jit_emitShift(jit, SHIFT_SHL, R10, 3);
+            c64jit_emitRR(jit, 0x09, R9, R10);
+        }
+    }
+    if (need & FLAG_ZERO)
+    {
+        c64jit_emitRR(jit, 0x85, RAX, RAX);
+        c64jit_emitSetcc(jit, CC_E, R10);
+        c64jit_emitShift(jit, SHIFT_SHL, R10, 1);
+        c64jit_emitRR(jit, 0x09, R9, R10);
+    }
+    if (need & FLAG_NEGATIVE)
+    {
+        c64jit_emitRR(jit, 0x89, R10, RAX);
+        c64jit_emitShift(jit, SHIFT_SHR, R10, 63);
+        c64jit_emitShift(jit, SHIFT_SHL, R10, 2);
+        c64jit_emitRR(jit, 0x09, R9, R10);
+    }
+
+    // cpu->flags = (cpu->flags & ~need) | r9
+    c64jit_emitLoadByte(jit, R10, R15, CPU_FLAGS);
+    c64jit_emitRex(jit, 1, 0, R10, 0);
+    c64jit_emit8(jit, 0x81);
+    c64jit_emitModRM(jit, 3, 4, R10);
+    c64jit_emit32(jit, (uint32_t)~(uint32_t)need);
+    c64jit_emitRR(jit, 0x09, R10, R9);
+    c64jit_emitRex(jit, 0, R10, R15, 1);
+    c64jit_emit8(jit, 0x88);
+    c64jit_emitModRM(jit, 2, R10, R15);
+    c64jit_emit32(jit, (uint32_t)CPU_FLAGS);
+}
+
+static char c64jit_isJump(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_JMP:
+    case OP_JEQ:
+    case OP_JNE:
+    case OP_JGT:
+    case OP_JLT:
+    case OP_JGE:
+    case OP_JLE:
+    case OP_JMPR:
+    case OP_JEQR:
+    case OP_JNER:
+    case OP_JGTR:
+    case OP_JLTR:
+    case OP_JGER:
+    case OP_JLER:
+        return 1;
+    }
+    return 0;
+}
+
+// Bytes written by a store, 0 for anything else
+static int c64jit_storeWidth(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_ST:
+        return 8;
+    case OP_STD:
+        return 4;
+    case OP_STW:
+        return 2;
+    case OP_STB:
+        return 1;
+    }
+    return 0;
+}
+
+static uint8_t c64jit_flagsDefined(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_ADDI:
+    case OP_SUBI:
+    case OP_MULI:
+    case OP_DIVI:
+    case OP_MODI:
+    case OP_MULIS:
+    case OP_DIVIS:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MOD:
+    case OP_MULS:
+    case OP_DIVS:
+        return ARITH_FLAGS;
+    case OP_SHLI:
+    case OP_SHRI:
+    case OP_RORI:
+    case OP_ROLI:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_ROR:
+    case OP_ROL:
+    case OP_CMPI:
+    case OP_CMP:
+        return FLAG_CARRY | FLAG_ZERO | FLAG_NEGATIVE;
+    case OP_ANDI:
+    case OP_ORI:
+    case OP_XORI:
+    case OP_NOTI:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOT:
+        return FLAG_ZERO | FLAG_NEGATIVE;
+    }
+    return 0;
+}
+
+static uint8_t c64jit_flagsUsed(uint8_t op)
+{
+    switch (op)
+    {
+    case OP_JEQ:
+    case OP_JNE:
+    case OP_JEQR:
+    case OP_JNER:
+        return FLAG_ZERO;
+    case OP_JLT:
+    case OP_JGE:
+    case OP_JLTR:
+    case OP_JGER:
+        return FLAG_NEGATIVE;
+    case OP_JGT:
+    case OP_JLE:
+    case OP_JGTR:
+    case OP_JLER:
+        return FLAG_ZERO | FLAG_NEGATIVE;
+    }
+    return 0;
+}
+
+char c64jit_canTranslate(const c64insn_t *insn)
+{
+    const uint8_t format = c64decode_format(insn->opcode);
+    if (!c64jit_isJump(insn->op) && !c64jit_storeWidth(insn->op) && !c64jit_flagsDefined(insn->op))
+    {
+        switch (insn->op)
+        {
+        case OP_LDI:
+        case OP_LDBI:
+        case OP_LDWI:
+        case OP_LDDI:
+        case OP_LDM:
+        case OP_LDBM:
+        case OP_LDWM:
+        case OP_LDDM:
+        case OP_TF:
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    // IP reads as the next instruction and writing it jumps,
+    // neither is tracked inside a block
+    if (format != FMT_NONE && format != FMT_I64 && format != FMT_INVALID && insn->r1 == REG_IP)
+    {
+        return 0;
+    }
+    if (format == FMT_RR && insn->r2 == REG_IP)
+    {
+        return 0;
+    }
+    // Left to the interpreter to fault on
+    if ((insn->op == OP_DIVI || insn->op == OP_MODI || insn->op == OP_DIVIS) && insn->imm == 0)
+    {
+        return 0;
+    }
+    if (insn->op == OP_DIVIS && insn->imm == UINT64_MAX)
+    {
+        return 0;
+    }
+    return 1;
+}
+
+// Register divides check the divisor first and leave to the interpreter
+// when it would fault
+static char c64jit_mayFault(const c64insn_t *insn)
+{
+    return insn->op == OP_DIV || insn->op == OP_MOD || insn->op == OP_DIVS;
+}
+
+// Exits in front of insn if the divisor would fault. Instructions from insn on
+// have not retired, their fuel goes back.
+static void c64jit_emitFaultGuard(c64jitCtx_t *ctx, const c64insn_t *insn, size_t unretired)
+{
+    c64jit_t *jit = ctx->jit;
+    uint8_t *site;
+
+    c64jit_loadReg(ctx, RCX, insn->r2);
+    if (insn->op == OP_DIVS)
+    {
+        // lea rdx, [rcx + 1]; cmp rdx, 1; ja over (divisor is neither 0 nor -1)
+        c64jit_emitMem(jit, 1, 0x8D, RDX, RCX, 1);
+        c64jit_emitRex(jit, 1, 0, RDX, 0);
+        c64jit_emit8(jit, 0x83);
+        c64jit_emitModRM(jit, 3, 7, RDX);
+        c64jit_emit8(jit, 1);
+        site = c64jit_emitJump(jit, CC_A, NULL);
+    }
+    else
+    {
+        // test rcx, rcx; jne over
+        c64jit_emitRR(jit, 0x85, RCX, RCX);
+        site = c64jit_emitJump(jit, CC_NE, NULL);
+    }
+
+    c64jit_emitWriteBack(ctx);
+    c64jit_emitMovImm(jit, RAX, insn->address);
+    c64jit_emitMem(jit, 1, 0x89, RAX, R15, CPU_REG(REG_IP));
+    c64jit_emitMem(jit, 1, 0x81, 0, R15, CPU_FUEL);
+    c64jit_emit32(jit, (uint32_t)unretired);
+    c64jit_emitMem(jit, 1, 0xC7, 0, R15, CPU_LAST_EXIT);
+    c64jit_emit32(jit, 0);
+    c64jit_emitJump(jit, -1, jit->exit);
+    c64jit_patch(site, jit->code + jit->used);
+}
+
+// Checks the TLB entry of insn->imm. Leaves rax + rcx pointing at the host
+// memory and returns the jump to patch to the slow path, NULL if the
+// access crosses a page and always takes the slow path.
+static uint8_t *c64jit_emitTlbLookup(c64jit_t *jit, const c64insn_t *insn, int width, char write)
+{
+    const uint64_t address = insn->imm;
+    if ((address & MM_PAGE_MASK) > MM_PAGE_SIZE - width)
+    {
+        return NULL;
+    }
+    // cmp rcx, [r15 + tag]; jne slow; mov rax, [r15 + addend]
+    c64jit_emitMovImm(jit, RCX, address >> MM_PAGE_SHIFT);
+    if (write)
+    {
+        c64jit_emitMem(jit, 1, 0x3B, RCX, R15, CPU_TLB_ENTRY(address, writeTag));
+    }
+    else
+    {
+        c64jit_emitMem(jit, 1, 0x3B, RCX, R15, CPU_TLB_ENTRY(address, readTag));
+    }
+    uint8_t *slow = c64jit_emitJump(jit, CC_NE, NULL);
+    c64jit_emitMem(jit, 1, 0x8B, RAX, R15, CPU_TLB_ENTRY(address, addend));
+    c64jit_emitMovImm(jit, RCX, address);
+    return slow;
+}
+
+static void c64jit_emitLoad(c64jitCtx_t *ctx, const c64insn_t *insn, uint64_t function, int width)
+{
+    c64jit_t *jit = ctx->jit;
+    uint8_t *done = NULL;
+    uint8_t *slow = c64jit_emitTlbLookup(jit, insn, width, 0);
+    if (slow != NULL)
+    {
+        // mov rax, [rax + rcx] or movzx eax, [rax + rcx], zero extending
+        static const uint8_t loads[9][4] = {
+            [1] = {0x0F, 0xB6, 0x04, 0x08},
+            [2] = {0x0F, 0xB7, 0x04, 0x08},
+            [4] = {0x8B, 0x04, 0x08},
+            [8] = {0x48, 0x8B, 0x04, 0x08},
+        };
+        c64jit_emitBytes(jit, loads[width], width == 4 ? 3 : 4);
+        done = c64jit_emitJump(jit, -1, NULL);
+        c64jit_patch(slow, jit->code + jit->used);
+    }
+
+    c64jit_emitMem(jit, 1, 0x8D, RDI, R15, CPU_TLB);
+    c64jit_emitMovImm(jit, RSI, insn->imm);
+    c64jit_emitCall(jit, function);
+    c64jit_emitZeroExtend(jit, RAX, width);
+    if (done != NULL)
+    {
+        c64jit_patch(done, jit->code + jit->used);
+    }
+    c64jit_storeReg(ctx, insn->r1, RAX);
+}
+
+static void c64jit_emitStore(c64jitCtx_t *ctx, const c64insn_t *insn, uint64_t function, int width)
+{
+    c64jit_t *jit = ctx->jit;
+    uint8_t *done = NULL;
+    c64jit_loadReg(ctx, RDX, insn->r1);
+    c64jit_emitZeroExtend(jit, RDX, width);
+    uint8_t *slow = c64jit_emitTlbLookup(jit, insn, width, 1);
+    if (slow != NULL)
+    {
+        // mov [rax + rcx], dl / dx / edx / rdx
+        static const uint8_t stores[9][4] = {
+            [1] = {0x88, 0x14, 0x08},
+            [2] = {0x66, 0x89, 0x14, 0x08},
+            [4] = {0x89, 0x14, 0x08},
+            [8] = {0x48, 0x89, 0x14, 0x08},
+        };
+        c64jit_emitBytes(jit, stores[width], width == 1 || width == 4 ? 3 : 4);
+
+        // c64mm_touch, the lines are known here. inc dword [rax]
+        const c64mm_t *mm = ctx->mm;
+        const size_t first = c64mm_genIndex(insn->imm);
+        const size_t last = c64mm_genIndex(insn->imm + width - 1);
+        c64jit_emitMovImm64(jit, RAX, (uint64_t)(uintptr_t)&mm->writeGen[first]);
+        c64jit_emit8(jit, 0xFF);
+        c64jit_emitModRM(jit, 0, 0, RAX);
+        if (last != first)
+        {
+            c64jit_emitMovImm64(jit, RAX, (uint64_t)(uintptr_t)&mm->writeGen[last]);
+            c64jit_emit8(jit, 0xFF);
+            c64jit_emitModRM(jit, 0, 0, RAX);
+        }
+        done = c64jit_emitJump(jit, -1, NULL);
+        c64jit_patch(slow, jit->code + jit->used);
+    }
+
+    c64jit_emitMem(jit, 1, 0x8D, RDI, R15, CPU_TLB);
+    c64jit_emitMovImm(jit, RSI, insn->imm);
+    c64jit_emitCall(jit, function);
+    if (done != NULL)
+    {
+        c64jit_patch(done, jit->code + jit->used);
+    }
+}
+
+// Arithmetic, logic and compare: rax = r1 op operand, r8 keeps the old r1
+static void c64jit_emitAlu(c64jitCtx_t *ctx, const c64insn_t *insn, uint8_t need)
+{
+    c64jit_t *jit = ctx->jit;
+    const uint8_t format = c64decode_format(insn->opcode);
+    int carry = CC_B;
+
+    c64jit_loadReg(ctx, RAX, insn->r1);
+    if (need & (FLAG_CARRY | FLAG_OVERFLOW))
+    {
+        c64jit_emitRR(jit, 0x89, R8, RAX);
+    }
+    if (format == FMT_RR)
+    {
+        c64jit_loadReg(ctx, RCX, insn->r2);
+    }
+    else if (format != FMT_R)
+    {
+        c64jit_emitMovImm(jit, RCX, insn->imm);
+    }
+
+    switch (insn->op)
+    {
+    case OP_ADDI:
+    case OP_ADD:
+        c64jit_emitRR(jit, 0x01, RAX, RCX);
+        break;
+    case OP_SUBI:
+    case OP_SUB:
+    case OP_CMPI:
+    case OP_CMP:
+        c64jit_emitRR(jit, 0x29, RAX, RCX);
+        carry = CC_A;
+        break;
+    case OP_MULI:
+    case OP_MUL:
+    case OP_MULIS:
+    case OP_MULS:
+        // imul rax, rcx
+        c64jit_emitRex(jit, 1, RAX, RCX, 0);
+        c64jit_emit8(jit, 0x0F);
+        c64jit_emit8(jit, 0xAF);
+        c64jit_emitModRM(jit, 3, RAX, RCX);
+        carry = insn->op == OP_MULIS || insn->op == OP_MULS ? CC_L : CC_B;
+        break;
+    case OP_DIVI:
+    case OP_DIV:
+    case OP_MODI:
+    case OP_MOD:
+        // xor edx, edx; div rcx
+        c64jit_emit8(jit, 0x31);
+        c64jit_emitModRM(jit, 3, RDX, RDX);
+        c64jit_emitRex(jit, 1, 0, RCX, 0);
+        c64jit_emit8(jit, 0xF7);
+        c64jit_emitModRM(jit, 3, 6, RCX);
+        if (insn->op == OP_MODI || insn->op == OP_MOD)
+        {
+            c64jit_emitRR(jit, 0x89, RAX, RDX);
+        }
+        carry = CC_A;
+        break;
+    case OP_DIVIS:
+    case OP_DIVS:
+        // cqo; idiv rcx
+        c64jit_emit8(jit, 0x48);
+        c64jit_emit8(jit, 0x99);
+        c64jit_emitRex(jit, 1, 0, RCX, 0);
+        c64jit_emit8(jit, 0xF7);
+        c64jit_emitModRM(jit, 3, 7, RCX);
+        carry = CC_G;
+        break;
+    case OP_ANDI:
+    case OP_AND:
+        c64jit_emitRR(jit, 0x21, RAX, RCX);
+        break;
+    case OP_ORI:
+    case OP_OR:
+        c64jit_emitRR(jit, 0x09, RAX, RCX);
+        break;
+    case OP_XORI:
+    case OP_XOR:
+        c64jit_emitRR(jit, 0x31, RAX, RCX);
+        break;
+    case OP_NOTI:
+    case OP_NOT:
+        c64jit_emitRex(jit, 1, 0, RAX, 0);
+        c64jit_emit8(jit, 0xF7);
+        c64jit_emitModRM(jit, 3, 2, RAX);
+        break;
+    // Shift counts are taken modulo 64, as the interpreter ends up doing on this host
+    case OP_SHLI:
+    case OP_SHL:
+        c64jit_emitShift(jit, SHIFT_SHL, RAX, format == FMT_RR ? -1 : (int)(insn->imm & 63));
+        break;
+    case OP_ROLI:
+    case OP_ROL:
+        c64jit_emitShift(jit, SHIFT_ROL, RAX, format == FMT_RR ? -1 : (int)(insn->imm & 63));
+        break;
+    case OP_SHRI:
+    case OP_SHR:
+        c64jit_emitShift(jit, SHIFT_SHR, RAX, format == FMT_RR ? -1 : (int)(insn->imm & 63));
+        carry = CC_A;
+        break;
+    case OP_RORI:
+    case OP_ROR:
+        c64jit_emitShift(jit, SHIFT_ROR, RAX, format == FMT_RR ? -1 : (int)(insn->imm & 63));
+        carry = CC_A;
+        break;
+    }
+
+    c64jit_emitFlags(jit, need, carry);
+    if (insn->op != OP_CMPI && insn->op != OP_CMP)
+    {
+        c64jit_storeReg(ctx, insn->r1, RAX);
+    }
+}
+
+static void c64jit_emitInsn(c64jitCtx_t *ctx, const c64insn_t *insn, uint8_t need)
+{
+    switch (insn->op)
+    {
+    case OP_LDI:
+    case OP_LDBI:
+    case OP_LDWI:
+    case OP_LDDI:
+        c64jit_emitMovImm(ctx->jit, RAX, insn->imm);
+        c64jit_storeReg(ctx, insn->r1, RAX);
+        break;
+    case OP_LDM:
+        c64jit_emitLoad(ctx, insn, (uint64_t)(uintptr_t)c64tlb_getUint64Slow, 8);
+        break;
+    case OP_LDDM:
+        c64jit_emitLoad(ctx, insn, (uint64_t)(uintptr_t)c64tlb_getUint32Slow, 4);
+        break;
+    case OP_LDWM:
+        c64jit_emitLoad(ctx, insn, (uint64_t)(uintptr_t)c64tlb_getUint16Slow, 2);
+        break;
+    case OP_LDBM:
+        c64jit_emitLoad(ctx, insn, (uint64_t)(uintptr_t)c64tlb_getUint8Slow, 1);
+        break;
+    case OP_ST:
+        c64jit_emitStore(ctx, insn, (uint64_t)(uintptr_t)c64tlb_setUint64Slow, 8);
+        break;
+    case OP_STD:
+        c64jit_emitStore(ctx, insn, (uint64_t)(uintptr_t)c64tlb_setUint32Slow, 4);
+        break;
+    case OP_STW:
+        c64jit_emitStore(ctx, insn, (uint64_t)(uintptr_t)c64tlb_setUint16Slow, 2);
+        break;
+    case OP_STB:
+        c64jit_emitStore(ctx, insn, (uint64_t)(uintptr_t)c64tlb_setUint8Slow, 1);
+        break;
+    case OP_TF:
+        c64jit_loadReg(ctx, RAX, insn->r1);
+        c64jit_storeReg(ctx, insn->r2, RAX);
+        break;
+    default:
+        c64jit_emitAlu(ctx, insn, need);
+        break;
+    }
+}
+
+// The jump ending a block, one or two exits
+static void c64jit_emitBranch(c64jitCtx_t *ctx, const c64insn_t *insn, uint64_t next)
+{
+    c64jit_t *jit = ctx->jit;
+    const char viaRegister = insn->op >= OP_JMPR && insn->op <= OP_JLER;
+    uint8_t mask = c64jit_flagsUsed(insn->op);
+    int taken;
+
+    if (insn->op == OP_JMP || insn->op == OP_JMPR)
+    {
+        if (viaRegister)
+        {
+            c64jit_emitExitReg(ctx, insn->r1);
+        }
+        else
+        {
+            c64jit_emitExit(ctx, insn->imm);
+        }
+        return;
+    }
+
+    switch (insn->op)
+    {
+    case OP_JNE:
+    case OP_JNER:
+    case OP_JGT:
+    case OP_JGTR:
+    case OP_JGE:
+    case OP_JGER:
+        taken = CC_E; // the tested flags are all clear
+        break;
+    default:
+        taken = CC_NE;
+        break;
+    }
+
+    // movzx eax, byte [r15 + flags]; test eax, mask
+    c64jit_emitLoadByte(jit, RAX, R15, CPU_FLAGS);
+    c64jit_emit8(jit, 0xA9);
+    c64jit_emit32(jit, mask);
+    uint8_t *site = c64jit_emitJump(jit, taken, NULL);
+    c64jit_emitExit(ctx, next);
+    c64jit_patch(site, jit->code + jit->used);
+    if (viaRegister)
+    {
+        c64jit_emitExitReg(ctx, insn->r1);
+    }
+    else
+    {
+        c64jit_emitExit(ctx, insn->imm);
+    }
+}
+
+static uint64_t c64jit_line(uint64_t address, size_t index)
+{
+    return ((address >> MM_LINE_SHIFT) + index) << MM_LINE_SHIFT;
+}
+
+// Whether size bytes at address are executable and in the same region.
+// Quiet, the translator looks ahead of execution.
+static char c64jit_isExecutable(c64mm_t *mm, uint64_t address, uint64_t size)
+{
+    if (address > UINT64_MAX - size)
+    {
+        return 0;
+    }
+    const c64mmEntry_t *first = c64mm_lookup(mm, address);
+    const c64mmEntry_t *last = c64mm_lookup(mm, address + size - 1);
+    return first->kind == MM_ENTRY_REGION && last->kind == MM_ENTRY_REGION && first->target == last->target &&
+           (first->attributes & last->attributes & MM_EXEC);
+}
+
+static size_t c64jit_bucket(uint64_t address)
+{
+    return (address ^ (address >> 16)) & (JIT_TABLE_SIZE - 1);
+}
+
+static c64jitBlock_t *c64jit_translate(c64jit_t *jit, c64cpu_t *cpu, uint64_t address)
+{
+    c64insn_t insns[JIT_MAX_INSNS];
+    uint8_t need[JIT_MAX_INSNS];
+    size_t uses[REG_COUNT] = {0};
+    size_t count = 0;
+    uint64_t end = address;
+    c64jitCtx_t ctx;
+
+    if (jit->blockCount == JIT_MAX_BLOCKS || jit->used + JIT_BLOCK_RESERVE > JIT_CODE_SIZE)
+    {
+        c64jit_flush(jit);
+        cpu->jitLastExit = NULL;
+    }
+
+    while (count < JIT_MAX_INSNS && c64jit_isExecutable(cpu->mm, end, INSN_MAX_LENGTH))
+    {
+        c64insn_t *insn = &insns[count];
+        c64decode(cpu->mm, insn, end);
+        const uint64_t lines = ((end + insn->length - 1) >> MM_LINE_SHIFT) - (address >> MM_LINE_SHIFT) + 1;
+        if (!c64jit_canTranslate(insn) || lines > JIT_MAX_LINES || c64cpu_isBreakpoint(cpu, end))
+        {
+            break;
+        }
+        insn->address = end;
+        end += insn->length;
+        count++;
+        if (c64jit_isJump(insn->op))
+        {
+            break;
+        }
+    }
+
+    // A store into the block itself ends it, what follows is decoded again
+    for (size_t i = 0; i < count; i++)
+    {
+        const int width = c64jit_storeWidth(insns[i].op);
+        if (width && insns[i].imm < end && insns[i].imm + width > address)
+        {
+            count = i + 1;
+            end = insns[i].address + insns[i].length;
+            break;
+        }
+    }
+
+    c64jitBlock_t *block = &jit->blocks[jit->blockCount++];
+    const size_t bucket = c64jit_bucket(address);
+    block->address = address;
+    block->entry = NULL;
+    block->size = end - address;
+    block->bytes = NULL;
+    block->lineCount = count == 0 ? 1 : ((end - 1) >> MM_LINE_SHIFT) - (address >> MM_LINE_SHIFT) + 1;
+    for (size_t i = 0; i < block->lineCount; i++)
+    {
+        block->gens[i] = c64mm_getWriteGen(cpu->mm, c64jit_line(address, i));
+        block->genPatch[i] = NULL;
+    }
+    block->next = jit->table[bucket];
+    jit->table[bucket] = block;
+    if (count == 0)
+    {
+        // Remembered as untranslatable until the line is written
+        return block;
+    }
+
+    block->bytes = (uint8_t *)malloc(block->size);
+    if (block->bytes == NULL)
+    {
+        error("c64jit_translate: malloc failed\n");
+    }
+    for (size_t i = 0; i < block->size; i++)
+    {
+        block->bytes[i] = c64mm_getUint8(cpu->mm, address + i);
+    }
+
+    // Flags only need computing if something reads them before they are overwritten.
+    // Everything is live at the end of the block.
+    uint8_t live = ARITH_FLAGS;
+    for (size_t i = count; i-- > 0;)
+    {
+        const uint8_t defined = c64jit_flagsDefined(insns[i].op);
+        need[i] = live & defined;
+        live = (live & ~defined) | c64jit_flagsUsed(insns[i].op);
+        if (c64jit_mayFault(&insns[i]))
+        {
+            live = ARITH_FLAGS;
+        }
+    }
+
+    // The most used guest registers live in host registers for the whole block
+    ctx.jit = jit;
+    ctx.mm = cpu->mm;
+    ctx.written = 0;
+    memset(ctx.host, -1, sizeof(ctx.host));
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t format = c64decode_format(insns[i].opcode);
+        if (format != FMT_NONE && format != FMT_I64)
+        {
+            uses[insns[i].r1]++;
+        }
+        if (format == FMT_RR)
+        {
+            uses[insns[i].r2]++;
+        }
+    }
+    for (size_t slot = 0; slot < JIT_CACHED_REGS; slot++)
+    {
+        size_t best = REG_COUNT;
+        for (size_t reg = 0; reg < REG_COUNT; reg++)
+        {
+            if (ctx.host[reg] < 0 && uses[reg] >= 2 && (best == REG_COUNT || uses[reg] > uses[best]))
+            {
+                best = reg;
+            }
+        }
+        if (best == REG_COUNT)
+        {
+            break;
+        }
+        ctx.host[best] = c64jit_cachedHost[slot];
+    }
+
+    // Prologue, reached from c64jit_run or from a linked exit with IP == address.
+    // Bails out if the budget cannot cover the whole block or the code changed.
+    c64jit_setWritable(jit, jit->code + jit->used, JIT_BLOCK_RESERVE, 1);
+    block->entry = jit->code + jit->used;
+    c64jit_emitMem(jit, 1, 0x81, 7, R15, CPU_FUEL);
+    c64jit_emit32(jit, (uint32_t)count);
+    c64jit_emitJump(jit, CC_B, jit->exit);
+    for (size_t i = 0; i < block->lineCount; i++)
+    {
+        const size_t slot = c64mm_genIndex(c64jit_line(address, i));
+        c64jit_emitMovImm64(jit, RAX, (uint64_t)(uintptr_t)&cpu->mm->writeGen[slot]);
+        // cmp dword [rax], imm32
+        c64jit_emit8(jit, 0x81);
+        c64jit_emitModRM(jit, 0, 7, RAX);
+        block->genPatch[i] = jit->code + jit->used;
+        c64jit_emit32(jit, block->gens[i]);
+        c64jit_emitJump(jit, CC_NE, jit->exit);
+    }
+    c64jit_emitMem(jit, 1, 0x81, 5, R15, CPU_FUEL);
+    c64jit_emit32(jit, (uint32_t)count);
+    for (size_t reg = 0; reg < REG_COUNT; reg++)
+    {
+        if (ctx.host[reg] >= 0)
+        {
+            c64jit_emitMem(jit, 1, 0x8B, ctx.host[reg], R15, CPU_REG(reg));
+        }
+    }
+
+    const c64insn_t *last = &insns[count - 1];
+    for (size_t i = 0; i < count; i++)
+    {
+        if (c64jit_mayFault(&insns[i]))
+        {
+            c64jit_emitFaultGuard(&ctx, &insns[i], count - i);
+        }
+        if (!c64jit_isJump(insns[i].op))
+        {
+            c64jit_emitInsn(&ctx, &insns[i], need[i]);
+        }
+    }
+    if (c64jit_isJump(last->op))
+    {
+        c64jit_emitBranch(&ctx, last, end);
+    }
+    else
+    {
+        c64jit_emitExit(&ctx, end);
+    }
+    c64jit_setWritable(jit, block->entry, JIT_BLOCK_RESERVE, 0);
+    return block;
+}
+
+static char c64jit_isCurrent(c64mm_t *mm, const c64jitBlock_t *block)
+{
+    for (size_t i = 0; i < block->lineCount; i++)
+    {
+        if (block->gens[i] != c64mm_getWriteGen(mm, c64jit_line(block->address, i)))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// A line of the block was written to. If the block's own bytes are
+// unchanged the write went elsewhere and the block is kept.
+static char c64jit_revalidate(c64jit_t *jit, c64mm_t *mm, c64jitBlock_t *block)
+{
+    for (size_t i = 0; i < block->size; i++)
+    {
+        if (c64mm_getUint8(mm, block->address + i) != block->bytes[i])
+        {
+            return 0;
+        }
+    }
+    uint8_t *patch = block->genPatch[0];
+    const size_t size = block->genPatch[block->lineCount - 1] + sizeof(uint32_t) - patch;
+    c64jit_setWritable(jit, patch, size, 1);
+    for (size_t i = 0; i < block->lineCount; i++)
+    {
+        block->gens[i] = c64mm_getWriteGen(mm, c64jit_line(block->address, i));
+        memcpy(block->genPatch[i], &block->gens[i], sizeof(uint32_t));
+    }
+    c64jit_setWritable(jit, patch, size, 0);
+    return 1;
+}
+
+// Returns the block to run at address, translating it once it is hot
+static c64jitBlock_t *c64jit_lookup(c64jit_t *jit, c64cpu_t *cpu, uint64_t address)
+{
+    c64jitBlock_t **link = &jit->table[c64jit_bucket(address)];
+    while (*link != NULL && (*link)->address != address)
+    {
+        link = &(*link)->next;
+    }
+
+    c64jitBlock_t *block = *link;
+    if (block != NULL)
+    {
+        if (c64jit_isCurrent(cpu->mm, block) || (block->entry != NULL && c64jit_revalidate(jit, cpu->mm, block)))
+        {
+            return block->entry != NULL ? block : NULL;
+        }
+        // Stale. Its code stays in place as linked exits may still jump to it,
+        // its prologue keeps failing and sends them back here.
+        *link = block->next;
+    }
+
+    uint16_t *hot = &jit->hot[(address ^ (address >> 16)) & (JIT_HOT_SIZE - 1)];
+    if (++*hot < JIT_HOT_THRESHOLD)
+    {
+        return NULL;
+    }
+    *hot = 0;
+    block = c64jit_translate(jit, cpu, address);
+    return block->entry != NULL ? block : NULL;
+}
+
+uint64_t c64jit_run(c64cpu_t *cpu, uint64_t budget)
+{
+    c64jit_t *jit = cpu->jit;
+    // Translated code keeps cpu->flags up to date itself
+    c64cpu_materializeFlags(cpu);
+    cpu->jitFuel = budget;
+    cpu->jitLastExit = NULL;
+
+    for (;;)
+    {
+        c64jitBlock_t *block = c64jit_lookup(jit, cpu, c64cpu_getReg(cpu, REG_IP));
+        if (block == NULL)
+        {
+            break;
+        }
+        // The exit that brought us here now jumps straight to the block
+        if (cpu->jitLastExit != NULL)
+        {
+            c64jit_setWritable(jit, cpu->jitLastExit, sizeof(int32_t), 1);
+            c64jit_patch(cpu->jitLastExit, block->entry);
+            c64jit_setWritable(jit, cpu->jitLastExit, sizeof(int32_t), 0);
+            cpu->jitLastExit = NULL;
+        }
+
+        const uint64_t fuel = cpu->jitFuel;
+        jit->enter(cpu, block->entry);
+        if (cpu->jitFuel == fuel)
+        {
+            // Bailed out in the prologue
+            break;
+        }
+    }
+
+    cpu->jitLastExit = NULL;
+    return budget - cpu->jitFuel;
+}
+
+c64jit_t *c64jit_create()
+{
+    // enter(cpu, entry): saves the callee saved registers, keeps cpu in r15
+    // and jumps to entry. Blocks leave through exit which restores and returns.
+    static const uint8_t enter[] = {
+        0x55,                   // push rbp
+        0x53,                   // push rbx
+        0x41, 0x54,             // push r12
+        0x41, 0x55,             // push r13
+        0x41, 0x56,             // push r14
+        0x41, 0x57,             // push r15
+        0x48, 0x83, 0xEC, 0x08, // sub rsp, 8 (keeps calls 16 byte aligned)
+        0x49, 0x89, 0xFF,       // mov r15, rdi
+        0xFF, 0xE6,             // jmp rsi
+    };
+    static const uint8_t exit[] = {
+        0x48, 0x83, 0xC4, 0x08, // add rsp, 8
+        0x41, 0x5F,             // pop r15
+        0x41, 0x5E,             // pop r14
+        0x41, 0x5D,             // pop r13
+        0x41, 0x5C,             // pop r12
+        0x5B,                   // pop rbx
+        0x5D,                   // pop rbp
+        0xC3,                   // ret
+    };
+
+    c64jit_t *jit = (c64jit_t *)malloc(sizeof(c64jit_t));
+    if (jit == NULL)
+    {
+        error("c64jit_create: malloc failed\n");
+    }
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_JIT
+    flags |= MAP_JIT;
+#endif
+    void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (code == MAP_FAILED)
+    {
+        warning("c64jit_create: mmap failed\n");
+        free(jit);
+        return NULL;
+    }
+    jit->code = (uint8_t *)code;
+    jit->pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    jit->used = 0;
+    jit->blockCount = 0;
+    memset(jit->table, 0, sizeof(jit->table));
+    memset(jit->hot, 0, sizeof(jit->hot));
+
+    // ISO C has no cast from object to function pointers
+    memcpy(&jit->enter, &code, sizeof(code));
+    c64jit_emitBytes(jit, enter, sizeof(enter));
+    jit->exit = jit->code + jit->used;
+    c64jit_emitBytes(jit, exit, sizeof(exit));
+    jit->start = jit->used;
+    c64jit_setWritable(jit, jit->code, JIT_CODE_SIZE, 0);
+    return jit;
+}
+
+void c64jit_flush(c64jit_t *jit)
+{
+    for (size_t i = 0; i < jit->blockCount; i++)
+    {
+        free(jit->blocks[i].bytes);
+    }
+    jit->blockCount = 0;
+    jit->used = jit->start;
+    memset(jit->table, 0, sizeof(jit->table));
+    memset(jit->hot, 0, sizeof(jit->hot));
+}
+
+void c64jit_destroy(c64jit_t *jit)
+{
+    if (jit == NULL)
+    {
+        return;
+    }
+    c64jit_flush(jit);
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+#else
+c64jit_t *c64jit_create()
+{
+    return NULL;
+}
+
+void c64jit_destroy(c64jit_t *jit)
+{
+    (void)jit;
+}
+
+void c64jit_flush(c64jit_t *jit)
+{
+    (void)jit;
+}
+
+char c64jit_canTranslate(const c64insn_t *insn)
+{
+    (void)insn;
+    return 0;
+}
+
+uint64_t c64jit_run(c64cpu_t *cpu, uint64_t budget)
+{
+    (void)cpu;
+    (void)budget;
+    return 0;
+}
+#endif
\ No newline at end of file
@@ -2,6 +2,6 @@
 
 int main(void)
 {
-    c64vm_run();
+    c64vm_run(ENGINE_THREADED);
     return 0;
 }
\ No newline at end of file
@@ -15,8 +15,21 @@ See the MIT License for more details.
 You should have received a copy of the MIT License
 along with c64vm. If not, see <https://mit-license.org/>.
 */
+// mmap with MAP_ANONYMOUS is not part of C99
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#define _DARWIN_C_SOURCE
 #include <c64mem.h>
 
+#if C64MEM_SPARSE
+#include <sys/mman.h>
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#endif
+
 c64dev_t *c64mem_createDevice(size_t size, c64cpu_t *cpu)
 {
     c64dev_t *device = malloc(sizeof(c64dev_t));
@@ -32,9 +45,13 @@ c64dev_t *c64mem_createDevice(size_t size, c64cpu_t *cpu)
     device->setUint32 = c64mem_setUint32;
     device->setUint16 = c64mem_setUint16;
     device->setUint8 = c64mem_setUint8;
+    device->readBlock = c64mem_readBlock;
+    device->writeBlock = c64mem_writeBlock;
     device->destroy = c64mem_destroy;
     device->data = c64mem_createMemory(size);
     device->dataSize = size;
+    device->host = (uint8_t *)device->data;
+    device->attributes = 0;
     device->cpu = cpu;
 
     strcpy(device->name, "Memory");
@@ -44,17 +61,34 @@ c64dev_t *c64mem_createDevice(size_t size, c64cpu_t *cpu)
 
 void *c64mem_createMemory(size_t size)
 {
-    void *memory = malloc(size);
+#if C64MEM_SPARSE
+    // Pages are only backed by the host once they are first touched and
+    // read as zero until then, so creation takes constant time
+    void *memory = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        error("c64mem_createMemory: mmap failed\n");
+    }
+#else
+    void *memory = calloc(size ? size : 1, 1);
     if (memory == NULL)
     {
-        error("c64mem_createMemory: malloc failed\n");
+        error("c64mem_createMemory: calloc failed\n");
     }
-
-    // Initialize memory to zero
-    memset(memory, 0, size);
+#endif
     return memory;
 }
 
+void c64mem_destroyMemory(void *memory, size_t size)
+{
+#if C64MEM_SPARSE
+    munmap(memory, size ? size : 1);
+#else
+    (void)size;
+    free(memory);
+#endif
+}
+
 uint64_t c64mem_getUint64(c64dev_t *device, uint64_t address)
 {
     // Check if address is out of bounds
@@ -143,8 +177,28 @@ void c64mem_setUint8(c64dev_t *device, uint64_t address, uint8_t value)
     memcpy((uint8_t *)(device->data) + address, &value, sizeof(uint8_t));
 }
 
+void c64mem_readBlock(c64dev_t *device, uint64_t address, void *buffer, size_t size)
+{
+    // Check if the block is out of bounds
+    if (address > device->dataSize || size > device->dataSize - address)
+    {
+        error("c64mem_readBlock: address out of bounds\n");
+    }
+    memcpy(buffer, (uint8_t *)(device->data) + address, size);
+}
+
+void c64mem_writeBlock(c64dev_t *device, uint64_t address, const void *buffer, size_t size)
+{
+    // Check if the block is out of bounds
+    if (address > device->dataSize || size > device->dataSize - address)
+    {
+        error("c64mem_writeBlock: address out of bounds\n");
+    }
+    memcpy((uint8_t *)(device->data) + address, buffer, size);
+}
+
 void c64mem_destroy(c64dev_t *device)
 {
-    free(device->data);
+    c64mem_destroyMemory(device->data, device->dataSize);
     free(device);
 }
\ No newline at end of file
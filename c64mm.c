@@ -17,6 +17,32 @@ along with c64vm. If not, see <https://mit-license.org/>.
 */
 #include <c64mm.h>
 
+static c64mmTable_t *c64mm_createTable()
+{
+    c64mmTable_t *table = (c64mmTable_t *)calloc(1, sizeof(c64mmTable_t));
+    if (table == NULL)
+    {
+        error("c64mm_createTable: calloc failed\n");
+    }
+    return table;
+}
+
+static void c64mm_destroyTable(c64mmTable_t *table)
+{
+    for (size_t i = 0; i < MM_LEVEL_SIZE; i++)
+    {
+        if (table->entries[i].kind == MM_ENTRY_TABLE)
+        {
+            c64mm_destroyTable(table->entries[i].next);
+        }
+        else if (table->entries[i].kind == MM_ENTRY_SHARED)
+        {
+            free(table->entries[i].target);
+        }
+    }
+    free(table);
+}
+
 c64mm_t *c64mm_create()
 {
     c64mm_t *c64mm = (c64mm_t *)malloc(sizeof(c64mm_t));
@@ -25,16 +51,46 @@ c64mm_t *c64mm_create()
         error("c64mm_create: malloc failed\n");
     }
     c64mm->count = 0;
+    c64mm->capacity = 0;
     c64mm->regions = NULL;
+    c64mm->root = c64mm_createTable();
+    c64mm->retired = NULL;
+    c64mm->lock = mutexCreate();
+    c64mm->users = 0;
+    c64mm->atomicLock = mutexCreate();
+    c64mm->waitLock = mutexCreate();
+    c64mm->waiters = NULL;
+    c64mm->mapGen = 0;
+    memset(c64mm->writeGen, 0, sizeof(c64mm->writeGen));
     return c64mm;
 }
 
 void c64mm_setCPU(c64mm_t *mm, c64cpu_t *cpu)
 {
+    mutexLock(mm->lock);
     for (uint64_t i = 0; i < mm->count; i++)
     {
         mm->regions[i]->device->cpu = cpu;
     }
+    mutexUnlock(mm->lock);
+}
+
+void c64mm_retain(c64mm_t *mm)
+{
+    mutexLock(mm->lock);
+    mm->users++;
+    mutexUnlock(mm->lock);
+}
+
+void c64mm_release(c64mm_t *mm)
+{
+    mutexLock(mm->lock);
+    const uint32_t users = --mm->users;
+    mutexUnlock(mm->lock);
+    if (users == 0)
+    {
+        c64mm_destroy(mm);
+    }
 }
 
 void c64mm_destroy(c64mm_t *mm)
@@ -59,15 +115,114 @@ void c64mm_destroy(c64mm_t *mm)
         free(mm->regions[i]);
     }
     free(mm->regions);
+    c64mm_destroyTable(mm->root);
+    while (mm->retired != NULL)
+    {
+        c64mmShared_t *shared = mm->retired;
+        mm->retired = shared->retired;
+        free(shared);
+    }
+    mutexDestroy(mm->lock);
+    mutexDestroy(mm->atomicLock);
+    mutexDestroy(mm->waitLock);
     free(mm);
 }
 
+// Index range of the entries of a table at level, based at base, that overlap start - end
+static void c64mm_entryRange(int level, uint64_t base, uint64_t start, uint64_t end, size_t *first, size_t *last)
+{
+    const int shift = c64mm_levelShift(level);
+    const uint64_t tableEnd = level == 0 ? UINT64_MAX : base + (((uint64_t)1 << c64mm_levelShift(level - 1)) - 1);
+    const uint64_t lo = start > base ? start : base;
+    const uint64_t hi = end < tableEnd ? end : tableEnd;
+    *first = (size_t)((lo - base) >> shift);
+    *last = (size_t)((hi - base) >> shift);
+}
+
+// Adds region to the regions sharing the page of entry
+static void c64mm_share(c64mm_t *mm, c64mmEntry_t *entry, c64mmr_t *region)
+{
+    c64mmShared_t *old = entry->kind == MM_ENTRY_SHARED ? (c64mmShared_t *)entry->target : NULL;
+    const size_t count = old == NULL ? 1 : old->count + 1;
+    c64mmShared_t *shared = (c64mmShared_t *)malloc(sizeof(c64mmShared_t) + count * sizeof(c64mmr_t *));
+    if (shared == NULL)
+    {
+        error("c64mm_map: malloc failed\n");
+    }
+    shared->retired = NULL;
+    shared->count = count;
+    size_t i = count - 1;
+    if (old != NULL)
+    {
+        memcpy(shared->regions, old->regions, old->count * sizeof(c64mmr_t *));
+        old->retired = mm->retired;
+        mm->retired = old;
+    }
+    while (i > 0 && shared->regions[i - 1]->start > region->start)
+    {
+        shared->regions[i] = shared->regions[i - 1];
+        i--;
+    }
+    shared->regions[i] = region;
+
+    entry->attributes = MM_READ | MM_WRITE | MM_EXEC | MM_MMIO | MM_COMPACT;
+    MM_STORE(entry->target, (void *)shared);
+    MM_STORE(entry->kind, MM_ENTRY_SHARED);
+}
+
+// Points the entries below table at region, as high up as the region covers them
+static void c64mm_mapRange(c64mm_t *mm, c64mmTable_t *table, int level, uint64_t base, c64mmr_t *region, uint8_t attributes)
+{
+    const uint64_t span = (uint64_t)1 << c64mm_levelShift(level);
+    size_t first;
+    size_t last;
+
+    c64mm_entryRange(level, base, region->start, region->end, &first, &last);
+    for (size_t i = first; i <= last; i++)
+    {
+        c64mmEntry_t *entry = &table->entries[i];
+        const uint64_t entryStart = base + i * span;
+        const uint64_t entryEnd = entryStart + (span - 1);
+
+        if (entry->kind == MM_ENTRY_NONE && region->start <= entryStart && region->end >= entryEnd)
+        {
+            entry->target = region;
+            entry->attributes = attributes;
+            MM_STORE(entry->kind, MM_ENTRY_REGION);
+        }
+        else if (level == MM_LEVELS - 1)
+        {
+            // Part of a page, possibly next to another region
+            c64mm_share(mm, entry, region);
+        }
+        else
+        {
+            if (entry->kind == MM_ENTRY_NONE)
+            {
+                entry->next = c64mm_createTable();
+                MM_STORE(entry->kind, MM_ENTRY_TABLE);
+            }
+            c64mm_mapRange(mm, entry->next, level + 1, entryStart, region, attributes);
+        }
+    }
+}
+
 void c64mm_map(c64mm_t *mm, c64dev_t *device, uint64_t start, uint64_t end, char remap)
 {
     if (start > end)
     {
         error("c64mm_map: start address 0x%016llx is greater than end address 0x%016llx\n", start, end);
     }
+    mutexLock(mm->lock);
+    for (uint64_t i = 0; i < mm->count; i++)
+    {
+        // Check if the new region overlaps with an existing region
+        if (start <= mm->regions[i]->end && end >= mm->regions[i]->start)
+        {
+            error("c64mm_map: region 0x%016llx - 0x%016llx overlaps with existing region 0x%016llx - 0x%016llx which is mapped to %s\n", start, end, mm->regions[i]->start, mm->regions[i]->end, mm->regions[i]->device->name);
+        }
+    }
+
     c64mmr_t *region = (c64mmr_t *)malloc(sizeof(c64mmr_t));
     if (region == NULL)
     {
@@ -78,45 +233,237 @@ void c64mm_map(c64mm_t *mm, c64dev_t *device, uint64_t start, uint64_t end, char
     region->end = end;
     region->remap = remap;
 
-    mm->regions = (c64mmr_t **)realloc(mm->regions, (mm->count + 1) * sizeof(c64mmr_t *));
-    for (uint64_t i = 0; i < mm->count; i++)
+    if (mm->count == mm->capacity)
     {
-        // Check if the new region overlaps with an existing region
-        // check if either the start or end of the new region is within the existing region
-        if ((region->start >= mm->regions[i]->start && region->start <= mm->regions[i]->end) ||
-            (region->end >= mm->regions[i]->start && region->end <= mm->regions[i]->end))
+        mm->capacity = mm->capacity == 0 ? 8 : mm->capacity * 2;
+        mm->regions = (c64mmr_t **)realloc(mm->regions, mm->capacity * sizeof(c64mmr_t *));
+        if (mm->regions == NULL)
         {
-            error("c64mm_map: region 0x%016llx - 0x%016llx overlaps with existing region 0x%016llx - 0x%016llx which is mapped to %s\n", region->start, region->end, mm->regions[i]->start, mm->regions[i]->end, mm->regions[i]->device->name);
+            error("c64mm_map: realloc failed\n");
         }
     }
-    for (int i = mm->count; i > 0; i--)
+    mm->regions[mm->count++] = region;
+
+    // Devices without host memory are MMIO
+    region->attributes = device->attributes ? device->attributes : MM_READ | MM_WRITE | MM_EXEC;
+    if (device->host == NULL)
+        region->attributes |= MM_MMIO;
+    c64mm_mapRange(mm, mm->root, 0, 0, region, region->attributes);
+    MM_STORE(mm->mapGen, mm->mapGen + 1);
+    mutexUnlock(mm->lock);
+}
+
+static void c64mm_protectRange(c64mmTable_t *table, int level, uint64_t base, uint64_t start, uint64_t end, uint8_t attributes)
+{
+    const uint64_t span = (uint64_t)1 << c64mm_levelShift(level);
+    size_t first;
+    size_t last;
+
+    c64mm_entryRange(level, base, start, end, &first, &last);
+    for (size_t i = first; i <= last; i++)
     {
-        mm->regions[i] = mm->regions[i - 1];
+        c64mmEntry_t *entry = &table->entries[i];
+        const uint64_t entryStart = base + i * span;
+        const uint64_t entryEnd = entryStart + (span - 1);
+        const char covered = start <= entryStart && end >= entryEnd;
+
+        if (entry->kind == MM_ENTRY_NONE)
+        {
+            continue;
+        }
+        if (entry->kind == MM_ENTRY_REGION && !covered && level < MM_LEVELS - 1)
+        {
+            // Only part of the span changes, split it into the next level
+            c64mmTable_t *next = c64mm_createTable();
+            for (size_t j = 0; j < MM_LEVEL_SIZE; j++)
+            {
+                next->entries[j] = *entry;
+            }
+            entry->next = next;
+            MM_STORE(entry->kind, MM_ENTRY_TABLE);
+        }
+        if (entry->kind == MM_ENTRY_TABLE)
+        {
+            c64mm_protectRange(entry->next, level + 1, entryStart, start, end, attributes);
+        }
+        else
+        {
+            entry->attributes = attributes;
+        }
     }
+}
 
-    mm->regions[0] = region;
-    mm->count++;
+void c64mm_protect(c64mm_t *mm, uint64_t start, uint64_t end, uint8_t attributes)
+{
+    if (start > end)
+    {
+        error("c64mm_protect: start address 0x%016llx is greater than end address 0x%016llx\n", start, end);
+    }
+    mutexLock(mm->lock);
+    c64mm_protectRange(mm->root, 0, 0, start, end, attributes);
+    MM_STORE(mm->mapGen, mm->mapGen + 1);
+    mutexUnlock(mm->lock);
 }
 
-c64mmr_t *c64mm_findRegion(c64mm_t *mm, uint64_t address)
+// Region holding address, NULL if there is none
+static c64mmr_t *c64mm_resolve(c64mm_t *mm, uint64_t address, uint8_t *attributes)
 {
-    for (uint64_t i = 0; i < mm->count; i++)
+    const c64mmEntry_t *entry = c64mm_lookup(mm, address);
+    const uint8_t kind = MM_LOAD(entry->kind);
+    *attributes = entry->attributes;
+    if (kind == MM_ENTRY_REGION)
+    {
+        return (c64mmr_t *)entry->target;
+    }
+    if (kind != MM_ENTRY_SHARED)
+    {
+        return NULL;
+    }
+    // The last region of the page starting at or before address
+    const c64mmShared_t *shared = (const c64mmShared_t *)MM_LOAD(entry->target);
+    size_t low = 0;
+    size_t high = shared->count;
+    while (low < high)
+    {
+        const size_t middle = low + (high - low) / 2;
+        if (shared->regions[middle]->start <= address)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if (low == 0 || address > shared->regions[low - 1]->end)
     {
-        if (address >= mm->regions[i]->start && address <= mm->regions[i]->end)
+        return NULL;
+    }
+    *attributes &= shared->regions[low - 1]->attributes;
+    return shared->regions[low - 1];
+}
+
+uint8_t c64mm_getAttributes(c64mm_t *mm, uint64_t address)
+{
+    uint8_t attributes;
+    return c64mm_resolve(mm, address, &attributes) == NULL ? 0 : attributes;
+}
+
+// The entry deciding about address and the bytes it covers
+static const c64mmEntry_t *c64mm_lookupSpan(c64mm_t *mm, uint64_t address, uint64_t *span)
+{
+    const c64mmTable_t *table = mm->root;
+    for (int level = 0;; level++)
+    {
+        const c64mmEntry_t *entry = &table->entries[(address >> c64mm_levelShift(level)) & (MM_LEVEL_SIZE - 1)];
+        if (MM_LOAD(entry->kind) != MM_ENTRY_TABLE)
         {
-            return mm->regions[i];
+            *span = (uint64_t)1 << c64mm_levelShift(level);
+            return entry;
         }
+        table = entry->next;
+    }
+}
+
+// Whether entry maps region as readable and writable memory
+static char c64mm_isHostEntry(const c64mmEntry_t *entry, const c64mmr_t *region)
+{
+    return entry->kind == MM_ENTRY_REGION && entry->target == region &&
+           (entry->attributes & (MM_READ | MM_WRITE | MM_MMIO)) == (MM_READ | MM_WRITE);
+}
+
+uint8_t *c64mm_hostRange(c64mm_t *mm, uint64_t address, uint64_t *low, uint64_t *high)
+{
+    uint64_t span;
+    const c64mmEntry_t *entry = c64mm_lookupSpan(mm, address, &span);
+    if (entry->kind != MM_ENTRY_REGION)
+    {
+        return NULL;
+    }
+    const c64mmr_t *region = (const c64mmr_t *)entry->target;
+    const c64dev_t *device = region->device;
+    if (!c64mm_isHostEntry(entry, region) || device->host == NULL || device->dataSize == 0)
+    {
+        return NULL;
+    }
+
+    // Guest addresses backed by the device data
+    const uint64_t base = region->remap ? region->start : 0;
+    const uint64_t dataEnd = device->dataSize - 1 > UINT64_MAX - base ? UINT64_MAX : base + (device->dataSize - 1);
+    const uint64_t first = *low > region->start ? *low : region->start;
+    const uint64_t last = *high < region->end ? *high : region->end;
+    if (address < first || address > last || address < base || address > dataEnd)
+    {
+        return NULL;
+    }
+
+    // Grow entry by entry while the neighbours map the same region the same way
+    uint64_t start = address & ~(span - 1);
+    uint64_t end = address | (span - 1);
+    while (start > first && start > base)
+    {
+        entry = c64mm_lookupSpan(mm, start - 1, &span);
+        if (!c64mm_isHostEntry(entry, region))
+        {
+            break;
+        }
+        start = (start - 1) & ~(span - 1);
+    }
+    while (end < last && end < dataEnd)
+    {
+        entry = c64mm_lookupSpan(mm, end + 1, &span);
+        if (!c64mm_isHostEntry(entry, region))
+        {
+            break;
+        }
+        end = (end + 1) | (span - 1);
+    }
+
+    start = start > first ? start : first;
+    start = start > base ? start : base;
+    end = end < last ? end : last;
+    end = end < dataEnd ? end : dataEnd;
+    *low = start;
+    *high = end;
+    return device->host + (start - base);
+}
+
+c64mmr_t *c64mm_findRegion(c64mm_t *mm, uint64_t address)
+{
+    uint8_t attributes;
+    c64mmr_t *region = c64mm_resolve(mm, address, &attributes);
+    if (region == NULL)
+    {
+        warning("c64mm_findRegion: no region found for address 0x%016llx\n", address);
+    }
+    return region;
+}
+
+// Region for an access, reports unmapped addresses and missing permissions.
+// Returns NULL if the access is to be dropped.
+static c64mmr_t *c64mm_access(c64mm_t *mm, uint64_t address, uint8_t permission, const char *function)
+{
+    uint8_t attributes;
+    c64mmr_t *region = c64mm_resolve(mm, address, &attributes);
+    if (region == NULL)
+    {
+        warning("c64mm_findRegion: no region found for address 0x%016llx\n", address);
+        error("%s: no region found for address 0x%016llx\n", function, address);
+    }
+    if (!(attributes & permission))
+    {
+        warning("%s: address 0x%016llx is not %s\n", function, address, permission == MM_READ ? "readable" : "writable");
+        return NULL;
     }
-    warning("c64mm_findRegion: no region found for address 0x%016llx\n", address);
-    return NULL;
+    return region;
 }
 
 uint64_t c64mm_getUint64(c64mm_t *mm, uint64_t address)
 {
-    c64mmr_t *region = c64mm_findRegion(mm, address);
+    c64mmr_t *region = c64mm_access(mm, address, MM_READ, "c64mm_getUint64");
     if (region == NULL)
     {
-        error("c64mm_getUint64: no region found for address 0x%016llx\n", address);
+        return 0;
     }
     uint64_t finalAddress = region->remap ? address - region->start : address;
     return region->device->getUint64(region->device, finalAddress);
@@ -124,10 +471,10 @@ uint64_t c64mm_getUint64(c64mm_t *mm, uint64_t address)
 
 uint32_t c64mm_getUint32(c64mm_t *mm, uint64_t address)
 {
-    c64mmr_t *region = c64mm_findRegion(mm, address);
+    c64mmr_t *region = c64mm_access(mm, address, MM_READ, "c64mm_getUint32");
     if (region == NULL)
     {
-        error("c64mm_getUint32: no region found for address 0x%016llx\n", address);
+        return 0;
     }
     uint64_t finalAddress = region->remap ? address - region->start : address;
     return region->device->getUint32(region->device, finalAddress);
@@ -135,10 +482,10 @@ uint32_t c64mm_getUint32(c64mm_t *mm, uint64_t address)
 
 uint16_t c64mm_getUint16(c64mm_t *mm, uint64_t address)
 {
-    c64mmr_t *region = c64mm_findRegion(mm, address);
+    c64mmr_t *region = c64mm_access(mm, address, MM_READ, "c64mm_getUint16");
     if (region == NULL)
     {
-        error("c64mm_getUint16: no region found for address 0x%016llx\n", address);
+        return 0;
     }
     uint64_t finalAddress = region->remap ? address - region->start : address;
     return region->device->getUint16(region->device, finalAddress);
@@ -146,10 +493,10 @@ uint16_t c64mm_getUint16(c64mm_t *mm, uint64_t address)
 
 uint8_t c64mm_getUint8(c64mm_t *mm, uint64_t address)
 {
-    c64mmr_t *region = c64mm_findRegion(mm, address);
+    c64mmr_t *region = c64mm_access(mm, address, MM_READ, "c64mm_getUint8");
     if (region == NULL)
     {
-        error("c64mm_getUint8: no region found for address 0x%016llx\n", address);
+        return 0;
     }
     uint64_t finalAddress = region->remap ? address - region->start : address;
     return region->device->getUint8(region->device, finalAddress);
@@ -157,54 +504,153 @@ uint8_t c64mm_getUint8(c64mm_t *mm, uint64_t address)
 
 void c64mm_setUint64(c64mm_t *mm, uint64_t address, uint64_t value)
 {
-    c64mmr_t *region = c64mm_findRegion(mm, address);
+    c64mmr_t *region = c64mm_access(mm, address, MM_WRITE, "c64mm_setUint64");
     if (region == NULL)
     {
-        error("c64mm_setUint64: no region found for address 0x%016llx\n", address);
+        return;
     }
     uint64_t finalAddress = region->remap ? address - region->start : address;
     region->device->setUint64(region->device, finalAddress, value);
+    c64mm_touch(mm, address, sizeof(uint64_t));
 }
 
 void c64mm_setUint32(c64mm_t *mm, uint64_t address, uint32_t value)
 {
-    c64mmr_t *region = c64mm_findRegion(mm, address);
+    c64mmr_t *region = c64mm_access(mm, address, MM_WRITE, "c64mm_setUint32");
     if (region == NULL)
     {
-        error("c64mm_setUint32: no region found for address 0x%016llx\n", address);
+        return;
     }
     uint64_t finalAddress = region->remap ? address - region->start : address;
     region->device->setUint32(region->device, finalAddress, value);
+    c64mm_touch(mm, address, sizeof(uint32_t));
 }
 
 void c64mm_setUint16(c64mm_t *mm, uint64_t address, uint16_t value)
 {
-    c64mmr_t *region = c64mm_findRegion(mm, address);
+    c64mmr_t *region = c64mm_access(mm, address, MM_WRITE, "c64mm_setUint16");
     if (region == NULL)
     {
-        error("c64mm_setUint16: no region found for address 0x%016llx\n", address);
+        return;
     }
     uint64_t finalAddress = region->remap ? address - region->start : address;
     region->device->setUint16(region->device, finalAddress, value);
+    c64mm_touch(mm, address, sizeof(uint16_t));
 }
 
 void c64mm_setUint8(c64mm_t *mm, uint64_t address, uint8_t value)
 {
-    c64mmr_t *region = c64mm_findRegion(mm, address);
+    c64mmr_t *region = c64mm_access(mm, address, MM_WRITE, "c64mm_setUint8");
     if (region == NULL)
     {
-        error("c64mm_setUint8: no region found for address 0x%016llx\n", address);
+        return;
     }
     uint64_t finalAddress = region->remap ? address - region->start : address;
     region->device->setUint8(region->device, finalAddress, value);
+    c64mm_touch(mm, address, sizeof(uint8_t));
+}
+
+// Length of the run at address that stays on one page and in one region, at most size.
+// Sets *region to NULL if the run lacks the permission.
+static size_t c64mm_blockRun(c64mm_t *mm, uint64_t address, size_t size, uint8_t permission, const char *function, c64mmr_t **region)
+{
+    uint8_t attributes;
+    *region = c64mm_resolve(mm, address, &attributes);
+    if (*region == NULL)
+    {
+        error("%s: no region found for address 0x%016llx\n", function, address);
+    }
+
+    // Attributes can change on the next page
+    uint64_t run = ((uint64_t)1 << MM_PAGE_SHIFT) - (address & (((uint64_t)1 << MM_PAGE_SHIFT) - 1));
+    if ((*region)->end - address < run - 1)
+    {
+        run = (*region)->end - address + 1;
+    }
+    if (run > size)
+    {
+        run = size;
+    }
+
+    if (!(attributes & permission))
+    {
+        warning("%s: 0x%016llx - 0x%016llx is not %s\n", function, address, address + run - 1, permission == MM_READ ? "readable" : "writable");
+        *region = NULL;
+    }
+    return (size_t)run;
+}
+
+void c64mm_read(c64mm_t *mm, uint64_t address, void *buffer, size_t size)
+{
+    uint8_t *bytes = (uint8_t *)buffer;
+    while (size > 0)
+    {
+        c64mmr_t *region;
+        const size_t run = c64mm_blockRun(mm, address, size, MM_READ, "c64mm_read", &region);
+        if (region == NULL)
+        {
+            memset(bytes, 0, run);
+        }
+        else
+        {
+            c64dev_t *device = region->device;
+            uint64_t finalAddress = region->remap ? address - region->start : address;
+            if (device->readBlock != NULL)
+            {
+                device->readBlock(device, finalAddress, bytes, run);
+            }
+            else
+            {
+                for (size_t i = 0; i < run; i++)
+                {
+                    bytes[i] = device->getUint8(device, finalAddress + i);
+                }
+            }
+        }
+        address += run;
+        bytes += run;
+        size -= run;
+    }
+}
+
+void c64mm_write(c64mm_t *mm, uint64_t address, const void *buffer, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)buffer;
+    while (size > 0)
+    {
+        c64mmr_t *region;
+        const size_t run = c64mm_blockRun(mm, address, size, MM_WRITE, "c64mm_write", &region);
+        if (region != NULL)
+        {
+            c64dev_t *device = region->device;
+            uint64_t finalAddress = region->remap ? address - region->start : address;
+            if (device->writeBlock != NULL)
+            {
+                device->writeBlock(device, finalAddress, bytes, run);
+            }
+            else
+            {
+                for (size_t i = 0; i < run; i++)
+                {
+                    device->setUint8(device, finalAddress + i, bytes[i]);
+                }
+            }
+            c64mm_touchBlock(mm, address, run);
+        }
+        address += run;
+        bytes += run;
+        size -= run;
+    }
 }
 
 void c64mm_print(c64mm_t *mm)
 {
     printf("Memory map:\n");
+    mutexLock(mm->lock);
     for (uint64_t i = 0; i < mm->count; i++)
     {
         printf("  0x%016llX - 0x%016llX: %s\n", mm->regions[i]->start, mm->regions[i]->end, mm->regions[i]->device->name);
     }
+    mutexUnlock(mm->lock);
     printf("\n");
 }
\ No newline at end of file
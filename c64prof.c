@@ -0,0 +1,262 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#include <c64prof.h>
+#include <string.h>
+
+c64prof_t *c64prof_create(uint8_t format)
+{
+    c64prof_t *prof = malloc(sizeof(c64prof_t));
+    if (prof == NULL)
+    {
+        error("c64prof_create: malloc failed\n");
+    }
+    prof->format = format;
+    prof->regionCount = 0;
+    c64prof_reset(prof);
+    return prof;
+}
+
+void c64prof_destroy(c64prof_t *prof)
+{
+    free(prof);
+}
+
+void c64prof_reset(c64prof_t *prof)
+{
+    prof->total = 0;
+    prof->ticks = 0;
+    memset(prof->opCounts, 0, sizeof(prof->opCounts));
+    memset(prof->opTicks, 0, sizeof(prof->opTicks));
+    for (size_t i = 0; i < PROF_SITE_SIZE; i++)
+    {
+        prof->sites[i].address = UINT64_MAX;
+        prof->sites[i].count = 0;
+        prof->sites[i].ticks = 0;
+        prof->sites[i].op = OP_INVALID;
+    }
+    prof->siteCount = 0;
+    prof->dropped = 0;
+}
+
+void c64prof_addRegion(c64prof_t *prof, const char *name, uint64_t start, uint64_t end)
+{
+    if (prof->regionCount == PROF_MAX_REGIONS)
+    {
+        warning("c64prof_addRegion: no room for region %s\n", name);
+        return;
+    }
+    c64profRegion_t *region = &prof->regions[prof->regionCount++];
+    snprintf(region->name, PROF_NAME_SIZE, "%s", name);
+    region->start = start;
+    region->end = end;
+}
+
+// Open addressing with linear probing. The table is never more than three
+// quarters full, later addresses are only counted in the totals.
+c64profSite_t *c64prof_findSite(c64prof_t *prof, uint64_t address)
+{
+    size_t index = (size_t)((address * 0x9e3779b97f4a7c15ull) >> 48) & (PROF_SITE_SIZE - 1);
+    while (1)
+    {
+        c64profSite_t *site = &prof->sites[index];
+        if (site->address == address)
+        {
+            return site;
+        }
+        if (site->address == UINT64_MAX)
+        {
+            if (prof->siteCount >= PROF_SITE_SIZE / 4 * 3)
+            {
+                return NULL;
+            }
+            prof->siteCount++;
+            site->address = address;
+            return site;
+        }
+        index = (index + 1) & (PROF_SITE_SIZE - 1);
+    }
+}
+
+static int c64prof_byTicks(const void *a, const void *b)
+{
+    const c64profSite_t *siteA = *(const c64profSite_t *const *)a;
+    const c64profSite_t *siteB = *(const c64profSite_t *const *)b;
+    if (siteA->ticks != siteB->ticks)
+    {
+        return siteA->ticks < siteB->ticks ? 1 : -1;
+    }
+    return siteA->address < siteB->address ? -1 : siteA->address > siteB->address;
+}
+
+// Sort key of the opcode table, set for the duration of the qsort
+static const uint64_t *c64prof_sortCounts;
+
+static int c64prof_byCount(const void *a, const void *b)
+{
+    const uint8_t opA = *(const uint8_t *)a;
+    const uint8_t opB = *(const uint8_t *)b;
+    if (c64prof_sortCounts[opA] != c64prof_sortCounts[opB])
+    {
+        return c64prof_sortCounts[opA] < c64prof_sortCounts[opB] ? 1 : -1;
+    }
+    return opA - opB;
+}
+
+static uint64_t c64prof_regionTicks(c64prof_t *prof, const c64profRegion_t *region, uint64_t *count)
+{
+    uint64_t ticks = 0;
+    *count = 0;
+    for (size_t i = 0; i < PROF_SITE_SIZE; i++)
+    {
+        const c64profSite_t *site = &prof->sites[i];
+        if (site->address != UINT64_MAX && site->address >= region->start && site->address <= region->end)
+        {
+            ticks += site->ticks;
+            *count += site->count;
+        }
+    }
+    return ticks;
+}
+
+static double c64prof_percent(uint64_t part, uint64_t whole)
+{
+    return whole == 0 ? 0.0 : 100.0 * (double)part / (double)whole;
+}
+
+// Writes name as a JSON string, region names may contain anything
+static void c64prof_writeString(FILE *file, const char *name)
+{
+    fputc('"', file);
+    for (const unsigned char *c = (const unsigned char *)name; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(file, "\\%c", *c);
+        }
+        else if (*c < 0x20)
+        {
+            fprintf(file, "\\u%04x", *c);
+        }
+        else
+        {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+void c64prof_report(c64prof_t *prof, FILE *file)
+{
+    uint8_t ops[OP_COUNT];
+    size_t opCount = 0;
+    for (size_t op = 0; op < OP_COUNT; op++)
+    {
+        if (prof->opCounts[op] > 0)
+        {
+            ops[opCount++] = (uint8_t)op;
+        }
+    }
+    c64prof_sortCounts = prof->opCounts;
+    qsort(ops, opCount, sizeof(ops[0]), c64prof_byCount);
+
+    c64profSite_t **sites = malloc(sizeof(c64profSite_t *) * (prof->siteCount + 1));
+    if (sites == NULL)
+    {
+        error("c64prof_report: malloc failed\n");
+    }
+    size_t siteCount = 0;
+    for (size_t i = 0; i < PROF_SITE_SIZE; i++)
+    {
+        if (prof->sites[i].address != UINT64_MAX)
+        {
+            sites[siteCount++] = &prof->sites[i];
+        }
+    }
+    qsort(sites, siteCount, sizeof(sites[0]), c64prof_byTicks);
+
+    if (prof->format == PROF_REPORT_JSON)
+    {
+        fprintf(file, "{\"unit\":\"%s\",\"instructions\":%llu,\"ticks\":%llu,\"dropped\":%llu,\"opcodes\":[",
+                PROF_TICK_UNIT, (unsigned long long)prof->total, (unsigned long long)prof->ticks,
+                (unsigned long long)prof->dropped);
+        for (size_t i = 0; i < opCount; i++)
+        {
+            fprintf(file, "%s{\"op\":\"%s\",\"count\":%llu,\"ticks\":%llu}", i > 0 ? "," : "",
+                    c64decode_opName(ops[i]), (unsigned long long)prof->opCounts[ops[i]],
+                    (unsigned long long)prof->opTicks[ops[i]]);
+        }
+        fprintf(file, "],\"addresses\":[");
+        for (size_t i = 0; i < siteCount; i++)
+        {
+            fprintf(file, "%s{\"address\":%llu,\"op\":\"%s\",\"count\":%llu,\"ticks\":%llu}", i > 0 ? "," : "",
+                    (unsigned long long)sites[i]->address, c64decode_opName(sites[i]->op),
+                    (unsigned long long)sites[i]->count, (unsigned long long)sites[i]->ticks);
+        }
+        fprintf(file, "],\"regions\":[");
+        for (size_t i = 0; i < prof->regionCount; i++)
+        {
+            const c64profRegion_t *region = &prof->regions[i];
+            uint64_t count;
+            const uint64_t ticks = c64prof_regionTicks(prof, region, &count);
+            fprintf(file, "%s{\"name\":", i > 0 ? "," : "");
+            c64prof_writeString(file, region->name);
+            fprintf(file, ",\"start\":%llu,\"end\":%llu,\"count\":%llu,\"ticks\":%llu}",
+                    (unsigned long long)region->start, (unsigned long long)region->end, (unsigned long long)count,
+                    (unsigned long long)ticks);
+        }
+        fprintf(file, "]}\n");
+        free(sites);
+        return;
+    }
+
+    fprintf(file, "Profile: %llu instructions, %llu %s ticks", (unsigned long long)prof->total,
+            (unsigned long long)prof->ticks, PROF_TICK_UNIT);
+    if (prof->dropped > 0)
+    {
+        fprintf(file, ", %llu at addresses beyond the table", (unsigned long long)prof->dropped);
+    }
+    fprintf(file, "\n\nOpcode         Count      %%     Ticks      %%\n");
+    for (size_t i = 0; i < opCount; i++)
+    {
+        const uint8_t op = ops[i];
+        fprintf(file, "%-10s %9llu %6.2f %9llu %6.2f\n", c64decode_opName(op),
+                (unsigned long long)prof->opCounts[op], c64prof_percent(prof->opCounts[op], prof->total),
+                (unsigned long long)prof->opTicks[op], c64prof_percent(prof->opTicks[op], prof->ticks));
+    }
+
+    fprintf(file, "\nAddress            Opcode         Count     Ticks      %%\n");
+    for (size_t i = 0; i < siteCount && i < PROF_TOP; i++)
+    {
+        fprintf(file, "0x%016llx %-10s %9llu %9llu %6.2f\n", (unsigned long long)sites[i]->address,
+                c64decode_opName(sites[i]->op), (unsigned long long)sites[i]->count,
+                (unsigned long long)sites[i]->ticks, c64prof_percent(sites[i]->ticks, prof->ticks));
+    }
+
+    if (prof->regionCount > 0)
+    {
+        fprintf(file, "\nRegion                               Count     Ticks      %%\n");
+        for (size_t i = 0; i < prof->regionCount; i++)
+        {
+            uint64_t count;
+            const uint64_t ticks = c64prof_regionTicks(prof, &prof->regions[i], &count);
+            fprintf(file, "%-32s %9llu %9llu %6.2f\n", prof->regions[i].name, (unsigned long long)count,
+                    (unsigned long long)ticks, c64prof_percent(ticks, prof->ticks));
+        }
+    }
+    free(sites);
+}
\ No newline at end of file
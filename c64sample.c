@@ -0,0 +1,185 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#include <c64sample.h>
+#include <c64cpu.h>
+#include <string.h>
+
+c64sample_t *c64sample_create(uint8_t mode, uint64_t period)
+{
+    c64sample_t *sampler = malloc(sizeof(c64sample_t));
+    if (sampler == NULL)
+    {
+        error("c64sample_create: malloc failed\n");
+    }
+    sampler->stacks = malloc(sizeof(c64sampleStack_t) * SAMPLE_MAX_STACKS);
+    if (sampler->stacks == NULL)
+    {
+        error("c64sample_create: malloc failed\n");
+    }
+    sampler->mode = mode;
+    sampler->period = period == 0 ? 1 : period;
+    sampler->symbolCount = 0;
+    c64sample_reset(sampler);
+    return sampler;
+}
+
+void c64sample_destroy(c64sample_t *sampler)
+{
+    if (sampler == NULL)
+    {
+        return;
+    }
+    free(sampler->stacks);
+    free(sampler);
+}
+
+void c64sample_reset(c64sample_t *sampler)
+{
+    sampler->next = 0;
+    sampler->samples = 0;
+    sampler->dropped = 0;
+    sampler->stackCount = 0;
+    for (size_t i = 0; i < SAMPLE_TABLE_SIZE; i++)
+    {
+        sampler->table[i] = -1;
+    }
+}
+
+void c64sample_addSymbol(c64sample_t *sampler, const char *name, uint64_t start, uint64_t end)
+{
+    if (sampler->symbolCount == SAMPLE_MAX_SYMBOLS)
+    {
+        warning("c64sample_addSymbol: no room for symbol %s\n", name);
+        return;
+    }
+    c64sampleSymbol_t *symbol = &sampler->symbols[sampler->symbolCount++];
+    snprintf(symbol->name, SAMPLE_NAME_SIZE, "%s", name);
+    symbol->start = start;
+    symbol->end = end;
+}
+
+static const c64sampleSymbol_t *c64sample_findSymbol(c64sample_t *sampler, uint64_t address)
+{
+    for (size_t i = 0; i < sampler->symbolCount; i++)
+    {
+        if (address >= sampler->symbols[i].start && address <= sampler->symbols[i].end)
+        {
+            return &sampler->symbols[i];
+        }
+    }
+    return NULL;
+}
+
+// The first sample is due one period after the sampler is first asked
+static void c64sample_start(c64sample_t *sampler, c64cpu_t *cpu)
+{
+    sampler->next = (sampler->mode == SAMPLE_TIME ? monotonicNs() : cpu->retired) + sampler->period;
+}
+
+uint64_t c64sample_slice(c64sample_t *sampler, c64cpu_t *cpu, uint64_t slice)
+{
+    if (sampler->next == 0)
+    {
+        c64sample_start(sampler, cpu);
+    }
+    if (sampler->mode != SAMPLE_INSTRUCTIONS)
+    {
+        return slice;
+    }
+    const uint64_t left = sampler->next > cpu->retired ? sampler->next - cpu->retired : 1;
+    return left < slice ? left : slice;
+}
+
+// Counts the stack in frames, all of its frames already resolved to symbols
+static void c64sample_record(c64sample_t *sampler, const uint64_t *frames, size_t depth)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < depth; i++)
+    {
+        hash = (hash ^ frames[i]) * 0x100000001b3ull;
+    }
+
+    size_t index = (size_t)(hash >> 32) & (SAMPLE_TABLE_SIZE - 1);
+    while (sampler->table[index] >= 0)
+    {
+        c64sampleStack_t *stack = &sampler->stacks[sampler->table[index]];
+        if (stack->hash == hash && stack->depth == depth && memcmp(stack->frames, frames, depth * sizeof(uint64_t)) == 0)
+        {
+            stack->count++;
+            return;
+        }
+        index = (index + 1) & (SAMPLE_TABLE_SIZE - 1);
+    }
+
+    if (sampler->stackCount == SAMPLE_MAX_STACKS)
+    {
+        sampler->dropped++;
+        return;
+    }
+    c64sampleStack_t *stack = &sampler->stacks[sampler->stackCount];
+    stack->count = 1;
+    stack->hash = hash;
+    stack->depth = depth;
+    memcpy(stack->frames, frames, depth * sizeof(uint64_t));
+    sampler->table[index] = (int32_t)sampler->stackCount++;
+}
+
+void c64sample_check(c64sample_t *sampler, c64cpu_t *cpu)
+{
+    const uint64_t now = sampler->mode == SAMPLE_TIME ? monotonicNs() : cpu->retired;
+    if (now < sampler->next)
+    {
+        return;
+    }
+    sampler->next = now + sampler->period;
+    sampler->samples++;
+
+    uint64_t frames[SAMPLE_MAX_DEPTH];
+    const size_t depth = c64cpu_unwind(cpu, frames, SAMPLE_MAX_DEPTH);
+    for (size_t i = 0; i < depth; i++)
+    {
+        const c64sampleSymbol_t *symbol = c64sample_findSymbol(sampler, frames[i]);
+        if (symbol != NULL)
+        {
+            frames[i] = symbol->start;
+        }
+    }
+    c64sample_record(sampler, frames, depth);
+}
+
+void c64sample_writeFolded(c64sample_t *sampler, FILE *file)
+{
+    for (size_t i = 0; i < sampler->stackCount; i++)
+    {
+        const c64sampleStack_t *stack = &sampler->stacks[i];
+        for (size_t frame = stack->depth; frame-- > 0;)
+        {
+            const c64sampleSymbol_t *symbol = c64sample_findSymbol(sampler, stack->frames[frame]);
+            if (symbol != NULL)
+            {
+                fprintf(file, "%s", symbol->name);
+            }
+            else
+            {
+                fprintf(file, "0x%llx", (unsigned long long)stack->frames[frame]);
+            }
+            fputc(frame > 0 ? ';' : ' ', file);
+        }
+        fprintf(file, "%llu\n", (unsigned long long)stack->count);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,201 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#include <c64smp.h>
+#include <c64utils.h>
+#include <string.h>
+
+c64smp_t *c64smp_create(c64mm_t *mm, size_t count, uint64_t interruptVectorAddress)
+{
+    if (count == 0 || count > SMP_MAX_CPUS)
+    {
+        error("c64smp_create: %zu cpus, between 1 and %d are supported\n", count, SMP_MAX_CPUS);
+    }
+    c64smp_t *smp = (c64smp_t *)malloc(sizeof(c64smp_t));
+    if (smp == NULL)
+    {
+        error("c64smp_create: malloc failed\n");
+    }
+    smp->mm = mm;
+    smp->count = count;
+    smp->stop = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        smp->cores[i].smp = smp;
+        smp->cores[i].cpu = c64cpu_create(mm, interruptVectorAddress);
+        smp->cores[i].thread = NULL;
+        c64cpu_setReg(smp->cores[i].cpu, REG_ACC, i);
+    }
+    return smp;
+}
+
+void c64smp_destroy(c64smp_t *smp)
+{
+    c64smp_stop(smp);
+    for (size_t i = 0; i < smp->count; i++)
+    {
+        c64cpu_destroy(smp->cores[i].cpu);
+    }
+    free(smp);
+}
+
+static void c64smp_run(void *arg)
+{
+    c64smpCore_t *core = (c64smpCore_t *)arg;
+    while (!MM_LOAD(core->smp->stop))
+    {
+        const uint8_t reason = c64cpu_runFor(core->cpu, SMP_QUANTUM);
+        if (reason == RUN_HALTED || reason == RUN_FAULT || reason == RUN_BREAKPOINT)
+        {
+            return;
+        }
+        if (reason == RUN_WAIT)
+        {
+            c64cpu_wait(core->cpu);
+        }
+    }
+}
+
+void c64smp_start(c64smp_t *smp)
+{
+    for (size_t i = 0; i < smp->count; i++)
+    {
+        if (smp->cores[i].thread == NULL)
+        {
+            smp->cores[i].thread = threadStart(c64smp_run, &smp->cores[i]);
+        }
+    }
+}
+
+void c64smp_wait(c64smp_t *smp)
+{
+    for (size_t i = 0; i < smp->count; i++)
+    {
+        if (smp->cores[i].thread != NULL)
+        {
+            threadJoin(smp->cores[i].thread);
+            smp->cores[i].thread = NULL;
+        }
+    }
+}
+
+void c64smp_stop(c64smp_t *smp)
+{
+    MM_STORE(smp->stop, 1);
+    for (size_t i = 0; i < smp->count; i++)
+    {
+        c64cpu_wake(smp->cores[i].cpu);
+    }
+    c64smp_wait(smp);
+    MM_STORE(smp->stop, 0);
+}
+
+void c64smp_sendIPI(c64smp_t *smp, size_t index, uint16_t interrupt)
+{
+    if (index >= smp->count)
+    {
+        warning("c64smp_sendIPI: there is no cpu %zu\n", index);
+        return;
+    }
+    if (interrupt >= 64)
+    {
+        warning("c64smp_sendIPI: there is no interrupt %u\n", (unsigned)interrupt);
+        return;
+    }
+    c64cpu_raiseInterrupt(smp->cores[index].cpu, interrupt);
+}
+
+// The register of a cpu is at its index * 8, narrower accesses address the same register
+static uint64_t c64smp_getPending(c64dev_t *device, uint64_t address)
+{
+    c64smp_t *smp = (c64smp_t *)device->data;
+    const uint64_t index = address / sizeof(uint64_t);
+    return index < smp->count ? MM_LOAD(c64smp_cpu(smp, index)->pending) : 0;
+}
+
+static uint32_t c64smp_getPending32(c64dev_t *device, uint64_t address)
+{
+    return (uint32_t)c64smp_getPending(device, address);
+}
+
+static uint16_t c64smp_getPending16(c64dev_t *device, uint64_t address)
+{
+    return (uint16_t)c64smp_getPending(device, address);
+}
+
+static uint8_t c64smp_getPending8(c64dev_t *device, uint64_t address)
+{
+    return (uint8_t)c64smp_getPending(device, address);
+}
+
+static void c64smp_raise(c64dev_t *device, uint64_t address, uint64_t value)
+{
+    if (value >= 64)
+    {
+        warning("c64smp: IPI with interrupt %llu dropped, interrupts are 0 - 63\n", (unsigned long long)value);
+        return;
+    }
+    c64smp_sendIPI((c64smp_t *)device->data, address / sizeof(uint64_t), (uint16_t)value);
+}
+
+static void c64smp_raise32(c64dev_t *device, uint64_t address, uint32_t value)
+{
+    c64smp_raise(device, address, value);
+}
+
+static void c64smp_raise16(c64dev_t *device, uint64_t address, uint16_t value)
+{
+    c64smp_raise(device, address, value);
+}
+
+static void c64smp_raise8(c64dev_t *device, uint64_t address, uint8_t value)
+{
+    c64smp_raise(device, address, value);
+}
+
+// data is the c64smp_t, which the device does not own
+static void c64smp_destroyIPIDevice(c64dev_t *device)
+{
+    free(device);
+}
+
+c64dev_t *c64smp_createIPIDevice(c64smp_t *smp)
+{
+    c64dev_t *device = malloc(sizeof(c64dev_t));
+    if (device == NULL)
+    {
+        error("c64smp_createIPIDevice: malloc failed\n");
+    }
+    strcpy(device->name, "IPI");
+    device->data = smp;
+    device->dataSize = smp->count * sizeof(uint64_t);
+    device->host = NULL;
+    device->attributes = MM_READ | MM_WRITE | MM_MMIO;
+    device->cpu = c64smp_cpu(smp, 0);
+    device->getUint64 = c64smp_getPending;
+    device->getUint32 = c64smp_getPending32;
+    device->getUint16 = c64smp_getPending16;
+    device->getUint8 = c64smp_getPending8;
+    device->setUint64 = c64smp_raise;
+    device->setUint32 = c64smp_raise32;
+    device->setUint16 = c64smp_raise16;
+    device->setUint8 = c64smp_raise8;
+    device->readBlock = NULL;
+    device->writeBlock = NULL;
+    device->destroy = c64smp_destroyIPIDevice;
+    return device;
+}
\ No newline at end of file
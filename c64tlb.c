@@ -0,0 +1,175 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#include <c64tlb.h>
+
+void c64tlb_init(c64tlb_t *tlb, c64mm_t *mm)
+{
+    tlb->mm = mm;
+    tlb->trace = NULL;
+    c64tlb_flush(tlb);
+}
+
+void c64tlb_flush(c64tlb_t *tlb)
+{
+    tlb->mapGen = MM_LOAD(tlb->mm->mapGen);
+    for (size_t i = 0; i < TLB_SIZE; i++)
+    {
+        tlb->entries[i].readTag = TLB_INVALID;
+        tlb->entries[i].writeTag = TLB_INVALID;
+        tlb->entries[i].addend = 0;
+    }
+}
+
+// Points the entry of address at host memory if its page belongs to a single
+// region with host memory and is not MMIO. Returns the host address of size
+// bytes at address, NULL if the access still has to go through the memory map.
+static uint8_t *c64tlb_fill(c64tlb_t *tlb, uint64_t address, size_t size, uint8_t permission)
+{
+    const uint64_t page = address & ~MM_PAGE_MASK;
+    const c64mmEntry_t *mapping = c64mm_lookup(tlb->mm, address);
+
+    if ((address & MM_PAGE_MASK) > MM_PAGE_SIZE - size)
+    {
+        return NULL;
+    }
+    if (mapping->kind != MM_ENTRY_REGION || (mapping->attributes & MM_MMIO))
+    {
+        return NULL;
+    }
+    const c64mmr_t *region = (const c64mmr_t *)mapping->target;
+    const c64dev_t *device = region->device;
+    const uint64_t offset = region->remap ? page - region->start : page;
+    if (device->host == NULL || offset > device->dataSize || device->dataSize - offset < MM_PAGE_SIZE)
+    {
+        return NULL;
+    }
+
+    c64tlbEntry_t *entry = c64tlb_entry(tlb, address);
+    entry->readTag = mapping->attributes & MM_READ ? page >> MM_PAGE_SHIFT : TLB_INVALID;
+    entry->writeTag = mapping->attributes & MM_WRITE ? page >> MM_PAGE_SHIFT : TLB_INVALID;
+    entry->addend = (uintptr_t)(device->host + offset) - (uintptr_t)page;
+    if (!(mapping->attributes & permission))
+    {
+        return NULL;
+    }
+    return device->host + offset + (address - page);
+}
+
+uint8_t *c64tlb_lookup(c64tlb_t *tlb, uint64_t address, uint8_t permission)
+{
+    if (c64tlb_tracing(tlb))
+    {
+        return NULL;
+    }
+    uint8_t *host = permission == MM_WRITE ? c64tlb_write(tlb, address, 1) : c64tlb_read(tlb, address, 1);
+    return host != NULL ? host : c64tlb_fill(tlb, address, 1, permission);
+}
+
+uint64_t c64tlb_getUint64Slow(c64tlb_t *tlb, uint64_t address)
+{
+    const uint8_t *host = c64tlb_fill(tlb, address, sizeof(uint64_t), MM_READ);
+    uint64_t value;
+    if (host == NULL)
+    {
+        return c64mm_getUint64(tlb->mm, address);
+    }
+    memcpy(&value, host, sizeof(value));
+    return value;
+}
+
+uint32_t c64tlb_getUint32Slow(c64tlb_t *tlb, uint64_t address)
+{
+    const uint8_t *host = c64tlb_fill(tlb, address, sizeof(uint32_t), MM_READ);
+    uint32_t value;
+    if (host == NULL)
+    {
+        return c64mm_getUint32(tlb->mm, address);
+    }
+    memcpy(&value, host, sizeof(value));
+    return value;
+}
+
+uint16_t c64tlb_getUint16Slow(c64tlb_t *tlb, uint64_t address)
+{
+    const uint8_t *host = c64tlb_fill(tlb, address, sizeof(uint16_t), MM_READ);
+    uint16_t value;
+    if (host == NULL)
+    {
+        return c64mm_getUint16(tlb->mm, address);
+    }
+    memcpy(&value, host, sizeof(value));
+    return value;
+}
+
+uint8_t c64tlb_getUint8Slow(c64tlb_t *tlb, uint64_t address)
+{
+    const uint8_t *host = c64tlb_fill(tlb, address, sizeof(uint8_t), MM_READ);
+    if (host == NULL)
+    {
+        return c64mm_getUint8(tlb->mm, address);
+    }
+    return *host;
+}
+
+void c64tlb_setUint64Slow(c64tlb_t *tlb, uint64_t address, uint64_t value)
+{
+    uint8_t *host = c64tlb_fill(tlb, address, sizeof(uint64_t), MM_WRITE);
+    if (host == NULL)
+    {
+        c64mm_setUint64(tlb->mm, address, value);
+        return;
+    }
+    memcpy(host, &value, sizeof(value));
+    c64mm_touch(tlb->mm, address, sizeof(value));
+}
+
+void c64tlb_setUint32Slow(c64tlb_t *tlb, uint64_t address, uint32_t value)
+{
+    uint8_t *host = c64tlb_fill(tlb, address, sizeof(uint32_t), MM_WRITE);
+    if (host == NULL)
+    {
+        c64mm_setUint32(tlb->mm, address, value);
+        return;
+    }
+    memcpy(host, &value, sizeof(value));
+    c64mm_touch(tlb->mm, address, sizeof(value));
+}
+
+void c64tlb_setUint16Slow(c64tlb_t *tlb, uint64_t address, uint16_t value)
+{
+    uint8_t *host = c64tlb_fill(tlb, address, sizeof(uint16_t), MM_WRITE);
+    if (host == NULL)
+    {
+        c64mm_setUint16(tlb->mm, address, value);
+        return;
+    }
+    memcpy(host, &value, sizeof(value));
+    c64mm_touch(tlb->mm, address, sizeof(value));
+}
+
+void c64tlb_setUint8Slow(c64tlb_t *tlb, uint64_t address, uint8_t value)
+{
+    uint8_t *host = c64tlb_fill(tlb, address, sizeof(uint8_t), MM_WRITE);
+    if (host == NULL)
+    {
+        c64mm_setUint8(tlb->mm, address, value);
+        return;
+    }
+    *host = value;
+    c64mm_touch(tlb->mm, address, sizeof(value));
+}
\ No newline at end of file
@@ -0,0 +1,268 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#include <c64trace.h>
+#include <c64decode.h>
+#include <c64utils.h>
+#include <string.h>
+
+#define TRACE_IDLE_NS 1000000 // Sleep of the drain thread while the ring is empty
+#define TRACE_SIZE_EXPLICIT 7
+
+// A record takes at most a tag and three varints of 10 bytes
+#define TRACE_RECORD_MAX 31
+
+static void c64trace_flushBuffer(c64trace_t *trace)
+{
+    fwrite(trace->buffer, 1, trace->used, trace->file);
+    trace->used = 0;
+}
+
+static void c64trace_writeVarint(c64trace_t *trace, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        trace->buffer[trace->used++] = (uint8_t)(value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    trace->buffer[trace->used++] = (uint8_t)value;
+}
+
+static uint64_t c64trace_zigzag(uint64_t delta)
+{
+    return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static uint8_t c64trace_sizeCode(uint32_t size)
+{
+    switch (size)
+    {
+    case 1:
+        return 0;
+    case 2:
+        return 1;
+    case 4:
+        return 2;
+    case 8:
+        return 3;
+    case 16:
+        return 4;
+    }
+    return TRACE_SIZE_EXPLICIT;
+}
+
+static void c64trace_encode(c64trace_t *trace, const c64traceRecord_t *record)
+{
+    const uint8_t sizeCode = c64trace_sizeCode(record->size);
+    if (trace->used > TRACE_BUFFER_SIZE - TRACE_RECORD_MAX)
+    {
+        c64trace_flushBuffer(trace);
+    }
+    trace->buffer[trace->used++] = record->kind | sizeCode << 2;
+    switch (record->kind)
+    {
+    case TRACE_INSN:
+        c64trace_writeVarint(trace, c64trace_zigzag(record->address - trace->lastIp));
+        c64trace_writeVarint(trace, record->value);
+        trace->lastIp = record->address;
+        break;
+    case TRACE_READ:
+    case TRACE_WRITE:
+        c64trace_writeVarint(trace, c64trace_zigzag(record->address - trace->lastAddress));
+        c64trace_writeVarint(trace, record->value);
+        if (sizeCode == TRACE_SIZE_EXPLICIT)
+        {
+            c64trace_writeVarint(trace, record->size);
+        }
+        trace->lastAddress = record->address;
+        break;
+    default:
+        c64trace_writeVarint(trace, record->value);
+        break;
+    }
+}
+
+// Writes out everything up to head, returns whether there was anything
+static char c64trace_drain(c64trace_t *trace)
+{
+    const uint64_t head = TRACE_LOAD(trace->head);
+    uint64_t tail = trace->tail;
+    if (tail == head)
+    {
+        return 0;
+    }
+    while (tail != head)
+    {
+        c64trace_encode(trace, &trace->ring[tail & (TRACE_RING_SIZE - 1)]);
+        tail++;
+        // Hand back room early so the cpu drops less on a long backlog
+        if ((tail & 1023) == 0)
+        {
+            TRACE_STORE(trace->tail, tail);
+        }
+    }
+    TRACE_STORE(trace->tail, tail);
+    return 1;
+}
+
+static void c64trace_run(c64trace_t *trace)
+{
+    while (1)
+    {
+        // stop is read before draining, the records from before it are in the ring by then
+        const uint64_t stop = TRACE_LOAD(trace->stop);
+        if (!c64trace_drain(trace))
+        {
+            if (stop)
+            {
+                break;
+            }
+            c64trace_flushBuffer(trace);
+            sleepNs(TRACE_IDLE_NS);
+        }
+    }
+    c64trace_flushBuffer(trace);
+    fflush(trace->file);
+}
+
+static void c64trace_thread(void *trace)
+{
+    c64trace_run(trace);
+}
+
+c64trace_t *c64trace_create(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        warning("c64trace_create: cannot open %s\n", path);
+        return NULL;
+    }
+    c64trace_t *trace = malloc(sizeof(c64trace_t));
+    if (trace == NULL)
+    {
+        error("c64trace_create: malloc failed\n");
+    }
+    trace->head = 0;
+    trace->tail = 0;
+    trace->lost = 0;
+    trace->cpu = NULL;
+    trace->stop = 0;
+    trace->file = file;
+    trace->lastIp = 0;
+    trace->lastAddress = 0;
+    trace->used = 0;
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), file);
+
+    trace->thread = threadStart(c64trace_thread, trace);
+    return trace;
+}
+
+void c64trace_destroy(c64trace_t *trace)
+{
+    if (trace == NULL)
+    {
+        return;
+    }
+    if (trace->lost > 0)
+    {
+        // The thread is still draining, so there is room for this eventually
+        while (!c64trace_push(trace, TRACE_LOST, 0, 0, trace->lost))
+        {
+            sleepNs(TRACE_IDLE_NS);
+        }
+    }
+    TRACE_STORE(trace->stop, 1);
+    threadJoin(trace->thread);
+    fclose(trace->file);
+    free(trace);
+}
+
+static int c64trace_readVarint(FILE *in, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        const int byte = fgetc(in);
+        if (byte == EOF)
+        {
+            return -1;
+        }
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static uint64_t c64trace_unzigzag(uint64_t value)
+{
+    return (value >> 1) ^ (uint64_t)-(int64_t)(value & 1);
+}
+
+int c64trace_decode(FILE *in, FILE *out)
+{
+    static const uint32_t sizes[] = {1, 2, 4, 8, 16};
+    char magic[sizeof(TRACE_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+    {
+        return -1;
+    }
+
+    uint64_t ip = 0;
+    uint64_t address = 0;
+    int tag;
+    while ((tag = fgetc(in)) != EOF)
+    {
+        const uint8_t kind = tag & 3;
+        const uint8_t sizeCode = (tag >> 2) & 7;
+        uint64_t delta;
+        uint64_t value;
+        uint64_t size = sizeCode < 5 ? sizes[sizeCode] : 0;
+
+        if (kind == TRACE_LOST)
+        {
+            if (c64trace_readVarint(in, &value) != 0)
+            {
+                return -1;
+            }
+            fprintf(out, "# %llu records lost\n", (unsigned long long)value);
+            continue;
+        }
+        if (c64trace_readVarint(in, &delta) != 0 || c64trace_readVarint(in, &value) != 0)
+        {
+            return -1;
+        }
+        if (kind == TRACE_INSN)
+        {
+            ip += c64trace_unzigzag(delta);
+            fprintf(out, "I 0x%016llx %04llx %s\n", (unsigned long long)ip, (unsigned long long)value,
+                    c64decode_opName(c64decode_op((uint16_t)value)));
+            continue;
+        }
+        if (sizeCode == TRACE_SIZE_EXPLICIT && c64trace_readVarint(in, &size) != 0)
+        {
+            return -1;
+        }
+        address += c64trace_unzigzag(delta);
+        fprintf(out, "%c 0x%016llx %llu 0x%llx\n", kind == TRACE_READ ? 'R' : 'W', (unsigned long long)address,
+                (unsigned long long)size, (unsigned long long)value);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#include <c64trace.h>
+#include <c64utils.h>
+
+// Turns a file written by c64trace into text
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        out("Usage: c64tracedump <trace> [output]");
+        return EXIT_FAILURE;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+        error("c64tracedump: cannot open %s\n", argv[1]);
+    }
+    FILE *output = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (output == NULL)
+    {
+        error("c64tracedump: cannot open %s\n", argv[2]);
+    }
+    if (c64trace_decode(in, output) != 0)
+    {
+        error("c64tracedump: %s is not a trace or is cut off\n", argv[1]);
+    }
+    fclose(in);
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+    return 0;
+}
\ No newline at end of file
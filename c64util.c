@@ -15,6 +15,12 @@ See the MIT License for more details.
 You should have received a copy of the MIT License
 along with c64vm. If not, see <https://mit-license.org/>.
 */
+// clock_gettime, nanosleep and pthreads are POSIX, not C99
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <pthread.h>
+#endif
 #include <c64utils.h>
 
 void error(const char *msg, ...)
@@ -87,4 +93,185 @@ void out(const char *msg, ...)
     printf("\n");
 
     va_end(args);
+}
+
+uint64_t monotonicNs()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 +
+           (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+#endif
+}
+
+void sleepNs(uint64_t ns)
+{
+#ifdef _WIN32
+    Sleep((DWORD)(ns / 1000000));
+#else
+    struct timespec duration;
+    duration.tv_sec = ns / 1000000000;
+    duration.tv_nsec = ns % 1000000000;
+    nanosleep(&duration, NULL);
+#endif
+}
+
+typedef struct
+{
+    void (*run)(void *);
+    void *arg;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t thread;
+#endif
+} c64thread_t;
+
+#ifdef _WIN32
+static DWORD WINAPI threadMain(LPVOID thread)
+{
+    ((c64thread_t *)thread)->run(((c64thread_t *)thread)->arg);
+    return 0;
+}
+#else
+static void *threadMain(void *thread)
+{
+    ((c64thread_t *)thread)->run(((c64thread_t *)thread)->arg);
+    return NULL;
+}
+#endif
+
+void *threadStart(void (*run)(void *), void *arg)
+{
+    c64thread_t *thread = malloc(sizeof(c64thread_t));
+    if (thread == NULL)
+    {
+        error("threadStart: malloc failed\n");
+    }
+    thread->run = run;
+    thread->arg = arg;
+#ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, threadMain, thread, 0, NULL);
+    if (thread->handle == NULL)
+    {
+        error("threadStart: cannot start a thread\n");
+    }
+#else
+    if (pthread_create(&thread->thread, NULL, threadMain, thread) != 0)
+    {
+        error("threadStart: cannot start a thread\n");
+    }
+#endif
+    return thread;
+}
+
+void threadJoin(void *thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(((c64thread_t *)thread)->handle, INFINITE);
+    CloseHandle(((c64thread_t *)thread)->handle);
+#else
+    pthread_join(((c64thread_t *)thread)->thread, NULL);
+#endif
+    free(thread);
+}
+
+void *mutexCreate()
+{
+#ifdef _WIN32
+    CRITICAL_SECTION *mutex = malloc(sizeof(CRITICAL_SECTION));
+    if (mutex == NULL)
+    {
+        error("mutexCreate: malloc failed\n");
+    }
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_t *mutex = malloc(sizeof(pthread_mutex_t));
+    if (mutex == NULL || pthread_mutex_init(mutex, NULL) != 0)
+    {
+        error("mutexCreate: cannot create a mutex\n");
+    }
+#endif
+    return mutex;
+}
+
+void mutexLock(void *mutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+void mutexUnlock(void *mutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+void mutexDestroy(void *mutex)
+{
+#ifdef _WIN32
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+    free(mutex);
+}
+
+void *condCreate()
+{
+#ifdef _WIN32
+    CONDITION_VARIABLE *cond = malloc(sizeof(CONDITION_VARIABLE));
+    if (cond == NULL)
+    {
+        error("condCreate: malloc failed\n");
+    }
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_t *cond = malloc(sizeof(pthread_cond_t));
+    if (cond == NULL || pthread_cond_init(cond, NULL) != 0)
+    {
+        error("condCreate: cannot create a condition variable\n");
+    }
+#endif
+    return cond;
+}
+
+void condWait(void *cond, void *mutex)
+{
+#ifdef _WIN32
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+void condSignal(void *cond)
+{
+#ifdef _WIN32
+    WakeConditionVariable(cond);
+#else
+    pthread_cond_signal(cond);
+#endif
+}
+
+void condDestroy(void *cond)
+{
+#ifdef _WIN32
+    (void)cond;
+#else
+    pthread_cond_destroy(cond);
+#endif
+    free(cond);
 }
\ No newline at end of file
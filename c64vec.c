@@ -0,0 +1,372 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#include <c64vec.h>
+
+// Host SIMD where the compiler targets it, the lane loops below cover the rest
+#if defined(__SSE2__)
+#define C64VEC_SSE2 1
+#include <emmintrin.h>
+#else
+#define C64VEC_SSE2 0
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+// a = op(a, b) on every lane, operands are widened to 64 bit first
+#define C64VEC_LANES(a, b, lane, op)                                              \
+    do                                                                            \
+    {                                                                             \
+        switch (lane)                                                             \
+        {                                                                         \
+        case 1:                                                                   \
+            for (size_t i = 0; i < VREG_SIZE; i++)                                \
+                (a)->u8[i] = (uint8_t)op((uint64_t)(a)->u8[i], (b)->u8[i]);       \
+            break;                                                                \
+        case 2:                                                                   \
+            for (size_t i = 0; i < VREG_SIZE / 2; i++)                            \
+                (a)->u16[i] = (uint16_t)op((uint64_t)(a)->u16[i], (b)->u16[i]);   \
+            break;                                                                \
+        case 4:                                                                   \
+            for (size_t i = 0; i < VREG_SIZE / 4; i++)                            \
+                (a)->u32[i] = (uint32_t)op((uint64_t)(a)->u32[i], (b)->u32[i]);   \
+            break;                                                                \
+        default:                                                                  \
+            for (size_t i = 0; i < VREG_SIZE / 8; i++)                            \
+                (a)->u64[i] = op((uint64_t)(a)->u64[i], (b)->u64[i]);             \
+            break;                                                                \
+        }                                                                         \
+    } while (0)
+
+#define C64VEC_ADD(x, y) ((x) + (y))
+#define C64VEC_SUB(x, y) ((x) - (y))
+#define C64VEC_MUL(x, y) ((x) * (y))
+#define C64VEC_MIN(x, y) ((x) < (y) ? (x) : (y))
+#define C64VEC_MAX(x, y) ((x) > (y) ? (x) : (y))
+#define C64VEC_CMPEQ(x, y) ((x) == (y) ? UINT64_MAX : 0)
+#define C64VEC_CMPGT(x, y) ((x) > (y) ? UINT64_MAX : 0)
+
+#if C64VEC_SSE2
+static inline __m128i c64vec_load(const c64vec_t *v)
+{
+    return _mm_loadu_si128((const __m128i *)v);
+}
+
+static inline void c64vec_store(c64vec_t *v, __m128i x)
+{
+    _mm_storeu_si128((__m128i *)v, x);
+}
+
+// Flips the sign bit of every lane, so signed compares order lanes as unsigned
+static inline __m128i c64vec_bias(__m128i x, uint8_t lane)
+{
+    switch (lane)
+    {
+    case 1:
+        return _mm_xor_si128(x, _mm_set1_epi8((char)0x80));
+    case 2:
+        return _mm_xor_si128(x, _mm_set1_epi16((short)0x8000));
+    default:
+        return _mm_xor_si128(x, _mm_set1_epi32((int)0x80000000));
+    }
+}
+#endif
+
+void c64vec_add(c64vec_t *a, const c64vec_t *b, uint8_t lane)
+{
+#if C64VEC_SSE2
+    const __m128i x = c64vec_load(a);
+    const __m128i y = c64vec_load(b);
+    switch (lane)
+    {
+    case 1:
+        c64vec_store(a, _mm_add_epi8(x, y));
+        return;
+    case 2:
+        c64vec_store(a, _mm_add_epi16(x, y));
+        return;
+    case 4:
+        c64vec_store(a, _mm_add_epi32(x, y));
+        return;
+    default:
+        c64vec_store(a, _mm_add_epi64(x, y));
+        return;
+    }
+#endif
+    C64VEC_LANES(a, b, lane, C64VEC_ADD);
+}
+
+void c64vec_sub(c64vec_t *a, const c64vec_t *b, uint8_t lane)
+{
+#if C64VEC_SSE2
+    const __m128i x = c64vec_load(a);
+    const __m128i y = c64vec_load(b);
+    switch (lane)
+    {
+    case 1:
+        c64vec_store(a, _mm_sub_epi8(x, y));
+        return;
+    case 2:
+        c64vec_store(a, _mm_sub_epi16(x, y));
+        return;
+    case 4:
+        c64vec_store(a, _mm_sub_epi32(x, y));
+        return;
+    default:
+        c64vec_store(a, _mm_sub_epi64(x, y));
+        return;
+    }
+#endif
+    C64VEC_LANES(a, b, lane, C64VEC_SUB);
+}
+
+void c64vec_mul(c64vec_t *a, const c64vec_t *b, uint8_t lane)
+{
+#if C64VEC_SSE2
+    if (lane == 2)
+    {
+        c64vec_store(a, _mm_mullo_epi16(c64vec_load(a), c64vec_load(b)));
+        return;
+    }
+#endif
+#if defined(__SSE4_1__)
+    if (lane == 4)
+    {
+        c64vec_store(a, _mm_mullo_epi32(c64vec_load(a), c64vec_load(b)));
+        return;
+    }
+#endif
+    C64VEC_LANES(a, b, lane, C64VEC_MUL);
+}
+
+void c64vec_min(c64vec_t *a, const c64vec_t *b, uint8_t lane)
+{
+#if C64VEC_SSE2
+    if (lane == 1)
+    {
+        c64vec_store(a, _mm_min_epu8(c64vec_load(a), c64vec_load(b)));
+        return;
+    }
+#endif
+#if defined(__SSE4_1__)
+    if (lane == 2)
+    {
+        c64vec_store(a, _mm_min_epu16(c64vec_load(a), c64vec_load(b)));
+        return;
+    }
+    if (lane == 4)
+    {
+        c64vec_store(a, _mm_min_epu32(c64vec_load(a), c64vec_load(b)));
+        return;
+    }
+#endif
+    C64VEC_LANES(a, b, lane, C64VEC_MIN);
+}
+
+void c64vec_max(c64vec_t *a, const c64vec_t *b, uint8_t lane)
+{
+#if C64VEC_SSE2
+    if (lane == 1)
+    {
+        c64vec_store(a, _mm_max_epu8(c64vec_load(a), c64vec_load(b)));
+        return;
+    }
+#endif
+#if defined(__SSE4_1__)
+    if (lane == 2)
+    {
+        c64vec_store(a, _mm_max_epu16(c64vec_load(a), c64vec_load(b)));
+        return;
+    }
+    if (lane == 4)
+    {
+        c64vec_store(a, _mm_max_epu32(c64vec_load(a), c64vec_load(b)));
+        return;
+    }
+#endif
+    C64VEC_LANES(a, b, lane, C64VEC_MAX);
+}
+
+void c64vec_cmpeq(c64vec_t *a, const c64vec_t *b, uint8_t lane)
+{
+#if C64VEC_SSE2
+    const __m128i x = c64vec_load(a);
+    const __m128i y = c64vec_load(b);
+    switch (lane)
+    {
+    case 1:
+        c64vec_store(a, _mm_cmpeq_epi8(x, y));
+        return;
+    case 2:
+        c64vec_store(a, _mm_cmpeq_epi16(x, y));
+        return;
+    case 4:
+        c64vec_store(a, _mm_cmpeq_epi32(x, y));
+        return;
+    }
+#endif
+    C64VEC_LANES(a, b, lane, C64VEC_CMPEQ);
+}
+
+void c64vec_cmpgt(c64vec_t *a, const c64vec_t *b, uint8_t lane)
+{
+#if C64VEC_SSE2
+    const __m128i x = c64vec_bias(c64vec_load(a), lane);
+    const __m128i y = c64vec_bias(c64vec_load(b), lane);
+    switch (lane)
+    {
+    case 1:
+        c64vec_store(a, _mm_cmpgt_epi8(x, y));
+        return;
+    case 2:
+        c64vec_store(a, _mm_cmpgt_epi16(x, y));
+        return;
+    case 4:
+        c64vec_store(a, _mm_cmpgt_epi32(x, y));
+        return;
+    }
+#endif
+    C64VEC_LANES(a, b, lane, C64VEC_CMPGT);
+}
+
+void c64vec_and(c64vec_t *a, const c64vec_t *b)
+{
+    a->u64[0] &= b->u64[0];
+    a->u64[1] &= b->u64[1];
+}
+
+void c64vec_or(c64vec_t *a, const c64vec_t *b)
+{
+    a->u64[0] |= b->u64[0];
+    a->u64[1] |= b->u64[1];
+}
+
+void c64vec_xor(c64vec_t *a, const c64vec_t *b)
+{
+    a->u64[0] ^= b->u64[0];
+    a->u64[1] ^= b->u64[1];
+}
+
+void c64vec_shuffle(c64vec_t *a, const c64vec_t *b)
+{
+#if defined(__SSSE3__)
+    c64vec_store(a, _mm_shuffle_epi8(c64vec_load(a), c64vec_load(b)));
+#else
+    const c64vec_t source = *a;
+    for (size_t i = 0; i < VREG_SIZE; i++)
+    {
+        const uint8_t index = b->u8[i];
+        a->u8[i] = index & 0x80 ? 0 : source.u8[index & (VREG_SIZE - 1)];
+    }
+#endif
+}
+
+void c64vec_splat(c64vec_t *a, uint64_t value, uint8_t lane)
+{
+    for (size_t i = 0; i < VREG_SIZE / lane; i++)
+    {
+        switch (lane)
+        {
+        case 1:
+            a->u8[i] = (uint8_t)value;
+            break;
+        case 2:
+            a->u16[i] = (uint16_t)value;
+            break;
+        case 4:
+            a->u32[i] = (uint32_t)value;
+            break;
+        default:
+            a->u64[i] = value;
+            break;
+        }
+    }
+}
+
+// Lane i of a widened to 64 bit
+static inline uint64_t c64vec_lane(const c64vec_t *a, size_t i, uint8_t lane)
+{
+    switch (lane)
+    {
+    case 1:
+        return a->u8[i];
+    case 2:
+        return a->u16[i];
+    case 4:
+        return a->u32[i];
+    default:
+        return a->u64[i];
+    }
+}
+
+uint64_t c64vec_reduceAdd(const c64vec_t *a, uint8_t lane)
+{
+#if C64VEC_SSE2
+    if (lane == 1)
+    {
+        // Sums of absolute differences to zero add up the bytes of each half
+        const __m128i sums = _mm_sad_epu8(c64vec_load(a), _mm_setzero_si128());
+        return (uint64_t)_mm_cvtsi128_si32(sums) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+#endif
+    uint64_t sum = 0;
+    for (size_t i = 0; i < VREG_SIZE / lane; i++)
+    {
+        sum += c64vec_lane(a, i, lane);
+    }
+    return sum;
+}
+
+uint64_t c64vec_reduceMin(const c64vec_t *a, uint8_t lane)
+{
+    uint64_t min = c64vec_lane(a, 0, lane);
+    for (size_t i = 1; i < VREG_SIZE / lane; i++)
+    {
+        const uint64_t value = c64vec_lane(a, i, lane);
+        min = value < min ? value : min;
+    }
+    return min;
+}
+
+uint64_t c64vec_reduceMax(const c64vec_t *a, uint8_t lane)
+{
+    uint64_t max = c64vec_lane(a, 0, lane);
+    for (size_t i = 1; i < VREG_SIZE / lane; i++)
+    {
+        const uint64_t value = c64vec_lane(a, i, lane);
+        max = value > max ? value : max;
+    }
+    return max;
+}
+
+uint64_t c64vec_mask(const c64vec_t *a)
+{
+#if C64VEC_SSE2
+    return (uint64_t)(uint16_t)_mm_movemask_epi8(c64vec_load(a));
+#else
+    uint64_t mask = 0;
+    for (size_t i = 0; i < VREG_SIZE; i++)
+    {
+        mask |= (uint64_t)(a->u8[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
\ No newline at end of file
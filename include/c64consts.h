@@ -24,6 +24,16 @@ along with c64vm. If not, see <https://mit-license.org/>.
 #define FLAG_OVERFLOW 0x08
 #define FLAG_INTERRUPT 0x10
 
+#define LAZY_FLAGS 1 // 1 = C/Z/N/V are computed when read, 0 = after every instruction
+
+#ifndef C64_PROFILE
+#define C64_PROFILE 0 // 1 = the engines can run under a profiler, see c64cpu_setProfiler
+#endif
+
+#ifndef C64_TRACE
+#define C64_TRACE 0 // 1 = instructions and memory accesses can be traced, see c64cpu_setTracer
+#endif
+
 #define LOG_NONE 0
 #define LOG_ERROR 1
 #define LOG_WARN 2
@@ -49,13 +59,47 @@ along with c64vm. If not, see <https://mit-license.org/>.
 #define REG_MB 12
 #define REG_IM 13
 
+#define VREG_COUNT 16 // vector registers v0 - v15
+#define VREG_SIZE 16  // bytes per vector register
+
+#define ENGINE_SWITCH 0   // one switch over all opcodes per instruction
+#define ENGINE_THREADED 1 // threaded dispatch over decoded instructions
+#define ENGINE_JIT 2      // translated x86-64 blocks, interpreter for the rest
+
+// Why c64cpu_runFor returned
+#define RUN_BUDGET 0     // the budget is used up
+#define RUN_HALTED 1     // HLT was executed
+#define RUN_BREAKPOINT 2 // IP is at a breakpoint, the instruction has not run yet
+#define RUN_FAULT 3      // IP is at the faulting instruction, see cpu->fault
+#define RUN_INTERRUPT 4  // a raised interrupt can be entered, done by the next c64cpu_runFor
+#define RUN_WAIT 5       // WAITADDR found its value, IP is past it, see c64cpu_wait
+
+#define FAULT_NONE 0
+#define FAULT_INVALID_OPCODE 1
+#define FAULT_DIVIDE 2  // division by zero or signed overflow
+#define FAULT_EXECUTE 3 // IP on a page that is not mapped executable
+#define FAULT_STACK 4   // a push or pop would leave the bounds set by c64cpu_setStack
+
 #define MEMORY_SIZE 65536
-#define c64cpu_speed 1000000
+#define c64cpu_speed 1000000     // default rate of c64cpu_run in instructions per second
+#define c64cpu_quantumNs 1000000 // c64cpu_run checks the clock once per millisecond of guest time
+#define c64cpu_maxLagNs 50000000 // falling further behind than this drops the backlog instead of catching up
+#define c64cpu_sliceSize 4096    // c64cpu_runFor looks for raised interrupts at least this often
+#define c64cpu_maxBreakpoints 16
+#define c64cpu_blockChunk 65536  // Bytes a memory block instruction handles before it is restarted
+#define c64cpu_stateWords 10     // Words c64cpu_pushState pushes for CALL and interrupts
 
 // Forward declarations
 typedef struct c64cpu c64cpu_t;
 typedef struct MemoryMap c64mm_t;
 typedef struct MemoryMapRegion c64mmr_t;
 typedef struct DeviceDriver c64dev_t;
+typedef struct c64insn c64insn_t;
+typedef struct c64jit c64jit_t;
+typedef struct c64tlb c64tlb_t;
+typedef struct c64prof c64prof_t;
+typedef struct c64sample c64sample_t;
+typedef struct c64trace c64trace_t;
+typedef struct c64smp c64smp_t;
 
 #endif // _c64consts_h_
\ No newline at end of file
@@ -22,32 +22,106 @@ along with c64vm. If not, see <https://mit-license.org/>.
 #include <c64utils.h>
 #include <c64mem.h>
 #include <c64instructions.h>
+#include <c64decode.h>
+#include <c64jit.h>
+#include <c64tlb.h>
+#include <c64vec.h>
+#include <c64prof.h>
+#include <c64sample.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
 
+// How the last ALU instruction sets the flags. With LAZY_FLAGS the operands
+// are recorded and the flags computed once something reads them.
+#define FLAGS_NONE 0  // nothing pending, cpu->flags is up to date
+#define FLAGS_LOGIC 1 // Z, N
+#define FLAGS_ADD 2   // C = V = result < previous, Z, N
+#define FLAGS_SUB 3   // C = V = result > previous, Z, N
+#define FLAGS_MULS 4  // FLAGS_ADD with a signed compare
+#define FLAGS_DIVS 5  // FLAGS_SUB with a signed compare
+#define FLAGS_SHL 6   // C = result < previous, Z, N
+#define FLAGS_SHR 7   // C = result > previous, Z, N
+#define FLAGS_CMP 8   // same as FLAGS_SHR
+#define FLAGS_COUNT 9
+
 struct c64cpu
 {
     c64mm_t *mm;
-    c64dev_t *registers;
+    uint64_t regs[REG_COUNT];
+    c64vec_t vregs[VREG_COUNT]; // not part of the state pushed on interrupts
+    c64tlb_t tlb; // loads, stores and stack accesses go through it
     char flags;
+    uint8_t flagsKind; // FLAGS_* update pending on top of flags
+    uint64_t flagsPrevious;
+    uint64_t flagsResult;
     char *regNames[REG_COUNT];
     size_t stackFrameSize;
+    uint64_t leafReturn; // where the innermost CALLM left its return address, 0 after its RETM
+    // The stack window: guest addresses stackLow to stackLow + stackSize - 1,
+    // backed by host memory at stackHost. Found around SP and looked for again
+    // once SP leaves it or the memory map changes.
+    uint8_t *stackHost;
+    uint64_t stackLow;
+    uint64_t stackSize; // 0 if SP is not in host memory
+    uint32_t stackGen;  // mm->mapGen the window was found at
+    // Bounds set by c64cpu_setStack, inclusive
+    char stackBounded;
+    uint64_t stackBottom;
+    uint64_t stackTop;
     uint64_t interruptVectorAddress;
+    char engine;
+    c64insn_t icache[ICACHE_SIZE];
+    uint64_t rate;          // instructions per second for c64cpu_run, 0 = unthrottled
+    uint64_t throttleStart; // monotonicNs() when the current rate took effect
+    uint64_t throttleCount; // instructions run at that rate since
+    uint64_t retired;       // instructions run so far
+    uint8_t stop;           // RUN_* reason the engines stopped for, RUN_BUDGET while running
+    uint8_t fault;          // FAULT_* of the last RUN_FAULT
+    uint64_t pending;       // interrupts raised by c64cpu_raiseInterrupt, by bit, set from any thread
+    // Parking by WAITADDR, guarded by mm->waitLock, see c64cpu_wait
+    uint64_t waitAddress;
+    uint64_t waitValue;
+    uint8_t waitWidth;
+    char woken;           // set by a wake, the next c64cpu_wait returns at once
+    uint64_t parked;      // 1 while in c64cpu_wait, read without the lock by c64cpu_raiseInterrupt
+    void *waitCond;       // signalled to wake the cpu, see condCreate
+    c64cpu_t *waitNext;   // next cpu in mm->waiters
+    uint64_t breakpoints[c64cpu_maxBreakpoints];
+    size_t breakpointCount;
+    c64jit_t *jit;          // created by c64cpu_setEngine(cpu, ENGINE_JIT)
+    uint64_t jitFuel;       // instructions translated code may still retire
+    uint8_t *jitLastExit;   // block exit to link to the next block, see c64jit_run
+    c64prof_t *prof;        // set by c64cpu_setProfiler, NULL when not profiling
+    c64sample_t *sampler;   // set by c64cpu_setSampler, NULL when not sampling
 };
 
+// Several cpus can be created on one memory map, the last one destroyed destroys it
 c64cpu_t *c64cpu_create(c64mm_t *mm, uint64_t interruptVectorAddress);
-c64dev_t *c64cpu_createRegisters(c64cpu_t *cpu);
 void c64cpu_destroy(c64cpu_t *cpu);
 
-uint64_t c64cpu_mapRegisterToOffset(c64cpu_t *cpu, char *regName);
+// Register access by REG_* index, used on the hot path
+static inline uint64_t c64cpu_getReg(c64cpu_t *cpu, size_t index)
+{
+    return cpu->regs[index];
+}
+
+static inline void c64cpu_setReg(c64cpu_t *cpu, size_t index, uint64_t value)
+{
+    cpu->regs[index] = value;
+}
+
+// Register access by name ("IP", "R1", ...), slow path for debuggers
 size_t _c16cpu_getRegisterIndex(c64cpu_t *cpu, char *regName);
 uint64_t c64cpu_getRegister(c64cpu_t *cpu, char *regName);
 void c64cpu_setRegister(c64cpu_t *cpu, char *regName, uint64_t value);
 
 // Sets or clears a flag
-void c64cpu_setFlag(c64cpu_t *cpu, char value, char flag);
+void c64cpu_setFlag(c64cpu_t *cpu, char flag, char value);
 char c64cpu_getFlag(c64cpu_t *cpu, char flag);
+// Applies a pending lazy flag update to cpu->flags.
+// Needed before reading cpu->flags directly.
+void c64cpu_materializeFlags(c64cpu_t *cpu);
 
 uint8_t c64cpu_fetch(c64cpu_t *cpu);
 uint16_t c64cpu_fetch16(c64cpu_t *cpu);
@@ -66,17 +140,93 @@ uint8_t c64cpu_pop8(c64cpu_t *cpu);
 void c64cpu_pushState(c64cpu_t *cpu);
 void c64cpu_popState(c64cpu_t *cpu);
 
+// Confines the stack to bottom - top. Instructions whose pushes or pops would
+// leave it fault with FAULT_STACK before they touch memory, instead of
+// overwriting whatever is mapped next to the stack. bottom > top removes the bounds.
+void c64cpu_setStack(c64cpu_t *cpu, uint64_t bottom, uint64_t top);
+// Writes the guest call chain to frames, innermost first: IP, then the return
+// address of every frame c64cpu_pushState left on the stack. Follows FP until
+// max frames, a frame outside host memory or the stack bounds, or one that does
+// not point further up. CALLM leaves have no frame of their own, the return
+// address of the innermost one is listed where it sits between the frames.
+// Once a nested CALLM returns, the outer leaf's caller is missing until the
+// outer one returns too. Returns the number of frames written.
+size_t c64cpu_unwind(c64cpu_t *cpu, uint64_t *frames, size_t max);
+
 size_t c64cpu_fetchRegisterIndex(c64cpu_t *cpu);
 
 void c64cpu_handleInterrupt(c64cpu_t *cpu, uint16_t interrupt);
-
+// Marks an interrupt (0 - 63) as pending. It is entered by c64cpu_runFor once
+// the interrupt flag is clear and its bit in IM is set, and stays pending
+// until then. c64cpu_runFor returns RUN_INTERRUPT to get there.
+void c64cpu_raiseInterrupt(c64cpu_t *cpu, uint16_t interrupt);
+
+// Parks the calling thread after c64cpu_runFor returned RUN_WAIT, until
+// WAKEADDR on the address the cpu waits for, an interrupt it can enter or
+// c64cpu_wake. Returns at once if the value changed in the meantime, and
+// may return for no reason at all. Only parks on aligned host memory.
+void c64cpu_wait(c64cpu_t *cpu);
+// Wakes the cpu from c64cpu_wait, from any thread. If it is not parked
+// its next c64cpu_wait returns at once.
+void c64cpu_wake(c64cpu_t *cpu);
+
+void c64cpu_decodeMiss(c64cpu_t *cpu, c64insn_t *insn, uint64_t address);
+
+// Returns the decoded instruction at address, decoding it on a cache miss
+static inline const c64insn_t *c64cpu_decodeAt(c64cpu_t *cpu, uint64_t address)
+{
+    c64insn_t *insn = &cpu->icache[address & (ICACHE_SIZE - 1)];
+    if (insn->address != address || insn->gen != c64mm_getWriteGen(cpu->mm, address))
+    {
+        c64cpu_decodeMiss(cpu, insn, address);
+    }
+    return insn;
+}
+
+uint16_t c64cpu_executeInstruction(c64cpu_t *cpu, const c64insn_t *insn);
 uint16_t c64cpu_execute(c64cpu_t *cpu, uint16_t opcode);
 void c64cpu_run(c64cpu_t *cpu, char debug);
+// Runs at most budget instructions with the selected engine and returns
+// the RUN_* reason it stopped for. cpu->retired counts what ran. Calling it
+// again after RUN_BREAKPOINT runs the instruction under the breakpoint.
+uint8_t c64cpu_runFor(c64cpu_t *cpu, uint64_t budget);
+// Instructions per second c64cpu_run aims for, 0 runs as fast as the host allows.
+// Takes effect at the next quantum, defaults to c64cpu_speed.
+void c64cpu_setRate(c64cpu_t *cpu, uint64_t rate);
+uint64_t c64cpu_getRate(c64cpu_t *cpu);
 
 void c64cpu_debug(c64cpu_t *cpu);
 void c64cpu_viewMemoryAt(c64cpu_t *cpu, uint64_t address, size_t size);
 void c64cpu_viewMemoryAtWithHighlightedByte(c64cpu_t *cpu, uint64_t address, size_t size, uint64_t highlightedByteAddress);
+// Runs the instruction at IP on its own, also one under a breakpoint, and
+// returns its opcode. Faults are reported and exit like in c64cpu_run.
+// cpu->stop is reset first, so afterwards it is RUN_HALTED after HLT,
+// RUN_WAIT after a WAITADDR that found its value and RUN_BUDGET otherwise.
 uint16_t c64cpu_step(c64cpu_t *cpu);
+// Executes up to count instructions with the selected engine, stops after HLT
+// and in front of breakpoints and faults. Returns HLT once halted, NOP otherwise.
+uint16_t c64cpu_stepMany(c64cpu_t *cpu, uint64_t count);
+void c64cpu_setEngine(c64cpu_t *cpu, char engine);
+// Counts everything run from now on in prof, NULL stops profiling. While
+// attached the instructions run in a profiling copy of ENGINE_SWITCH, whatever
+// the engine. c64cpu_run writes the report once the guest halts. Needs
+// C64_PROFILE, the engines are left alone without it.
+void c64cpu_setProfiler(c64cpu_t *cpu, c64prof_t *prof);
+// Lets sampler take samples from now on, NULL stops sampling. Unlike the
+// profiler it works with every engine and needs no special build.
+void c64cpu_setSampler(c64cpu_t *cpu, c64sample_t *sampler);
+// Records every instruction and memory access from now on in trace, NULL
+// stops tracing. Like the profiler it runs everything on a copy of
+// ENGINE_SWITCH and needs C64_TRACE, the engines are left alone without it.
+// The trace has to outlive the cpu or be detached before c64trace_destroy.
+// Its ring has a single producer, so every cpu needs a trace of its own, a
+// trace attached to another cpu is refused.
+void c64cpu_setTracer(c64cpu_t *cpu, c64trace_t *trace);
+// Breakpoints are checked when an instruction is decoded, so they cost
+// nothing while running
+void c64cpu_setBreakpoint(c64cpu_t *cpu, uint64_t address);
+void c64cpu_clearBreakpoint(c64cpu_t *cpu, uint64_t address);
+char c64cpu_isBreakpoint(c64cpu_t *cpu, uint64_t address);
 void c64cpu_attachDebugger(c64cpu_t *cpu, void (*debugger)(c64cpu_t *cpu));
 
 #endif // _c64cpu_h_
\ No newline at end of file
@@ -0,0 +1,114 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#ifndef _c64decode_h_
+#define _c64decode_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <c64consts.h>
+#include <c64instructions.h>
+
+// Operand layouts following the 16 bit opcode
+#define FMT_NONE 0    // op
+#define FMT_R 1       // op r
+#define FMT_RR 2      // op r1, r2
+#define FMT_RI8 3     // op r, imm8
+#define FMT_RI16 4    // op r, imm16
+#define FMT_RI32 5    // op r, imm32
+#define FMT_RI64 6    // op r, imm64
+#define FMT_I64 7     // op imm64
+#define FMT_INVALID 8 // unknown opcode, decoded as a bare opcode
+#define FMT_RRR 9     // op r1, r2, r3
+#define FMT_VR 10     // op v, r
+#define FMT_VV 11     // op v1, v2
+#define FMT_RV 12     // op r, v
+#define FMT_RRI32 13  // op r1, r2, imm32, the immediate is sign extended
+#define FMT_RRRI8 14  // op r1, r2, r3, imm8
+#define FMT_MI64 15   // op mask, imm64, the register mask is kept in r1
+#define FMT_M 16      // op mask, kept in r1
+
+// Compact encoding, used for instructions whose opcode is on a MM_COMPACT page.
+// Register pairs share a byte, low nibble first, and 64 bit immediates are
+// stored in 1 << size bytes and sign extended:
+//   FMT_RR, FMT_VR, FMT_VV, FMT_RV  r1 | r2 << 4
+//   FMT_RRR                         r1 | r2 << 4, r3
+//   FMT_RRI32                       r1 | r2 << 4, imm32
+//   FMT_RRRI8                       r1 | r2 << 4, r3 | imm4 << 4
+//   FMT_RI64                        r | size << 4, imm
+//   FMT_I64                         size, imm
+//   FMT_MI64                        mask, size, imm
+// Jumps, branches, CALL and CALLM with a 1, 2 or 4 byte immediate are relative to
+// the next instruction. All other formats are encoded as usual.
+
+// Superinstructions the cpu fuses adjacent pairs into, see c64cpu_fuse.
+// They have no encoding of their own.
+#define C64_FUSED_OPS(X)                                                     \
+    X(CMPJEQ) X(CMPJNE) X(CMPJGT) X(CMPJLT) X(CMPJGE) X(CMPJLE)             \
+    X(CMPIJEQ) X(CMPIJNE) X(CMPIJGT) X(CMPIJLT) X(CMPIJGE) X(CMPIJLE)       \
+    X(LDIADD) X(PUSHICALL)
+
+// Dense handler indexes, one per opcode
+enum
+{
+#define X(name) OP_##name,
+    C64_OPCODES(X)
+    C64_FUSED_OPS(X)
+#undef X
+    OP_BREAK, // breakpoint in front of the instruction, see c64cpu_setBreakpoint
+    OP_INVALID,
+    OP_COUNT
+};
+
+#define ICACHE_SIZE 4096 // Decoded instruction cache entries, power of two
+
+// An instruction in its decoded form.
+// Cached per guest address in the cpu and reused until the line it was
+// decoded from is written to (see c64mm_getWriteGen).
+struct c64insn
+{
+    uint64_t address;    // guest address of the opcode, UINT64_MAX if not cached
+    uint64_t imm;        // immediate or address operand, zero extended to 64 bit except for FMT_RRI32 and compact 64 bit immediates, which are sign extended
+    uint64_t target;     // jump target of the second instruction of a fused pair
+    const void *handler; // threaded dispatch target, set by the cpu
+    uint32_t gen;        // write generation of the line at decode time
+    uint16_t opcode;
+    uint8_t op;     // OP_* handler index
+    uint8_t length; // encoded size in bytes including the opcode
+    uint8_t r1;     // register indexes, already reduced modulo REG_COUNT (VREG_COUNT for vector registers), or a register mask
+    uint8_t r2;
+    uint8_t r3;
+    uint8_t split; // length of the first instruction of a fused pair, 0 if not fused
+};
+
+uint8_t c64decode_format(uint16_t opcode);
+uint8_t c64decode_op(uint16_t opcode);
+uint8_t c64decode_length(uint8_t format);
+
+// Decodes the operands of opcode which is located at address, in the compact
+// encoding if the page at address is MM_COMPACT
+void c64decode_operands(c64mm_t *mm, c64insn_t *insn, uint64_t address, uint16_t opcode);
+// Decodes the instruction at address
+void c64decode(c64mm_t *mm, c64insn_t *insn, uint64_t address);
+void c64decode_flush(c64insn_t *cache, size_t count);
+
+// Name of an OP_* handler index
+const char *c64decode_opName(uint8_t op);
+// Writes the instruction in assembly syntax to buffer, returns what snprintf returns
+int c64decode_disassemble(const c64insn_t *insn, char *buffer, size_t size);
+
+#endif // _c64decode_h_
\ No newline at end of file
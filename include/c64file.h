@@ -0,0 +1,50 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#ifndef _c64file_h_
+#define _c64file_h_
+
+#include <c64mm.h>
+#include <c64mem.h>
+#include <c64utils.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Program images are mapped straight from the page cache where the host
+// supports mmap, and read into device memory otherwise
+#if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)
+#define C64FILE_MMAP 1
+#else
+#define C64FILE_MMAP 0
+#endif
+
+// A read only device backed by the file at path, dataSize is the file size.
+// Mapped with MM_READ | MM_EXEC, writes are dropped.
+c64dev_t *c64file_createRom(const char *path, c64cpu_t *cpu);
+
+// A copy on write device backed by the file at path. Writes stay private to
+// the device. size may exceed the file size, the rest reads as zero.
+// size 0 uses the file size.
+c64dev_t *c64file_createRam(const char *path, size_t size, c64cpu_t *cpu);
+
+void c64file_setUint64(c64dev_t *device, uint64_t address, uint64_t value);
+void c64file_setUint32(c64dev_t *device, uint64_t address, uint32_t value);
+void c64file_setUint16(c64dev_t *device, uint64_t address, uint16_t value);
+void c64file_setUint8(c64dev_t *device, uint64_t address, uint8_t value);
+void c64file_writeBlock(c64dev_t *device, uint64_t address, const void *buffer, size_t size);
+
+#endif // _c64file_h_
\ No newline at end of file
@@ -34,6 +34,41 @@ along with c64vm. If not, see <https://mit-license.org/>.
 #define STD (uint16_t)0x0303  // STD r, addr | 4 bytes (32 bit)
 #define TF (uint16_t)0x0004  // TF r1, r2 (r1 = r2)
 
+// Register addressed loads and stores, sized like LDM and ST.
+// IP used as r2 reads as the address of the next instruction.
+#define LDR (uint16_t)0x0005  // LDR r1, r2 (r1 = [r2])
+#define LDBR (uint16_t)0x0105 // LDBR r1, r2 | 1 byte
+#define LDWR (uint16_t)0x0205 // LDWR r1, r2 | 2 bytes
+#define LDDR (uint16_t)0x0305 // LDDR r1, r2 | 4 bytes
+#define STR (uint16_t)0x0006  // STR r1, r2 (r1 -> [r2])
+#define STBR (uint16_t)0x0106 // STBR r1, r2 | 1 byte
+#define STWR (uint16_t)0x0206 // STWR r1, r2 | 2 bytes
+#define STDR (uint16_t)0x0306 // STDR r1, r2 | 4 bytes
+#define LDO (uint16_t)0x0007  // LDO r1, r2, imm32 (r1 = [r2 + imm]) ( imm is signed )
+#define LDBO (uint16_t)0x0107 // LDBO r1, r2, imm32 | 1 byte
+#define LDWO (uint16_t)0x0207 // LDWO r1, r2, imm32 | 2 bytes
+#define LDDO (uint16_t)0x0307 // LDDO r1, r2, imm32 | 4 bytes
+#define STO (uint16_t)0x0008  // STO r1, r2, imm32 (r1 -> [r2 + imm]) ( imm is signed )
+#define STBO (uint16_t)0x0108 // STBO r1, r2, imm32 | 1 byte
+#define STWO (uint16_t)0x0208 // STWO r1, r2, imm32 | 2 bytes
+#define STDO (uint16_t)0x0308 // STDO r1, r2, imm32 | 4 bytes
+#define LDX (uint16_t)0x0009  // LDX r1, r2, r3, s (r1 = [r2 + (r3 << s)]) ( s = 0..3 )
+#define LDBX (uint16_t)0x0109 // LDBX r1, r2, r3, s | 1 byte
+#define LDWX (uint16_t)0x0209 // LDWX r1, r2, r3, s | 2 bytes
+#define LDDX (uint16_t)0x0309 // LDDX r1, r2, r3, s | 4 bytes
+#define STX (uint16_t)0x000A  // STX r1, r2, r3, s (r1 -> [r2 + (r3 << s)]) ( s = 0..3 )
+#define STBX (uint16_t)0x010A // STBX r1, r2, r3, s | 1 byte
+#define STWX (uint16_t)0x020A // STWX r1, r2, r3, s | 2 bytes
+#define STDX (uint16_t)0x030A // STDX r1, r2, r3, s | 4 bytes
+#define LDP (uint16_t)0x000B  // LDP r1, r2 (r1 = [r2], r2 += size) ( post increment )
+#define LDBP (uint16_t)0x010B // LDBP r1, r2 | 1 byte
+#define LDWP (uint16_t)0x020B // LDWP r1, r2 | 2 bytes
+#define LDDP (uint16_t)0x030B // LDDP r1, r2 | 4 bytes
+#define STP (uint16_t)0x000C  // STP r1, r2 (r1 -> [r2], r2 += size) ( post increment )
+#define STBP (uint16_t)0x010C // STBP r1, r2 | 1 byte
+#define STWP (uint16_t)0x020C // STWP r1, r2 | 2 bytes
+#define STDP (uint16_t)0x030C // STDP r1, r2 | 4 bytes
+
 #define ADDI (uint16_t)0x0011  // ADDI r, imm (r += imm) ( C/Z/N/V )
 #define SUBI (uint16_t)0x0012  // SUBI r, imm (r -= imm) ( C/Z/N/V )
 #define MULI (uint16_t)0x0013  // MULI r, imm (r *= imm) ( unsigned ) ( C/Z/N/V )
@@ -114,6 +149,8 @@ along with c64vm. If not, see <https://mit-license.org/>.
 #define CALL (uint16_t)0x00A1  // CALL addr ( PC => SP-- => *SP = PC => PC = addr )
 #define CALLR (uint16_t)0x00A2 // CALLR r ( PC => SP-- => *SP = PC => PC = r )
 #define RTC (uint16_t)0x00A3   // RTC ( PC => SP++ => *SP => PC )
+#define CALLM (uint16_t)0x00A4 // CALLM mask, addr ( R1-R8 in mask => SP--, PC => SP-- => PC = addr ) ( bit i of mask is R(i+1) )
+#define RETM (uint16_t)0x00A5  // RETM mask ( PC = SP++, SP++ => R1-R8 in mask ) ( mask as passed to CALLM )
 
 #define CLC (uint16_t)0x00B1 // CLC ( C = 0 )
 #define SEC (uint16_t)0x00B2 // SEC ( C = 1 )
@@ -129,7 +166,127 @@ along with c64vm. If not, see <https://mit-license.org/>.
 #define _INT (uint16_t)0x00C1 // INT imm ( interrupt )
 #define RTI (uint16_t)0x00C2  // RTI ( return from interrupt )
 
+// Memory accesses before a FENCE are seen by every cpu before any access after it, see c64smp.h
+#define FENCE (uint16_t)0x00C3 // FENCE ( full memory barrier )
+
+// Atomic read-modify-write of the value at r2, sized like the vector lanes:
+// no suffix = 8 bytes, B = 1 byte, W = 2 bytes, D = 4 bytes. Values are zero extended.
+// Naturally aligned accesses to host memory are host atomics, other accesses
+// (MMIO, unaligned) are only atomic against the atomic instructions of other cpus.
+#define CAS (uint16_t)0x00C4   // CAS r1, r2, r3 ( if [r2] == r1 then [r2] = r3 ) ( r1 = old [r2] ) ( Z if stored )
+#define CASB (uint16_t)0x01C4  // CASB r1, r2, r3 | 1 byte
+#define CASW (uint16_t)0x02C4  // CASW r1, r2, r3 | 2 bytes
+#define CASD (uint16_t)0x03C4  // CASD r1, r2, r3 | 4 bytes
+#define XCHG (uint16_t)0x00C5  // XCHG r1, r2 ( r1 = [r2], [r2] = old r1 )
+#define XCHGB (uint16_t)0x01C5 // XCHGB r1, r2 | 1 byte
+#define XCHGW (uint16_t)0x02C5 // XCHGW r1, r2 | 2 bytes
+#define XCHGD (uint16_t)0x03C5 // XCHGD r1, r2 | 4 bytes
+#define FETCHADD (uint16_t)0x00C6  // FETCHADD r1, r2 ( r1 = [r2], [r2] += old r1 )
+#define FETCHADDB (uint16_t)0x01C6 // FETCHADDB r1, r2 | 1 byte
+#define FETCHADDW (uint16_t)0x02C6 // FETCHADDW r1, r2 | 2 bytes
+#define FETCHADDD (uint16_t)0x03C6 // FETCHADDD r1, r2 | 4 bytes
+
+// Futex style parking of the host thread, see c64cpu_wait. A parked cpu wakes
+// on WAKEADDR of its address, an interrupt it can enter or its host, and may
+// also wake for no reason, so guests check the value again.
+#define WAITADDR (uint16_t)0x00C7  // WAITADDR r1, r2 ( park while [r2] == r1 )
+#define WAITADDRB (uint16_t)0x01C7 // WAITADDRB r1, r2 | 1 byte
+#define WAITADDRW (uint16_t)0x02C7 // WAITADDRW r1, r2 | 2 bytes
+#define WAITADDRD (uint16_t)0x03C7 // WAITADDRD r1, r2 | 4 bytes
+#define WAKEADDR (uint16_t)0x00C8  // WAKEADDR r1, r2 ( wake up to r1 cpus parked on address r2 ) ( r1 = cpus woken )
+
+// Memory block instructions. Each execution handles up to c64cpu_blockChunk bytes
+// and advances its registers, the instruction is repeated until r3 is used up.
+#define MCPY (uint16_t)0x00D1  // MCPY r1, r2, r3 ( copy r3 bytes from r2 to r1, ascending ) ( r1 += r3, r2 += r3, r3 = 0 )
+#define MSET (uint16_t)0x00D2  // MSET r1, r2, r3 ( fill r3 bytes at r1 with the low byte of r2 ) ( r1 += r3, r3 = 0 )
+#define MCMP (uint16_t)0x00D3  // MCMP r1, r2, r3 ( compare r3 bytes at r1 and r2 up to the first difference ) ( r1, r2 = difference, r3 = bytes left ) ( C/Z/N )
+#define MSCAN (uint16_t)0x00D4 // MSCAN r1, r2, r3 ( find the low byte of r2 in r3 bytes at r1 ) ( r1 = match, r3 = bytes left ) ( Z if found )
+
+// Vector instructions on the vector registers v0 - v15 (see VREG_COUNT).
+// Lane-wise instructions take the lane width from the high byte like LDI:
+// no suffix = 8 byte lanes, B = 1 byte, W = 2 bytes, D = 4 bytes. Lanes are unsigned.
+#define VLD (uint16_t)0x00E1  // VLD v, r (v = VREG_SIZE bytes at r)
+#define VST (uint16_t)0x00E2  // VST v, r (v -> VREG_SIZE bytes at r)
+#define VMOV (uint16_t)0x00E3 // VMOV v1, v2 (v1 = v2)
+#define VSPLAT (uint16_t)0x00E4  // VSPLAT v, r (every lane of v = r)
+#define VSPLATB (uint16_t)0x01E4 // VSPLATB v, r | 1 byte lanes
+#define VSPLATW (uint16_t)0x02E4 // VSPLATW v, r | 2 byte lanes
+#define VSPLATD (uint16_t)0x03E4 // VSPLATD v, r | 4 byte lanes
+#define VADD (uint16_t)0x00E5  // VADD v1, v2 (v1 += v2)
+#define VADDB (uint16_t)0x01E5 // VADDB v1, v2 | 1 byte lanes
+#define VADDW (uint16_t)0x02E5 // VADDW v1, v2 | 2 byte lanes
+#define VADDD (uint16_t)0x03E5 // VADDD v1, v2 | 4 byte lanes
+#define VSUB (uint16_t)0x00E6  // VSUB v1, v2 (v1 -= v2)
+#define VSUBB (uint16_t)0x01E6 // VSUBB v1, v2 | 1 byte lanes
+#define VSUBW (uint16_t)0x02E6 // VSUBW v1, v2 | 2 byte lanes
+#define VSUBD (uint16_t)0x03E6 // VSUBD v1, v2 | 4 byte lanes
+#define VMUL (uint16_t)0x00E7  // VMUL v1, v2 (v1 *= v2, low half)
+#define VMULB (uint16_t)0x01E7 // VMULB v1, v2 | 1 byte lanes
+#define VMULW (uint16_t)0x02E7 // VMULW v1, v2 | 2 byte lanes
+#define VMULD (uint16_t)0x03E7 // VMULD v1, v2 | 4 byte lanes
+#define VMIN (uint16_t)0x00E8  // VMIN v1, v2 (v1 = min(v1, v2))
+#define VMINB (uint16_t)0x01E8 // VMINB v1, v2 | 1 byte lanes
+#define VMINW (uint16_t)0x02E8 // VMINW v1, v2 | 2 byte lanes
+#define VMIND (uint16_t)0x03E8 // VMIND v1, v2 | 4 byte lanes
+#define VMAX (uint16_t)0x00E9  // VMAX v1, v2 (v1 = max(v1, v2))
+#define VMAXB (uint16_t)0x01E9 // VMAXB v1, v2 | 1 byte lanes
+#define VMAXW (uint16_t)0x02E9 // VMAXW v1, v2 | 2 byte lanes
+#define VMAXD (uint16_t)0x03E9 // VMAXD v1, v2 | 4 byte lanes
+#define VCMPEQ (uint16_t)0x00EA  // VCMPEQ v1, v2 (v1 = v1 == v2 ? ~0 : 0)
+#define VCMPEQB (uint16_t)0x01EA // VCMPEQB v1, v2 | 1 byte lanes
+#define VCMPEQW (uint16_t)0x02EA // VCMPEQW v1, v2 | 2 byte lanes
+#define VCMPEQD (uint16_t)0x03EA // VCMPEQD v1, v2 | 4 byte lanes
+#define VCMPGT (uint16_t)0x00EB  // VCMPGT v1, v2 (v1 = v1 > v2 ? ~0 : 0)
+#define VCMPGTB (uint16_t)0x01EB // VCMPGTB v1, v2 | 1 byte lanes
+#define VCMPGTW (uint16_t)0x02EB // VCMPGTW v1, v2 | 2 byte lanes
+#define VCMPGTD (uint16_t)0x03EB // VCMPGTD v1, v2 | 4 byte lanes
+#define VAND (uint16_t)0x00EC  // VAND v1, v2 (v1 &= v2)
+#define VOR (uint16_t)0x00ED   // VOR v1, v2 (v1 |= v2)
+#define VXOR (uint16_t)0x00EE  // VXOR v1, v2 (v1 ^= v2)
+#define VSHUF (uint16_t)0x00EF // VSHUF v1, v2 (byte i of v1 = byte v2[i] & 15 of v1, 0 if bit 7 of v2[i] is set)
+#define VHADD (uint16_t)0x00F0  // VHADD r, v (r = sum of the lanes of v)
+#define VHADDB (uint16_t)0x01F0 // VHADDB r, v | 1 byte lanes
+#define VHADDW (uint16_t)0x02F0 // VHADDW r, v | 2 byte lanes
+#define VHADDD (uint16_t)0x03F0 // VHADDD r, v | 4 byte lanes
+#define VHMIN (uint16_t)0x00F1  // VHMIN r, v (r = smallest lane of v)
+#define VHMINB (uint16_t)0x01F1 // VHMINB r, v | 1 byte lanes
+#define VHMINW (uint16_t)0x02F1 // VHMINW r, v | 2 byte lanes
+#define VHMIND (uint16_t)0x03F1 // VHMIND r, v | 4 byte lanes
+#define VHMAX (uint16_t)0x00F2  // VHMAX r, v (r = largest lane of v)
+#define VHMAXB (uint16_t)0x01F2 // VHMAXB r, v | 1 byte lanes
+#define VHMAXW (uint16_t)0x02F2 // VHMAXW r, v | 2 byte lanes
+#define VHMAXD (uint16_t)0x03F2 // VHMAXD r, v | 4 byte lanes
+#define VMASK (uint16_t)0x00F3 // VMASK r, v (bit i of r = top bit of byte i of v)
+
 #define NOP (uint16_t)0x0000 // NOP ( no operation )
 #define HLT (uint16_t)0xFFFF // HLT ( halt )
 
+// Every instruction above, used to generate the decoder and dispatch tables
+#define C64_OPCODES(X) \
+    X(LDI) X(LDBI) X(LDWI) X(LDDI) X(LDM) X(LDBM) X(LDWM) X(LDDM) \
+    X(ST) X(STB) X(STW) X(STD) X(TF) X(LDR) X(LDBR) X(LDWR) \
+    X(LDDR) X(STR) X(STBR) X(STWR) X(STDR) X(LDO) X(LDBO) X(LDWO) \
+    X(LDDO) X(STO) X(STBO) X(STWO) X(STDO) X(LDX) X(LDBX) X(LDWX) \
+    X(LDDX) X(STX) X(STBX) X(STWX) X(STDX) X(LDP) X(LDBP) X(LDWP) \
+    X(LDDP) X(STP) X(STBP) X(STWP) X(STDP) X(ADDI) X(SUBI) X(MULI) \
+    X(DIVI) X(MODI) X(MULIS) X(DIVIS) X(ADD) X(SUB) X(MUL) X(DIV) \
+    X(MOD) X(MULS) X(DIVS) X(ANDI) X(ORI) X(XORI) X(NOTI) X(SHLI) \
+    X(SHRI) X(RORI) X(ROLI) X(AND) X(OR) X(XOR) X(NOT) X(SHL) \
+    X(SHR) X(ROR) X(ROL) X(CMP) X(CMPI) X(JMP) X(JEQ) X(JNE) \
+    X(JGT) X(JLT) X(JGE) X(JLE) X(BRA) X(BEQ) X(BNE) X(BGT) \
+    X(BLT) X(BGE) X(BLE) X(JMPR) X(JEQR) X(JNER) X(JGTR) X(JLTR) \
+    X(JGER) X(JLER) X(BRAR) X(BEQR) X(BNER) X(BGTR) X(BLTR) X(BGER) \
+    X(BLER) X(RET) X(PUSH) X(PUSHI) X(POP) X(CALL) X(CALLR) X(RTC) \
+    X(CALLM) X(RETM) X(CLC) X(SEC) X(CLZ) X(SEZ) X(CLN) X(SEN) \
+    X(CLV) X(SEV) X(CLI) X(SEI) X(_INT) X(RTI) X(FENCE) X(CAS) \
+    X(XCHG) X(FETCHADD) X(WAITADDR) X(WAKEADDR) X(MCPY) X(MSET) X(MCMP) X(MSCAN) \
+    X(VLD) X(VST) X(VMOV) X(VSPLAT) X(VADD) X(VSUB) X(VMUL) X(VMIN) \
+    X(VMAX) X(VCMPEQ) X(VCMPGT) X(VAND) X(VOR) X(VXOR) X(VSHUF) X(VHADD) \
+    X(VHMIN) X(VHMAX) X(VMASK) X(NOP) X(HLT)
+
+// Instructions with B, W and D lane or access width variants, decoded to the same handler
+#define C64_LANE_OPCODES(X) \
+    X(VSPLAT) X(VADD) X(VSUB) X(VMUL) X(VMIN) X(VMAX) X(VCMPEQ) X(VCMPGT) \
+    X(VHADD) X(VHMIN) X(VHMAX) X(CAS) X(XCHG) X(FETCHADD) X(WAITADDR)
+
 #endif // _c64instructions_h_
\ No newline at end of file
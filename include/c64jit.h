@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#ifndef _c64jit_h_
+#define _c64jit_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <c64consts.h>
+#include <c64decode.h>
+
+// Translation is only implemented for x86-64 hosts with mmap
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define C64JIT_AVAILABLE 1
+#else
+#define C64JIT_AVAILABLE 0
+#endif
+
+#define JIT_CODE_SIZE (16 * 1024 * 1024) // Host code buffer, flushed when full
+#define JIT_BLOCK_RESERVE (64 * 1024)     // Upper bound for the code of one block
+#define JIT_MAX_BLOCKS 16384
+#define JIT_TABLE_SIZE 4096  // Block lookup buckets, power of two
+#define JIT_HOT_SIZE 4096    // Execution counters, power of two
+#define JIT_HOT_THRESHOLD 16 // Dispatches of an address before it is translated
+#define JIT_MAX_INSNS 64     // Guest instructions per block
+#define JIT_MAX_LINES 4      // Write tracking lines a block may span
+#define JIT_CACHED_REGS 5    // Guest registers held in host registers per block
+
+typedef struct c64jitBlock c64jitBlock_t;
+
+// A translated basic block: straight line guest code ending in a jump,
+// an instruction the translator does not handle or a line boundary.
+struct c64jitBlock
+{
+    uint64_t address;
+    uint8_t *entry; // host code, NULL if the code at address is not translatable
+    size_t size;    // guest bytes covered
+    uint8_t *bytes; // copy of the guest bytes, to revalidate after writes to the same lines
+    size_t lineCount;
+    uint32_t gens[JIT_MAX_LINES];
+    uint8_t *genPatch[JIT_MAX_LINES]; // generation immediates checked in the prologue
+    c64jitBlock_t *next;
+};
+
+struct c64jit
+{
+    uint8_t *code; // readable and executable, writable only while c64jit writes to it
+    size_t pageSize;
+    size_t used;
+    size_t start; // first byte after the entry and exit paths
+    void (*enter)(c64cpu_t *cpu, const uint8_t *entry);
+    uint8_t *exit; // common exit path back into c64jit_run
+    c64jitBlock_t *table[JIT_TABLE_SIZE];
+    c64jitBlock_t blocks[JIT_MAX_BLOCKS];
+    size_t blockCount;
+    uint16_t hot[JIT_HOT_SIZE];
+};
+
+// Returns NULL if translation is not available on this host
+c64jit_t *c64jit_create();
+void c64jit_destroy(c64jit_t *jit);
+// Drops all translated code
+void c64jit_flush(c64jit_t *jit);
+
+// Whether the translator handles the decoded instruction.
+// Everything else (CALL, PUSH, _INT, ...) runs in the interpreter.
+char c64jit_canTranslate(const c64insn_t *insn);
+
+// Runs translated blocks starting at IP until at most budget guest
+// instructions have retired or the next block is not translated.
+// Returns the number of retired instructions, 0 if nothing ran.
+uint64_t c64jit_run(c64cpu_t *cpu, uint64_t budget);
+
+#endif // _c64jit_h_
\ No newline at end of file
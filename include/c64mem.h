@@ -25,9 +25,18 @@ along with c64vm. If not, see <https://mit-license.org/>.
 #include <stdlib.h>
 #include <string.h>
 
+// Device memory is reserved with demand-zero anonymous mappings where the
+// host supports them, so untouched guest memory costs no host memory
+#if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)
+#define C64MEM_SPARSE 1
+#else
+#define C64MEM_SPARSE 0
+#endif
+
 c64dev_t *c64mem_createDevice(size_t size, c64cpu_t *cpu);
 
 void *c64mem_createMemory(size_t size);
+void c64mem_destroyMemory(void *memory, size_t size);
 
 uint64_t c64mem_getUint64(c64dev_t *device, uint64_t address);
 uint32_t c64mem_getUint32(c64dev_t *device, uint64_t address);
@@ -39,6 +48,9 @@ void c64mem_setUint32(c64dev_t *device, uint64_t address, uint32_t value);
 void c64mem_setUint16(c64dev_t *device, uint64_t address, uint16_t value);
 void c64mem_setUint8(c64dev_t *device, uint64_t address, uint8_t value);
 
+void c64mem_readBlock(c64dev_t *device, uint64_t address, void *buffer, size_t size);
+void c64mem_writeBlock(c64dev_t *device, uint64_t address, const void *buffer, size_t size);
+
 void c64mem_destroy(c64dev_t *device);
 
 #endif // _c64mem_h_
\ No newline at end of file
@@ -20,14 +20,20 @@ along with c64vm. If not, see <https://mit-license.org/>.
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <c64utils.h>
-#include <c64cpu.h>
+#include <c64consts.h>
 
 struct DeviceDriver
 {
     char name[32];
     void *data;
     size_t dataSize;
+    // Plain memory behind the device, dataSize bytes, accessed directly through
+    // the cpu's TLB. NULL for devices that need their callbacks on every access.
+    uint8_t *host;
+    // Page attributes the device is mapped with, 0 for MM_READ | MM_WRITE | MM_EXEC
+    uint8_t attributes;
     c64cpu_t *cpu;
     uint64_t (*getUint64)(c64dev_t *device, uint64_t address);
     uint32_t (*getUint32)(c64dev_t *device, uint64_t address);
@@ -38,6 +44,11 @@ struct DeviceDriver
     void (*setUint16)(c64dev_t *device, uint64_t address, uint16_t value);
     void (*setUint8)(c64dev_t *device, uint64_t address, uint8_t value);
 
+    // Optional bulk transfers of size bytes at address, NULL to fall back to getUint8 and setUint8.
+    // Called for runs that never cross the end of the device's region.
+    void (*readBlock)(c64dev_t *device, uint64_t address, void *buffer, size_t size);
+    void (*writeBlock)(c64dev_t *device, uint64_t address, const void *buffer, size_t size);
+
     // The destroy function if defined will be called when the memory map is destroyed.
     // And needs to call free on the device itself.
     // If not defined the device will be freed by the memory map.
@@ -51,19 +62,114 @@ struct MemoryMapRegion
     uint64_t start;
     uint64_t end;
     char remap;
+    // Attributes the region was mapped with, applied on pages it shares with other regions
+    uint8_t attributes;
 };
 
+#define MM_PAGE_SHIFT 12 // 4 KiB pages
+#define MM_LINE_SHIFT 8   // 256 byte lines, the granularity of write tracking
+#define MM_GEN_COUNT 16384 // Write generation slots, power of two
+
+// Page attributes
+#define MM_READ 0x01
+#define MM_WRITE 0x02
+#define MM_EXEC 0x04
+#define MM_MMIO 0x08 // never cached, every access goes through the device callbacks
+#define MM_COMPACT 0x10 // code is in the compact encoding, see c64decode.h
+
+// The page table: 52 bit page numbers split into a 7 bit top level and five 9 bit levels
+#define MM_LEVELS 6
+#define MM_LEVEL_BITS 9
+#define MM_LEVEL_SIZE (1 << MM_LEVEL_BITS)
+
+#define MM_ENTRY_NONE 0   // unmapped
+#define MM_ENTRY_TABLE 1  // next is the next level
+#define MM_ENTRY_REGION 2 // target is the region covering the whole span of the entry
+#define MM_ENTRY_SHARED 3 // a page shared by regions smaller than a page, target is their c64mmShared_t
+
+typedef struct c64mmTable c64mmTable_t;
+typedef struct c64mmShared c64mmShared_t;
+
+// The regions sharing a page, ordered by start. A region joining the page
+// replaces the whole list. Other threads may still read the old one, so it
+// is kept on mm->retired until the map is destroyed.
+struct c64mmShared
+{
+    c64mmShared_t *retired; // next replaced list of the map
+    size_t count;
+    c64mmr_t *regions[];
+};
+
+// Entries are read by cpus on other threads without taking the lock. They are
+// published by storing the kind last, and target stays valid when a region
+// entry is split into a table, so a reader sees either the old or the new entry.
+// The target of a shared entry changes while its kind stays, it is loaded with MM_LOAD.
+typedef struct
+{
+    void *target;
+    c64mmTable_t *next;
+    uint8_t kind;       // MM_ENTRY_*
+    uint8_t attributes; // MM_READ, ... of the whole span
+} c64mmEntry_t;
+
+struct c64mmTable
+{
+    c64mmEntry_t entries[MM_LEVEL_SIZE];
+};
+
+// Loads and stores of the fields cpus on other threads read without the lock
+#if defined(__GNUC__)
+#define MM_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define MM_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+#else
+// Enough on x86 hosts, where stores are not reordered with other stores
+#define MM_LOAD(field) (field)
+#define MM_STORE(field, value) ((field) = (value))
+#endif
+
+// One map can be shared by several cpus, each on its own host thread (see c64smp.h).
+// Everything a cpu caches from the map lives in the cpu: its TLB, decoded
+// instructions, translated code and stack window. c64mm_map and c64mm_protect
+// take the lock, the cpus pick up their changes through mapGen at their next slice.
 struct MemoryMap
 {
-    c64mmr_t **regions;
+    c64mmr_t **regions; // only read under the lock, it moves when it grows
     uint64_t count;
+    uint64_t capacity;
+    c64mmTable_t *root;
+    c64mmShared_t *retired; // replaced lists of shared pages, freed with the map
+    void *lock;     // serializes changes to the map, see mutexCreate
+    uint32_t users; // cpus created on the map, the last one destroys it
+    void *atomicLock;  // serializes atomic instructions outside host memory
+    void *waitLock;    // guards waiters and the wait state of the cpus, see c64cpu_wait
+    c64cpu_t *waiters; // cpus parked by WAITADDR, linked through their waitNext
+    // Bumped whenever a mapping or attribute changes, so cpus can drop what they cached
+    uint32_t mapGen;
+    // Bumped on every write to a line hashing into the slot.
+    // Decoded instructions remember the value and are dropped once it changes.
+    // Increments racing on other cpus may merge, but the slot still changes.
+    uint32_t writeGen[MM_GEN_COUNT];
 };
 
 c64mm_t *c64mm_create();
 void c64mm_setCPU(c64mm_t *mm, c64cpu_t *cpu);
 void c64mm_destroy(c64mm_t *mm);
+// Counts a cpu using the map, called by c64cpu_create
+void c64mm_retain(c64mm_t *mm);
+// Drops a cpu using the map, called by c64cpu_destroy. Destroys the map with the last one.
+void c64mm_release(c64mm_t *mm);
 void c64mm_map(c64mm_t *mm, c64dev_t *device, uint64_t start, uint64_t end, char remap);
 
+// Sets the attributes of every page overlapping start - end
+void c64mm_protect(c64mm_t *mm, uint64_t start, uint64_t end, uint8_t attributes);
+// Attributes of the page holding address, 0 if it is not mapped
+uint8_t c64mm_getAttributes(c64mm_t *mm, uint64_t address);
+
+// Host memory behind address if it is readable and writable RAM, NULL otherwise.
+// low and high are narrowed to the guest addresses around address that are
+// backed by the same host memory, starting at the returned pointer.
+uint8_t *c64mm_hostRange(c64mm_t *mm, uint64_t address, uint64_t *low, uint64_t *high);
+
 c64mmr_t *c64mm_findRegion(c64mm_t *mm, uint64_t address);
 uint64_t c64mm_getUint64(c64mm_t *mm, uint64_t address);
 uint32_t c64mm_getUint32(c64mm_t *mm, uint64_t address);
@@ -74,6 +180,64 @@ void c64mm_setUint32(c64mm_t *mm, uint64_t address, uint32_t value);
 void c64mm_setUint16(c64mm_t *mm, uint64_t address, uint16_t value);
 void c64mm_setUint8(c64mm_t *mm, uint64_t address, uint8_t value);
 
+// Copies size bytes between the guest at address and buffer, the range may span regions.
+// Pages without the permission are skipped with a warning, skipped reads leave zeros.
+void c64mm_read(c64mm_t *mm, uint64_t address, void *buffer, size_t size);
+void c64mm_write(c64mm_t *mm, uint64_t address, const void *buffer, size_t size);
+
 void c16mm_print(c64mm_t *mm);
 
+static inline int c64mm_levelShift(int level)
+{
+    return MM_PAGE_SHIFT + MM_LEVEL_BITS * (MM_LEVELS - 1 - level);
+}
+
+// The entry deciding about address, at whatever level the walk ends
+static inline const c64mmEntry_t *c64mm_lookup(c64mm_t *mm, uint64_t address)
+{
+    const c64mmTable_t *table = mm->root;
+    for (int level = 0;; level++)
+    {
+        const c64mmEntry_t *entry = &table->entries[(address >> c64mm_levelShift(level)) & (MM_LEVEL_SIZE - 1)];
+        if (MM_LOAD(entry->kind) != MM_ENTRY_TABLE)
+        {
+            return entry;
+        }
+        table = entry->next;
+    }
+}
+
+static inline size_t c64mm_genIndex(uint64_t address)
+{
+    return (address >> MM_LINE_SHIFT) & (MM_GEN_COUNT - 1);
+}
+
+static inline uint32_t c64mm_getWriteGen(c64mm_t *mm, uint64_t address)
+{
+    return mm->writeGen[c64mm_genIndex(address)];
+}
+
+// Marks size bytes at address as written.
+// Must be called by anything that changes device memory without going through c64mm_set*
+static inline void c64mm_touch(c64mm_t *mm, uint64_t address, size_t size)
+{
+    const size_t first = c64mm_genIndex(address);
+    const size_t last = c64mm_genIndex(address + size - 1);
+    mm->writeGen[first]++;
+    if (last != first)
+    {
+        mm->writeGen[last]++;
+    }
+}
+
+// Marks every line of size bytes at address as written, size must not be 0
+static inline void c64mm_touchBlock(c64mm_t *mm, uint64_t address, size_t size)
+{
+    const uint64_t last = (address + size - 1) >> MM_LINE_SHIFT;
+    for (uint64_t line = address >> MM_LINE_SHIFT; line <= last; line++)
+    {
+        mm->writeGen[line & (MM_GEN_COUNT - 1)]++;
+    }
+}
+
 #endif // _c64mm_h_
\ No newline at end of file
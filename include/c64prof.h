@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#ifndef _c64prof_h_
+#define _c64prof_h_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <c64consts.h>
+#include <c64decode.h>
+#include <c64utils.h>
+
+// Execution profiler, see c64cpu_setProfiler. Only built into the engines
+// with C64_PROFILE, otherwise they have no trace of it.
+//
+// Counts every instruction per OP_* and per guest address and measures the
+// host time between consecutive instructions, which is charged to the first.
+// Time is in TSC ticks on x86-64 and nanoseconds elsewhere.
+
+#define PROF_SITE_SIZE 65536 // Per address counters, power of two
+#define PROF_MAX_REGIONS 16
+#define PROF_NAME_SIZE 32
+#define PROF_TOP 20 // Addresses listed by the text report
+
+#define PROF_REPORT_TEXT 0
+#define PROF_REPORT_JSON 1
+
+typedef struct
+{
+    uint64_t address; // UINT64_MAX if unused
+    uint64_t count;
+    uint64_t ticks;
+    uint8_t op; // OP_* of the last instruction counted here
+} c64profSite_t;
+
+// Guest address range whose time is summed up in the report, inclusive
+typedef struct
+{
+    char name[PROF_NAME_SIZE];
+    uint64_t start;
+    uint64_t end;
+} c64profRegion_t;
+
+struct c64prof
+{
+    uint8_t format; // PROF_REPORT_*
+    uint64_t total; // instructions counted
+    uint64_t ticks;
+    uint64_t opCounts[OP_COUNT];
+    uint64_t opTicks[OP_COUNT];
+    c64profSite_t sites[PROF_SITE_SIZE];
+    size_t siteCount;
+    uint64_t dropped; // instructions at addresses that found no free site
+    c64profRegion_t regions[PROF_MAX_REGIONS];
+    size_t regionCount;
+};
+
+c64prof_t *c64prof_create(uint8_t format);
+void c64prof_destroy(c64prof_t *prof);
+// Drops everything counted so far, regions are kept
+void c64prof_reset(c64prof_t *prof);
+void c64prof_addRegion(c64prof_t *prof, const char *name, uint64_t start, uint64_t end);
+
+// Writes the report in prof->format. Opcodes are sorted by count,
+// addresses and regions by time.
+void c64prof_report(c64prof_t *prof, FILE *file);
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <x86intrin.h>
+#define PROF_TICK_UNIT "tsc"
+static inline uint64_t c64prof_now()
+{
+    return __rdtsc();
+}
+#else
+#define PROF_TICK_UNIT "ns"
+static inline uint64_t c64prof_now()
+{
+    return monotonicNs();
+}
+#endif
+
+c64profSite_t *c64prof_findSite(c64prof_t *prof, uint64_t address);
+
+// Counts insn, which ran at address and took ticks
+static inline void c64prof_count(c64prof_t *prof, const c64insn_t *insn, uint64_t address, uint64_t ticks)
+{
+    prof->total++;
+    prof->ticks += ticks;
+    prof->opCounts[insn->op]++;
+    prof->opTicks[insn->op] += ticks;
+
+    c64profSite_t *site = c64prof_findSite(prof, address);
+    if (site == NULL)
+    {
+        prof->dropped++;
+        return;
+    }
+    site->count++;
+    site->ticks += ticks;
+    site->op = insn->op;
+}
+
+#endif // _c64prof_h_
\ No newline at end of file
@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#ifndef _c64sample_h_
+#define _c64sample_h_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <c64consts.h>
+
+// Sampling profiler, see c64cpu_setSampler. Every period it unwinds the guest
+// call chain with c64cpu_unwind and counts the stack, CALLM leaves are
+// attributed to their caller as c64cpu_unwind describes. Samples are only
+// taken between the slices of c64cpu_runFor, the engines run as usual.
+
+#define SAMPLE_INSTRUCTIONS 0 // period counts guest instructions, slices are cut to hit it exactly
+#define SAMPLE_TIME 1         // period is host nanoseconds, sampled at the next slice boundary
+
+#define SAMPLE_MAX_DEPTH 32    // Frames kept per sample, the outermost are cut off
+#define SAMPLE_MAX_STACKS 4096 // Distinct stacks, later ones are only counted as dropped
+#define SAMPLE_TABLE_SIZE 8192 // Stack lookup buckets, power of two
+#define SAMPLE_MAX_SYMBOLS 256
+#define SAMPLE_NAME_SIZE 32
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t hash;
+    size_t depth;
+    uint64_t frames[SAMPLE_MAX_DEPTH]; // innermost first, the IP and then return addresses
+} c64sampleStack_t;
+
+// A guest function, frames inside it are counted under start and written as name
+typedef struct
+{
+    char name[SAMPLE_NAME_SIZE];
+    uint64_t start;
+    uint64_t end; // inclusive
+} c64sampleSymbol_t;
+
+struct c64sample
+{
+    uint8_t mode; // SAMPLE_*
+    uint64_t period;
+    uint64_t next; // cpu->retired or monotonicNs() of the next sample
+    uint64_t samples;
+    uint64_t dropped;
+    c64sampleStack_t *stacks;
+    size_t stackCount;
+    int32_t table[SAMPLE_TABLE_SIZE]; // index into stacks, -1 if free
+    c64sampleSymbol_t symbols[SAMPLE_MAX_SYMBOLS];
+    size_t symbolCount;
+};
+
+c64sample_t *c64sample_create(uint8_t mode, uint64_t period);
+void c64sample_destroy(c64sample_t *sampler);
+// Drops all samples, symbols are kept
+void c64sample_reset(c64sample_t *sampler);
+// Symbols should be added before sampling starts
+void c64sample_addSymbol(c64sample_t *sampler, const char *name, uint64_t start, uint64_t end);
+
+// Called by c64cpu_runFor: the slice shortened to end at the next sample,
+// and taking the sample once it is due
+uint64_t c64sample_slice(c64sample_t *sampler, c64cpu_t *cpu, uint64_t slice);
+void c64sample_check(c64sample_t *sampler, c64cpu_t *cpu);
+
+// Writes one line per distinct stack in the folded format flamegraph tools
+// read: the frames outermost first, separated by ';', then the sample count.
+// Frames are symbol names or hex addresses.
+void c64sample_writeFolded(c64sample_t *sampler, FILE *file);
+
+#endif // _c64sample_h_
\ No newline at end of file
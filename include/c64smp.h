@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#ifndef _c64smp_h_
+#define _c64smp_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <c64consts.h>
+#include <c64cpu.h>
+#include <c64mm.h>
+
+// Several cpus sharing one memory map, each run on its own host thread.
+// Every cpu keeps its own registers, TLB, decoded instructions, translated
+// code and stack window, only the map and the devices behind it are shared.
+//
+// Memory ordering of RAM between the cpus:
+//  - A cpu sees its own loads and stores in program order.
+//  - Naturally aligned loads and stores of 1, 2, 4 and 8 bytes are single host
+//    accesses, other cpus see them whole. Unaligned, vector and block
+//    accesses can be seen in parts.
+//  - Other cpus see stores in the order the host makes them visible, which
+//    is program order on x86 hosts and any order elsewhere. FENCE makes every
+//    access before it visible to all cpus before any access after it.
+//  - Everything a cpu did before raising an interrupt on another cpu is
+//    visible to that cpu once it enters the interrupt.
+//  - Code stored by one cpu is picked up by the others the next time they
+//    decode it. Several cpus storing to the same code at once is not supported.
+//  - MMIO accesses call the device on the thread of the accessing cpu,
+//    devices mapped for several cpus have to be thread safe.
+//  - Profilers, samplers and traces are per cpu. A trace in particular has a
+//    single producer and cannot be shared, see c64cpu_setTracer.
+//  - c64mm_map and c64mm_protect can be called from any thread, the cpus
+//    see the change at their next slice (c64cpu_sliceSize instructions).
+//
+// Guests synchronize with CAS, XCHG and FETCHADD, which are host atomics on
+// aligned host memory. Instead of spinning, a cpu can park its thread with
+// WAITADDR until another one changes the value and runs WAKEADDR, see c64cpu_wait.
+//
+// Interrupts between cpus (IPIs) are raised with c64cpu_raiseInterrupt on the
+// target, which enters them through c64cpu_handleInterrupt at its next slice.
+// Guests raise them through the device of c64smp_createIPIDevice.
+
+#define SMP_MAX_CPUS 64
+#define SMP_QUANTUM 65536 // Instructions a cpu runs between looks at c64smp_stop
+
+typedef struct
+{
+    c64smp_t *smp;
+    c64cpu_t *cpu;
+    void *thread; // NULL while the cpu is not running, see threadStart
+} c64smpCore_t;
+
+struct c64smp
+{
+    c64mm_t *mm;
+    size_t count;
+    c64smpCore_t cores[SMP_MAX_CPUS];
+    uint64_t stop; // set by c64smp_stop
+};
+
+// Creates count cpus on mm, each with its index in ACC. Their IP, SP and
+// stack bounds are left to the caller, as they are for c64cpu_create.
+c64smp_t *c64smp_create(c64mm_t *mm, size_t count, uint64_t interruptVectorAddress);
+// Stops the cpus and destroys them, the last one takes the memory map with it
+void c64smp_destroy(c64smp_t *smp);
+
+static inline c64cpu_t *c64smp_cpu(c64smp_t *smp, size_t index)
+{
+    return smp->cores[index].cpu;
+}
+
+// Runs every cpu on its own thread until it halts, faults or reaches a breakpoint.
+// Why a cpu stopped is left in cpu->stop and cpu->fault.
+void c64smp_start(c64smp_t *smp);
+// Waits for every running cpu to stop on its own
+void c64smp_wait(c64smp_t *smp);
+// Makes every running cpu stop within SMP_QUANTUM instructions, wakes the
+// parked ones and waits for them
+void c64smp_stop(c64smp_t *smp);
+
+// Raises interrupt (0 - 63) on the cpu at index, from any thread
+void c64smp_sendIPI(c64smp_t *smp, size_t index, uint16_t interrupt);
+
+// MMIO device with one 8 byte register per cpu. Storing a value to the register
+// of a cpu raises that interrupt on it, values above 63 are dropped with a warning.
+// Loading it reads the interrupts still pending on it. Map it once, it is
+// destroyed with the memory map.
+c64dev_t *c64smp_createIPIDevice(c64smp_t *smp);
+
+#endif // _c64smp_h_
\ No newline at end of file
@@ -0,0 +1,243 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#ifndef _c64tlb_h_
+#define _c64tlb_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <c64consts.h>
+#include <c64mm.h>
+#include <c64trace.h>
+
+#define TLB_SIZE 256 // Entries, power of two
+#define TLB_INVALID UINT64_MAX
+
+#define MM_PAGE_SIZE ((uint64_t)1 << MM_PAGE_SHIFT)
+#define MM_PAGE_MASK (MM_PAGE_SIZE - 1)
+
+// A guest page backed by plain host memory.
+// The host address of a byte in the page is address + addend.
+typedef struct
+{
+    uint64_t readTag;  // page number (address >> MM_PAGE_SHIFT), TLB_INVALID if empty
+    uint64_t writeTag; // same, separate so a page can be readable only
+    uintptr_t addend;
+} c64tlbEntry_t;
+
+// Software TLB in front of the memory map, one per cpu.
+// Only devices with host memory are cached, accesses to anything else and
+// accesses crossing a page go through c64mm_get* and c64mm_set*.
+// Entries are dropped when the map changes (see c64tlb_isCurrent).
+struct c64tlb
+{
+    c64mm_t *mm;
+    uint32_t mapGen; // mm->mapGen the entries were filled under
+    c64tlbEntry_t entries[TLB_SIZE];
+    c64trace_t *trace; // records every access made through the get and set functions, see c64cpu_setTracer
+};
+
+// Whether accesses are traced. Callers that go to host memory directly have
+// to take the get and set functions instead while it holds.
+#define c64tlb_tracing(tlb) (C64_TRACE && (tlb)->trace != NULL)
+
+void c64tlb_init(c64tlb_t *tlb, c64mm_t *mm);
+void c64tlb_flush(c64tlb_t *tlb);
+
+// Whether the entries still match the memory map. Checked by the cpu
+// before it runs, a change made while running takes effect the next time.
+static inline char c64tlb_isCurrent(const c64tlb_t *tlb)
+{
+    return tlb->mapGen == MM_LOAD(tlb->mm->mapGen);
+}
+
+// Slow paths, fill the entry for address if its page is host memory
+uint64_t c64tlb_getUint64Slow(c64tlb_t *tlb, uint64_t address);
+uint32_t c64tlb_getUint32Slow(c64tlb_t *tlb, uint64_t address);
+uint16_t c64tlb_getUint16Slow(c64tlb_t *tlb, uint64_t address);
+uint8_t c64tlb_getUint8Slow(c64tlb_t *tlb, uint64_t address);
+void c64tlb_setUint64Slow(c64tlb_t *tlb, uint64_t address, uint64_t value);
+void c64tlb_setUint32Slow(c64tlb_t *tlb, uint64_t address, uint32_t value);
+void c64tlb_setUint16Slow(c64tlb_t *tlb, uint64_t address, uint16_t value);
+void c64tlb_setUint8Slow(c64tlb_t *tlb, uint64_t address, uint8_t value);
+
+// Host address of address for block accesses, valid up to the end of its page.
+// NULL if the page is not host memory with the permission (MM_READ or MM_WRITE),
+// and while tracing.
+uint8_t *c64tlb_lookup(c64tlb_t *tlb, uint64_t address, uint8_t permission);
+
+static inline c64tlbEntry_t *c64tlb_entry(c64tlb_t *tlb, uint64_t address)
+{
+    return &tlb->entries[(address >> MM_PAGE_SHIFT) & (TLB_SIZE - 1)];
+}
+
+// Host address of size bytes at address, NULL if the access has to take the slow path
+static inline uint8_t *c64tlb_read(c64tlb_t *tlb, uint64_t address, size_t size)
+{
+    const c64tlbEntry_t *entry = c64tlb_entry(tlb, address);
+    if (entry->readTag != address >> MM_PAGE_SHIFT || (address & MM_PAGE_MASK) > MM_PAGE_SIZE - size)
+    {
+        return NULL;
+    }
+    return (uint8_t *)(uintptr_t)(address + entry->addend);
+}
+
+static inline uint8_t *c64tlb_write(c64tlb_t *tlb, uint64_t address, size_t size)
+{
+    const c64tlbEntry_t *entry = c64tlb_entry(tlb, address);
+    if (entry->writeTag != address >> MM_PAGE_SHIFT || (address & MM_PAGE_MASK) > MM_PAGE_SIZE - size)
+    {
+        return NULL;
+    }
+    return (uint8_t *)(uintptr_t)(address + entry->addend);
+}
+
+static inline uint64_t c64tlb_getUint64(c64tlb_t *tlb, uint64_t address)
+{
+    const uint8_t *host = c64tlb_read(tlb, address, sizeof(uint64_t));
+    uint64_t value;
+    if (host == NULL)
+    {
+        value = c64tlb_getUint64Slow(tlb, address);
+    }
+    else
+    {
+        memcpy(&value, host, sizeof(value));
+    }
+    if (c64tlb_tracing(tlb))
+    {
+        c64trace_record(tlb->trace, TRACE_READ, address, sizeof(value), value);
+    }
+    return value;
+}
+
+static inline uint32_t c64tlb_getUint32(c64tlb_t *tlb, uint64_t address)
+{
+    const uint8_t *host = c64tlb_read(tlb, address, sizeof(uint32_t));
+    uint32_t value;
+    if (host == NULL)
+    {
+        value = c64tlb_getUint32Slow(tlb, address);
+    }
+    else
+    {
+        memcpy(&value, host, sizeof(value));
+    }
+    if (c64tlb_tracing(tlb))
+    {
+        c64trace_record(tlb->trace, TRACE_READ, address, sizeof(value), value);
+    }
+    return value;
+}
+
+static inline uint16_t c64tlb_getUint16(c64tlb_t *tlb, uint64_t address)
+{
+    const uint8_t *host = c64tlb_read(tlb, address, sizeof(uint16_t));
+    uint16_t value;
+    if (host == NULL)
+    {
+        value = c64tlb_getUint16Slow(tlb, address);
+    }
+    else
+    {
+        memcpy(&value, host, sizeof(value));
+    }
+    if (c64tlb_tracing(tlb))
+    {
+        c64trace_record(tlb->trace, TRACE_READ, address, sizeof(value), value);
+    }
+    return value;
+}
+
+static inline uint8_t c64tlb_getUint8(c64tlb_t *tlb, uint64_t address)
+{
+    const uint8_t *host = c64tlb_read(tlb, address, sizeof(uint8_t));
+    const uint8_t value = host == NULL ? c64tlb_getUint8Slow(tlb, address) : *host;
+    if (c64tlb_tracing(tlb))
+    {
+        c64trace_record(tlb->trace, TRACE_READ, address, sizeof(value), value);
+    }
+    return value;
+}
+
+// Stores still bump the write generation, decoded and translated code depends on it
+static inline void c64tlb_setUint64(c64tlb_t *tlb, uint64_t address, uint64_t value)
+{
+    if (c64tlb_tracing(tlb))
+    {
+        c64trace_record(tlb->trace, TRACE_WRITE, address, sizeof(value), value);
+    }
+    uint8_t *host = c64tlb_write(tlb, address, sizeof(uint64_t));
+    if (host == NULL)
+    {
+        c64tlb_setUint64Slow(tlb, address, value);
+        return;
+    }
+    memcpy(host, &value, sizeof(value));
+    c64mm_touch(tlb->mm, address, sizeof(value));
+}
+
+static inline void c64tlb_setUint32(c64tlb_t *tlb, uint64_t address, uint32_t value)
+{
+    if (c64tlb_tracing(tlb))
+    {
+        c64trace_record(tlb->trace, TRACE_WRITE, address, sizeof(value), value);
+    }
+    uint8_t *host = c64tlb_write(tlb, address, sizeof(uint32_t));
+    if (host == NULL)
+    {
+        c64tlb_setUint32Slow(tlb, address, value);
+        return;
+    }
+    memcpy(host, &value, sizeof(value));
+    c64mm_touch(tlb->mm, address, sizeof(value));
+}
+
+static inline void c64tlb_setUint16(c64tlb_t *tlb, uint64_t address, uint16_t value)
+{
+    if (c64tlb_tracing(tlb))
+    {
+        c64trace_record(tlb->trace, TRACE_WRITE, address, sizeof(value), value);
+    }
+    uint8_t *host = c64tlb_write(tlb, address, sizeof(uint16_t));
+    if (host == NULL)
+    {
+        c64tlb_setUint16Slow(tlb, address, value);
+        return;
+    }
+    memcpy(host, &value, sizeof(value));
+    c64mm_touch(tlb->mm, address, sizeof(value));
+}
+
+static inline void c64tlb_setUint8(c64tlb_t *tlb, uint64_t address, uint8_t value)
+{
+    if (c64tlb_tracing(tlb))
+    {
+        c64trace_record(tlb->trace, TRACE_WRITE, address, sizeof(value), value);
+    }
+    uint8_t *host = c64tlb_write(tlb, address, sizeof(uint8_t));
+    if (host == NULL)
+    {
+        c64tlb_setUint8Slow(tlb, address, value);
+        return;
+    }
+    *host = value;
+    c64mm_touch(tlb->mm, address, sizeof(value));
+}
+
+#endif // _c64tlb_h_
\ No newline at end of file
@@ -0,0 +1,124 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#ifndef _c64trace_h_
+#define _c64trace_h_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <c64consts.h>
+
+// Execution trace, see c64cpu_setTracer. Only built into the cpu with
+// C64_TRACE. One cpu appends fixed size records to a ring, a thread of the
+// trace drains it into a file. Neither side takes a lock, the cpu drops
+// records while the ring is full instead of waiting.
+//
+// The file starts with TRACE_MAGIC. Every record follows as a tag byte,
+// kind | size code << 2, and varints:
+//  TRACE_INSN   zigzag(IP - previous IP), opcode
+//  TRACE_READ   zigzag(address - previous access address), value [, size]
+//  TRACE_WRITE  same as TRACE_READ
+//  TRACE_LOST   number of records dropped here
+// The size code is 0-4 for 1, 2, 4, 8 and 16 bytes, 7 if the size follows.
+
+#define TRACE_RING_SIZE 65536 // Records, power of two
+#define TRACE_BUFFER_SIZE 65536 // Bytes the drain thread encodes before writing them out
+#define TRACE_MAGIC "C64TRC1\n"
+
+#define TRACE_INSN 0  // address = IP, value = opcode, recorded before it runs
+#define TRACE_READ 1  // value = what was read, 0 for accesses over 8 bytes
+#define TRACE_WRITE 2 // value = what was written
+#define TRACE_LOST 3  // value = records dropped since the last one
+
+typedef struct
+{
+    uint64_t address;
+    uint64_t value;
+    uint32_t size;
+    uint8_t kind; // TRACE_*
+} c64traceRecord_t;
+
+struct c64trace
+{
+    c64traceRecord_t ring[TRACE_RING_SIZE];
+    uint64_t head;  // records written, only advanced by the cpu
+    uint64_t tail;  // records drained, only advanced by the drain thread
+    uint64_t lost;  // dropped since the last TRACE_LOST, cpu side
+    uint64_t stop;  // set by c64trace_destroy
+    c64cpu_t *cpu;  // the one cpu recording into the ring, see c64cpu_setTracer
+    FILE *file;
+    void *thread;   // host thread handle, see threadStart
+    uint64_t lastIp; // delta encoding state of the drain thread
+    uint64_t lastAddress;
+    uint8_t buffer[TRACE_BUFFER_SIZE];
+    size_t used;
+};
+
+// Writes to the file at path, NULL if it cannot be opened
+c64trace_t *c64trace_create(const char *path);
+// Drains what is left in the ring, stops the thread and closes the file
+void c64trace_destroy(c64trace_t *trace);
+
+// Turns a trace file into one line of text per record.
+// Returns 0, or -1 if in is not a trace or ends within a record.
+int c64trace_decode(FILE *in, FILE *out);
+
+#if defined(__GNUC__)
+#define TRACE_LOAD(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define TRACE_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
+#else
+// Enough on x86 hosts, where stores are not reordered with other stores
+#define TRACE_LOAD(field) (*(volatile uint64_t *)&(field))
+#define TRACE_STORE(field, value) (*(volatile uint64_t *)&(field) = (value))
+#endif
+
+static inline char c64trace_push(c64trace_t *trace, uint8_t kind, uint64_t address, uint32_t size, uint64_t value)
+{
+    const uint64_t head = trace->head;
+    if (head - TRACE_LOAD(trace->tail) == TRACE_RING_SIZE)
+    {
+        return 0;
+    }
+    c64traceRecord_t *record = &trace->ring[head & (TRACE_RING_SIZE - 1)];
+    record->address = address;
+    record->value = value;
+    record->size = size;
+    record->kind = kind;
+    TRACE_STORE(trace->head, head + 1);
+    return 1;
+}
+
+// Appends a record, called by the cpu thread only
+static inline void c64trace_record(c64trace_t *trace, uint8_t kind, uint64_t address, uint32_t size, uint64_t value)
+{
+    if (trace->lost > 0)
+    {
+        if (!c64trace_push(trace, TRACE_LOST, 0, 0, trace->lost))
+        {
+            trace->lost++;
+            return;
+        }
+        trace->lost = 0;
+    }
+    if (!c64trace_push(trace, kind, address, size, value))
+    {
+        trace->lost++;
+    }
+}
+
+#endif // _c64trace_h_
\ No newline at end of file
@@ -21,13 +21,12 @@ along with c64vm. If not, see <https://mit-license.org/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <c64consts.h>
 #ifdef _WIN32
 #include <Windows.h>
-#define SLEEP_MS(ms) Sleep(ms)
 #else
 #include <unistd.h>
-#define SLEEP_MS(ms) usleep(ms * 1000)
 #endif
 
 void error(const char *msg, ...);
@@ -37,4 +36,19 @@ void debug(const char *msg, ...);
 
 void out(const char *msg, ...); // Same as printf, but with a newline at the end
 
+uint64_t monotonicNs(); // Nanoseconds of a clock that never jumps, for measuring intervals
+void sleepNs(uint64_t ns);
+
+// Host threads and locks, as opaque handles
+void *threadStart(void (*run)(void *), void *arg); // Runs run(arg) on a new thread
+void threadJoin(void *thread);                     // Waits for the thread to end and frees the handle
+void *mutexCreate();
+void mutexLock(void *mutex);
+void mutexUnlock(void *mutex);
+void mutexDestroy(void *mutex);
+void *condCreate();
+void condWait(void *cond, void *mutex); // Releases mutex while waiting, may return without a signal
+void condSignal(void *cond);
+void condDestroy(void *cond);
+
 #endif // _c64utils_h_
\ No newline at end of file
@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2023 Noah Scholz
+
+This file is part of the c64vm project.
+
+c64vm is free software: you can redistribute it and/or modify
+it under the terms of the MIT License.
+
+c64vm is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the MIT License for more details.
+
+You should have received a copy of the MIT License
+along with c64vm. If not, see <https://mit-license.org/>.
+*/
+#ifndef _c64vec_h_
+#define _c64vec_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <c64consts.h>
+
+// A vector register, VREG_SIZE bytes split into unsigned lanes of 1, 2, 4 or 8 bytes.
+// Lane 0 is at the lowest address when loaded from or stored to memory.
+typedef union
+{
+    uint8_t u8[VREG_SIZE];
+    uint16_t u16[VREG_SIZE / 2];
+    uint32_t u32[VREG_SIZE / 4];
+    uint64_t u64[VREG_SIZE / 8];
+} c64vec_t;
+
+// Lane size in bytes of a vector opcode, taken from its high byte like the widths of LDI, LDBI, ...
+static inline uint8_t c64vec_laneSize(uint16_t opcode)
+{
+    static const uint8_t sizes[4] = {8, 1, 2, 4};
+    return sizes[(opcode >> 8) & 3];
+}
+
+// a = a op b lane by lane. Products keep their low half, compares set
+// matching lanes to all ones and the others to zero.
+void c64vec_add(c64vec_t *a, const c64vec_t *b, uint8_t lane);
+void c64vec_sub(c64vec_t *a, const c64vec_t *b, uint8_t lane);
+void c64vec_mul(c64vec_t *a, const c64vec_t *b, uint8_t lane);
+void c64vec_min(c64vec_t *a, const c64vec_t *b, uint8_t lane);
+void c64vec_max(c64vec_t *a, const c64vec_t *b, uint8_t lane);
+void c64vec_cmpeq(c64vec_t *a, const c64vec_t *b, uint8_t lane);
+void c64vec_cmpgt(c64vec_t *a, const c64vec_t *b, uint8_t lane);
+
+void c64vec_and(c64vec_t *a, const c64vec_t *b);
+void c64vec_or(c64vec_t *a, const c64vec_t *b);
+void c64vec_xor(c64vec_t *a, const c64vec_t *b);
+// Byte i of a becomes byte b[i] & 15 of a, or 0 if bit 7 of b[i] is set
+void c64vec_shuffle(c64vec_t *a, const c64vec_t *b);
+
+// Every lane of a = the low lane bytes of value
+void c64vec_splat(c64vec_t *a, uint64_t value, uint8_t lane);
+
+// Horizontal reductions over the lanes of a
+uint64_t c64vec_reduceAdd(const c64vec_t *a, uint8_t lane);
+uint64_t c64vec_reduceMin(const c64vec_t *a, uint8_t lane);
+uint64_t c64vec_reduceMax(const c64vec_t *a, uint8_t lane);
+// Bit i = top bit of byte i of a
+uint64_t c64vec_mask(const c64vec_t *a);
+
+#endif // _c64vec_h_
\ No newline at end of file
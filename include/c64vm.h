@@ -21,12 +21,15 @@ along with c64vm. If not, see <https://mit-license.org/>.
 #include <stdint.h>
 #include <stdlib.h>
 #include <c64mem.h>
+#include <c64file.h>
 #include <c64cpu.h>
 #include <c64consts.h>
 #include <c64mm.h>
+#include <c64smp.h>
 #include <c64instructions.h>
 #include <c64utils.h>
 
-void c64vm_run();
+// engine is one of ENGINE_SWITCH, ENGINE_THREADED or ENGINE_JIT
+void c64vm_run(char engine);
 
 #endif // _c64vm_h_
\ No newline at end of file